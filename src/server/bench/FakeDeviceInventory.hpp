@@ -0,0 +1,50 @@
+#pragma once
+#include "Device.hpp"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/// @brief a simulated inventory with settable free memory, to exercise placement on hosts without GPUs
+class FakeDeviceInventory : public kurento::module::objdet::DeviceInventory {
+public:
+  /**
+   * @param freeBytes free memory per device id, one entry per device
+   * @param totalBytes memory of every device
+   */
+  explicit FakeDeviceInventory(std::vector<size_t> freeBytes, size_t totalBytes = size_t(16) << 30)
+      : freeBytes(std::move(freeBytes)), totalBytes(totalBytes) {}
+
+  int getDeviceCount() override { return static_cast<int>(this->freeBytes.size()); }
+
+  bool selectDevice(int deviceId) override {
+    if (deviceId < 0 || deviceId >= this->getDeviceCount()) {
+      return false;
+    }
+    this->currentDevice = deviceId;
+    return true;
+  }
+
+  bool getMemInfo(int deviceId, size_t &freeBytes, size_t &totalBytes) override {
+    this->queriedDevices.push_back(deviceId);
+    if (deviceId < 0 || deviceId >= this->getDeviceCount()) {
+      return false;
+    }
+    freeBytes = this->freeBytes[deviceId];
+    totalBytes = this->totalBytes;
+    return true;
+  }
+
+  void setFreeBytes(int deviceId, size_t freeBytes) { this->freeBytes[deviceId] = freeBytes; }
+
+  /// @brief the device last selected, 0 at first
+  int getCurrentDevice() const { return this->currentDevice; }
+
+  /// @brief the devices getMemInfo was asked about, in order, and forget them
+  std::vector<int> takeQueriedDevices() { return std::exchange(this->queriedDevices, {}); }
+
+private:
+  std::vector<size_t> freeBytes;
+  size_t totalBytes;
+  int currentDevice = 0;
+  std::vector<int> queriedDevices;
+};
@@ -0,0 +1,124 @@
+#include "StubDetector.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+/// @brief input size of the exported models when none is configured
+static const int defaultInputWH = 640;
+
+static const int inputChannel = 3;
+
+StubDetector::StubDetector(int objectCount, int computeUs, std::vector<int> inputSizes, int maxBatch,
+                           utils::HostAllocator &hostAllocator)
+    : objectCount(std::max(objectCount, 0)), computeUs(std::max(computeUs, 0)), inputSizes(std::move(inputSizes)),
+      maxBatch(std::max(maxBatch, 1)) {
+  if (this->inputSizes.empty()) {
+    this->inputSizes.push_back(defaultInputWH);
+  }
+  std::sort(this->inputSizes.begin(), this->inputSizes.end(), std::greater<int>());
+  this->requestedWH.store(this->inputSizes.front(), std::memory_order_relaxed);
+
+  this->inputBuffer = utils::HostBuffer<float>(
+      hostAllocator, static_cast<size_t>(this->maxBatch) * inputChannel * this->inputSizes.front() * this->inputSizes.front());
+  this->inputs.resize(this->maxBatch);
+  this->boxes.resize(this->objectCount * 4);
+  this->confidences.resize(this->objectCount);
+  this->labels.resize(this->objectCount);
+  this->singleImage.resize(1);
+  this->singleOutput.resize(1);
+  this->outputBuffers = {&this->boxCount, this->boxes.data(), this->confidences.data(), this->labels.data()};
+}
+
+bool StubDetector::setInputSize(int wh) {
+  if (wh == 0) {
+    wh = this->inputSizes.front();
+  }
+  if (std::find(this->inputSizes.begin(), this->inputSizes.end(), wh) == this->inputSizes.end()) {
+    return false;
+  }
+  this->requestedWH.store(wh, std::memory_order_relaxed);
+  return true;
+}
+
+void StubDetector::setOutputLimits(float minConfidence, int maxCount) {
+  this->minConfidence = minConfidence;
+  this->maxCount = maxCount;
+}
+
+void StubDetector::infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) {
+  // a batch of one in reused containers, the output keeps its capacity across frames
+  this->singleImage[0] = &rgbImg;
+  this->singleOutput[0].swap(output);
+  this->inferBatch(this->singleImage, this->singleOutput);
+  this->singleOutput[0].swap(output);
+}
+
+void StubDetector::inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) {
+  using kurento::module::objdet::Stage;
+  int wh = this->requestedWH.load(std::memory_order_relaxed);
+  int total = static_cast<int>(rgbImgs.size());
+  outputs.resize(total);
+
+  // engine runs of at most maxBatch images, the input buffers hold no more
+  for (int first = 0; first < total; first += this->maxBatch) {
+    int batchSize = std::min(total - first, this->maxBatch);
+    auto start = std::chrono::steady_clock::now();
+    this->preprocess(rgbImgs, first, batchSize, wh);
+    auto computeStart = std::chrono::steady_clock::now();
+    this->compute(wh);
+    auto decodeStart = std::chrono::steady_clock::now();
+    // every image of a batch gets the same made-up outputs, mapped back to its own size
+    for (int i = 0; i < batchSize; i++) {
+      utils::postprocess(this->outputBuffers, this->inputs[i], outputs[first + i], utils::COCO_CLASSNAMES, this->minConfidence,
+                         this->maxCount);
+    }
+
+    if (this->metrics != nullptr) {
+      auto us = [](std::chrono::steady_clock::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+      this->metrics->record(Stage::PREPROCESS, us(computeStart - start));
+      this->metrics->record(Stage::COMPUTE, us(decodeStart - computeStart));
+      this->metrics->record(Stage::POSTPROCESS, kurento::module::objdet::elapsedUs(decodeStart));
+    }
+  }
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void StubDetector::preprocess(const std::vector<const cv::Mat *> &rgbImgs, int first, int batchSize, int wh) {
+  size_t itemSize = static_cast<size_t>(inputChannel) * wh * wh;
+  for (int i = 0; i < batchSize; i++) {
+    utils::preprocessInto(*rgbImgs[first + i], this->inputBuffer.data() + i * itemSize, this->inputs[i], this->letterboxPlan, wh,
+                          114);
+  }
+}
+
+void StubDetector::compute(int wh) {
+  if (this->computeUs > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(this->computeUs));
+  }
+
+  //// boxes of a fixed size on a grid, walking right and down, scores descending like the NMS plugin emits them
+  this->runIndex++;
+  int columns = 1;
+  while (columns * columns < this->objectCount) {
+    columns++;
+  }
+  float cell = static_cast<float>(wh) / columns;
+  float side = cell * 0.6f;
+  for (int i = 0; i < this->objectCount; i++) {
+    float drift = static_cast<float>((this->runIndex + i * 7) % 64) / 64 * (cell - side);
+    float x1 = (i % columns) * cell + drift;
+    float y1 = (i / columns) * cell + drift / 2;
+    float *box = this->boxes.data() + i * 4;
+    box[0] = x1;
+    box[1] = y1;
+    box[2] = x1 + side;
+    box[3] = y1 + side;
+    this->confidences[i] = 0.95f - 0.9f * i / std::max(this->objectCount, 1);
+    this->labels[i] = i % static_cast<int>(utils::COCO_CLASSNAMES.size());
+  }
+  this->boxCount = this->objectCount;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "Detector.hpp"
+#include "allocator.hpp"
+#include "letterbox.hpp"
+#include <atomic>
+#include <vector>
+
+/**
+ * @brief a detector without a model: the real preprocess and postprocess around a fixed engine time
+ *
+ * The engine outputs are made up in the layout of the TensorRT NMS plugin, boxes drifting a little every run, so that
+ * the postprocess, the tracker, the overlay and the encoders see the same kind of input as with a real model.
+ */
+class StubDetector : public Detector {
+public:
+  /**
+   * @param objectCount objects in the engine outputs, before the confidence filter
+   * @param computeUs engine time per run, slept like a session waiting for the GPU
+   * @param inputSizes selectable input sizes, 640 if empty
+   * @param maxBatch images per engine run in inferBatch
+   * @param hostAllocator provider of the input buffer, as the engine IO staging buffers of Yolov7trt
+   */
+  StubDetector(int objectCount, int computeUs, std::vector<int> inputSizes, int maxBatch, utils::HostAllocator &hostAllocator);
+
+  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) override;
+
+  std::vector<int> getInputSizes() const override { return this->inputSizes; }
+
+  int getInputSize() const override { return this->requestedWH.load(std::memory_order_relaxed); }
+
+  bool setInputSize(int wh) override;
+
+  void setOutputLimits(float minConfidence, int maxCount) override;
+
+  void setMetrics(kurento::module::objdet::StageMetrics *metrics) override { this->metrics = metrics; }
+
+  int getMaxBatchSize() const override { return this->maxBatch; }
+
+  void inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) override;
+
+private:
+  int objectCount;
+  int computeUs;
+  std::vector<int> inputSizes;
+  int maxBatch;
+  std::atomic<int> requestedWH;
+
+  float minConfidence = 0;
+  int maxCount = 100;
+  kurento::module::objdet::StageMetrics *metrics = nullptr;
+
+  //// preprocess buffers, one input per batch item
+  utils::HostBuffer<float> inputBuffer;
+  std::vector<utils::Yolov7Input> inputs;
+  utils::LetterboxPlan letterboxPlan;
+
+  //// engine outputs in the NMS plugin layout: count, boxes, scores, classes
+  int boxCount = 0;
+  std::vector<float> boxes;
+  std::vector<float> confidences;
+  std::vector<int> labels;
+  std::vector<void *> outputBuffers;
+
+  //// infer as a batch of one
+  std::vector<const cv::Mat *> singleImage;
+  std::vector<std::vector<utils::Obj>> singleOutput;
+
+  /// @brief runs so far, moves the boxes
+  int runIndex = 0;
+
+  /// @brief letterbox batchSize images from rgbImgs[first] on into the input buffer, batchSize at most maxBatch
+  void preprocess(const std::vector<const cv::Mat *> &rgbImgs, int first, int batchSize, int wh);
+
+  /// @brief the engine run: sleep, then fill the outputs
+  void compute(int wh);
+};
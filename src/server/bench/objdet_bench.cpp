@@ -0,0 +1,1317 @@
+/**
+ * @brief offline benchmark of the detection path
+ *
+ * Replays a video file, an image directory or synthetic frames through the filter's own FramePipeline (checkout,
+ * inference with its preprocess and postprocess, tracking, overlay, box encoding) in N simulated sessions against one
+ * ModelPool, and prints throughput, per-stage percentiles and allocations per frame as JSON.
+ */
+#include "BoxEncoder.hpp"
+#include "DetectorFactory.hpp"
+#include "Device.hpp"
+#include "FakeDeviceInventory.hpp"
+#include "FramePipeline.hpp"
+#include "Metrics.hpp"
+#include "ModelPool.hpp"
+#include "OverlayRenderer.hpp"
+#include "Placement.hpp"
+#include "Residency.hpp"
+#include "StubDetector.hpp"
+#include "allocator.hpp"
+#include "letterbox.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <gst/gst.h>
+#include <iostream>
+#include <json/json.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace kurento::module::objdet;
+
+//// allocations of the calling thread, so that every session only counts its own frames
+static thread_local uint64_t allocCount = 0;
+static thread_local uint64_t allocBytes = 0;
+
+void *operator new(std::size_t size) {
+  allocCount++;
+  allocBytes += size;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+// the temporary buffers of std::stable_sort come from here, they must be counted and freed the same way
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  allocCount++;
+  allocBytes += size;
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { std::free(ptr); }
+
+namespace {
+
+/// @brief model name of the generated pool config
+const char *benchModelName = "bench";
+
+//// host buffers of the stub instances, counted to show that the sessions never allocate them once the instances exist
+utils::SystemAllocator systemAllocator;
+utils::CountingAllocator stubHostAllocator(systemAllocator);
+
+struct Options {
+  //// frame source, synthetic frames if neither a video nor an image directory is given
+  std::string videoPath;
+  std::string imageDir;
+  cv::Size frameSize = cv::Size(1280, 720);
+  int frameCount = 300;
+  int loops = 1;
+
+  //// sessions and pool
+  int sessionCount = 1;
+  int instanceCount = 0;
+  int maxBatch = 1;
+  bool isLazy = false;
+  bool isCheckoutPerFrame = false;
+  std::string configPath;
+  std::string modelName;
+
+  //// backend of the generated config
+  std::string backend = "stub";
+  std::string modelPath;
+  std::vector<int> inputSizes;
+  int stubObjects = 20;
+  int stubComputeUs = 5000;
+
+  //// session settings, as set by the client of a filter
+  int inputSize = 0;
+  float confidence = 0.5f;
+  int boxLimit = 100;
+  bool isDrawing = true;
+  std::string format = "json";
+  bool isTracking = false;
+  bool isTiling = false;
+  float tileOverlap = 0.2f;
+  bool isGating = false;
+  float targetFps = 0;
+
+  //// checks run instead of the sessions
+  bool isPlacementCheck = false;
+  bool isResidencyCheck = false;
+  bool isPreprocessReference = false;
+  bool isDrawReference = false;
+  bool isAdmissionCheck = false;
+  bool isReloadCheck = false;
+  float maxDifferingShare = 0.01f;
+  int maxChannelDiff = 0;
+
+  //// report
+  std::string outputPath;
+  std::string baselinePath;
+  float tolerance = 0.1f;
+};
+
+void printUsage() {
+  std::cerr << "usage: objdet-bench [options]\n"
+               "frames:\n"
+               "  --video PATH            replay a video file\n"
+               "  --images DIR            replay the images of a directory, by file name\n"
+               "  --size WxH              synthetic frame size (default 1280x720)\n"
+               "  --frames N              frames loaded or generated (default 300)\n"
+               "  --loops N               replays of the frames per session (default 1)\n"
+               "sessions and pool:\n"
+               "  --sessions N            parallel sessions (default 1)\n"
+               "  --instances N           model instances (default one per session)\n"
+               "  --max-batch N           cross-session batch size (default 1)\n"
+               "  --lazy                  load the model on the first checkout\n"
+               "  --checkout-per-frame    get and return the model around every inference\n"
+               "  --config PATH           use a model pool config instead of generating one\n"
+               "  --model NAME            model of the config (default: its default model)\n"
+               "backend of the generated config:\n"
+               "  --backend NAME          stub, opencv-cpu or tensorrt (default stub)\n"
+               "  --model-path PATH       model file of the opencv-cpu or tensorrt backend\n"
+               "  --input-sizes A,B,...   selectable input sizes of the model\n"
+               "  --stub-objects N        objects per frame of the stub backend (default 20)\n"
+               "  --stub-compute-us N     engine time of the stub backend (default 5000)\n"
+               "session settings:\n"
+               "  --input-size N          input size of the sessions (default: the largest)\n"
+               "  --confidence F          confidence threshold (default 0.5)\n"
+               "  --box-limit N           maximum boxes per frame (default 100)\n"
+               "  --no-drawing            do not draw the boxes\n"
+               "  --format NAME           json, binary or columnar (default json)\n"
+               "  --tracking              track objects between inferences\n"
+               "  --tiling OVERLAP        infer on a grid of tiles\n"
+               "  --motion-gate           skip the inference on static frames\n"
+               "  --fps F                 frame rate per session, 0 for as fast as possible (default 0)\n"
+               "checks, run instead of the sessions:\n"
+               "  --check-placement       rank devices with every placement policy on a simulated inventory, exit\n"
+               "                          with 2 if one picks the wrong device\n"
+               "  --check-residency       plan evictions of simulated footprints under a memory budget, exit with 2\n"
+               "                          if models are not unloaded least recently used first or the budget is not met\n"
+               "  --preprocess-reference  time the fused preprocess against utils::preprocess on the frames, exit\n"
+               "                          with 2 if they differ by more than 1/255\n"
+               "  --draw-reference        time the overlay against utils::drawObjs with the boxes of the stub\n"
+               "                          backend on the frames, exit with 2 if more pixels differ than allowed\n"
+               "  --max-differing-share F share of pixels the overlay may draw differently (default 0.01)\n"
+               "  --max-channel-diff N    largest channel difference allowed outside of box corners (default 0)\n"
+               "  --check-admission       queue --sessions sessions on --instances stub instances, exit with 2 if they\n"
+               "                          are not served by priority and in order, or the cap, cancel or timeout fail\n"
+               "  --check-reload          rewrite and reload the config of a pool of stub instances, exit with 2 if\n"
+               "                          instances are not added, released or kept as the new config asks\n"
+               "report:\n"
+               "  --output PATH           write the JSON report to a file instead of stdout\n"
+               "  --baseline PATH         exit with 2 if the throughput, frame p95 or allocations regressed against a report\n"
+               "  --tolerance F           allowed regression against the baseline (default 0.1)\n";
+}
+
+/// @brief parse the command line, false on an unknown option or a missing value
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string name = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::invalid_argument("missing value of " + name);
+      }
+      return argv[++i];
+    };
+    if (name == "--video") {
+      options.videoPath = value();
+    } else if (name == "--images") {
+      options.imageDir = value();
+    } else if (name == "--size") {
+      std::string size = value();
+      if (std::sscanf(size.c_str(), "%dx%d", &options.frameSize.width, &options.frameSize.height) != 2) {
+        throw std::invalid_argument("invalid size " + size);
+      }
+    } else if (name == "--frames") {
+      options.frameCount = std::stoi(value());
+    } else if (name == "--loops") {
+      options.loops = std::stoi(value());
+    } else if (name == "--sessions") {
+      options.sessionCount = std::stoi(value());
+    } else if (name == "--instances") {
+      options.instanceCount = std::stoi(value());
+    } else if (name == "--max-batch") {
+      options.maxBatch = std::stoi(value());
+    } else if (name == "--lazy") {
+      options.isLazy = true;
+    } else if (name == "--checkout-per-frame") {
+      options.isCheckoutPerFrame = true;
+    } else if (name == "--config") {
+      options.configPath = value();
+    } else if (name == "--model") {
+      options.modelName = value();
+    } else if (name == "--backend") {
+      options.backend = value();
+    } else if (name == "--model-path") {
+      options.modelPath = value();
+    } else if (name == "--input-sizes") {
+      std::string sizes = value();
+      for (size_t start = 0; start < sizes.size();) {
+        size_t end = std::min(sizes.find(',', start), sizes.size());
+        options.inputSizes.push_back(std::stoi(sizes.substr(start, end - start)));
+        start = end + 1;
+      }
+    } else if (name == "--stub-objects") {
+      options.stubObjects = std::stoi(value());
+    } else if (name == "--stub-compute-us") {
+      options.stubComputeUs = std::stoi(value());
+    } else if (name == "--input-size") {
+      options.inputSize = std::stoi(value());
+    } else if (name == "--confidence") {
+      options.confidence = std::stof(value());
+    } else if (name == "--box-limit") {
+      options.boxLimit = std::stoi(value());
+    } else if (name == "--no-drawing") {
+      options.isDrawing = false;
+    } else if (name == "--format") {
+      options.format = value();
+    } else if (name == "--tracking") {
+      options.isTracking = true;
+    } else if (name == "--tiling") {
+      options.isTiling = true;
+      options.tileOverlap = std::stof(value());
+    } else if (name == "--motion-gate") {
+      options.isGating = true;
+    } else if (name == "--fps") {
+      options.targetFps = std::stof(value());
+    } else if (name == "--check-placement") {
+      options.isPlacementCheck = true;
+    } else if (name == "--check-residency") {
+      options.isResidencyCheck = true;
+    } else if (name == "--preprocess-reference") {
+      options.isPreprocessReference = true;
+    } else if (name == "--draw-reference") {
+      options.isDrawReference = true;
+    } else if (name == "--check-admission") {
+      options.isAdmissionCheck = true;
+    } else if (name == "--check-reload") {
+      options.isReloadCheck = true;
+    } else if (name == "--max-differing-share") {
+      options.maxDifferingShare = std::stof(value());
+    } else if (name == "--max-channel-diff") {
+      options.maxChannelDiff = std::stoi(value());
+    } else if (name == "--output") {
+      options.outputPath = value();
+    } else if (name == "--baseline") {
+      options.baselinePath = value();
+    } else if (name == "--tolerance") {
+      options.tolerance = std::stof(value());
+    } else {
+      return false;
+    }
+  }
+  return options.sessionCount > 0 && options.frameCount > 0 && options.loops > 0;
+}
+
+/// @brief a frame as the filter gets it from KMS, BGRA
+cv::Mat toFilterFrame(const cv::Mat &image) {
+  cv::Mat frame;
+  if (image.channels() == 1) {
+    cv::cvtColor(image, frame, cv::COLOR_GRAY2BGRA);
+  } else if (image.channels() == 3) {
+    cv::cvtColor(image, frame, cv::COLOR_BGR2BGRA);
+  } else {
+    frame = image.clone();
+  }
+  return frame;
+}
+
+/// @brief load or generate the frames to replay, decoded up front so that decoding is not measured
+void loadFrames(const Options &options, std::vector<cv::Mat> &frames) {
+  if (options.videoPath.empty() == false) {
+    cv::VideoCapture capture(options.videoPath);
+    if (capture.isOpened() == false) {
+      throw std::runtime_error("video cannot be opened: " + options.videoPath);
+    }
+    cv::Mat image;
+    while (static_cast<int>(frames.size()) < options.frameCount && capture.read(image)) {
+      frames.push_back(toFilterFrame(image));
+    }
+  } else if (options.imageDir.empty() == false) {
+    std::vector<fs::path> paths;
+    for (const fs::directory_entry &entry : fs::directory_iterator(options.imageDir)) {
+      if (entry.is_regular_file()) {
+        paths.push_back(entry.path());
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+    for (const fs::path &path : paths) {
+      if (static_cast<int>(frames.size()) >= options.frameCount) {
+        break;
+      }
+      cv::Mat image = cv::imread(path.string(), cv::IMREAD_COLOR);
+      if (image.empty() == false) {
+        frames.push_back(toFilterFrame(image));
+      }
+    }
+  } else {
+    // a still background with a few moving rectangles, so that the motion gate sees both kinds of frames
+    for (int i = 0; i < options.frameCount; i++) {
+      cv::Mat frame(options.frameSize, CV_8UC4, cv::Scalar(90, 110, 120, 255));
+      if ((i / 30) % 2 == 0) {
+        for (int k = 0; k < 4; k++) {
+          int x = (k * options.frameSize.width / 4 + i * 4) % std::max(options.frameSize.width - 80, 1);
+          int y = options.frameSize.height / 5 * (k + 1) - 40;
+          cv::rectangle(frame, cv::Rect(x, y, 80, 80), cv::Scalar(40 * k, 200, 255 - 40 * k, 255), -1);
+        }
+      }
+      frames.push_back(frame);
+    }
+  }
+  if (frames.empty()) {
+    throw std::runtime_error("no frames to replay");
+  }
+}
+
+/// @brief the stub backend, configured by the "stub_objects" and "stub_compute_us" keys of a model entry
+class StubDetectorFactory : public DetectorFactory {
+public:
+  explicit StubDetectorFactory(const Json::Value &modelParam)
+      : objectCount(modelParam.get("stub_objects", 20).asInt()), computeUs(modelParam.get("stub_compute_us", 5000).asInt()) {
+    for (const Json::Value &size : modelParam["input_sizes"]) {
+      this->inputSizes.push_back(size.asInt());
+    }
+  }
+
+  bool usesDevice() const override { return false; }
+
+  Detector *createDetector(int index, int deviceId) override {
+    return new StubDetector(this->objectCount, this->computeUs, this->inputSizes, 1, stubHostAllocator);
+  }
+
+  Detector *createBatchEngine(int maxBatch, int deviceId) override {
+    return new StubDetector(this->objectCount, this->computeUs, this->inputSizes, maxBatch, stubHostAllocator);
+  }
+
+private:
+  int objectCount;
+  int computeUs;
+  std::vector<int> inputSizes;
+};
+
+/// @brief the pool config of the run, read from --config or generated with one model
+Json::Value makeConfig(const Options &options) {
+  Json::Value config;
+  if (options.configPath.empty() == false) {
+    std::ifstream fileStream(options.configPath, std::ifstream::binary);
+    Json::Reader reader;
+    if (reader.parse(fileStream, config) == false) {
+      throw std::runtime_error("config cannot be parsed: " + options.configPath);
+    }
+    if (options.isLazy) {
+      config["lazy_load"] = true;
+    }
+    return config;
+  }
+
+  Json::Value model;
+  model["enabled"] = true;
+  model["name"] = benchModelName;
+  model["backend"] = options.backend;
+  model["max_model_limit"] = options.instanceCount > 0 ? options.instanceCount : options.sessionCount;
+  model["max_batch"] = options.maxBatch;
+  // sessions never heartbeat here, they must not time out during a long run
+  model["session_timeout_sec"] = 24 * 3600;
+  // the pool only checks that the file exists, the stub backend does not read it
+  model["model_abs_path"] = options.modelPath.empty() ? "/proc/self/exe" : options.modelPath;
+  model["stub_objects"] = options.stubObjects;
+  model["stub_compute_us"] = options.stubComputeUs;
+  for (int size : options.inputSizes) {
+    model["input_sizes"].append(size);
+  }
+  config["device_id"] = 0;
+  config["default_model_name"] = benchModelName;
+  config["lazy_load"] = options.isLazy;
+  config["models"].append(model);
+  return config;
+}
+
+/// @brief one simulated filter: the FramePipeline of ObjDetOpenCVImpl over the replayed frames
+class BenchSession {
+public:
+  BenchSession(ModelPool &pool, const Options &options, const std::string &modelName, const std::vector<cv::Mat> &frames, int index)
+      : pool(pool), options(options), modelName(modelName), frames(frames), sessionId("bench-" + std::to_string(index)) {
+    BoxFormat format = BoxFormat::JSON;
+    if (BoxEncoder::parseFormat(options.format, format) == false) {
+      throw std::invalid_argument("invalid format " + options.format);
+    }
+    this->pipeline.setFormat(format);
+    this->pipeline.setTracking(options.isTracking, 1000);
+    this->pipeline.setMotionGate(options.isGating, 0.01f, 2000);
+    if (options.isTiling) {
+      this->pipeline.getTiling().setGrid(options.tileOverlap);
+    }
+    this->pipeline.setModelMetrics(pool.getModelMetrics(modelName));
+  }
+
+  void run() {
+    if (this->options.isCheckoutPerFrame == false) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      this->model = this->checkout();
+      this->firstCheckoutMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      if (this->options.inputSize > 0 && this->model->setInputSize(this->options.inputSize) == false) {
+        throw std::runtime_error("input size not supported: " + std::to_string(this->options.inputSize));
+      }
+    }
+
+    std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point nextFrame = runStart;
+    std::chrono::steady_clock::duration interval =
+        this->options.targetFps > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                          std::chrono::duration<double>(1 / this->options.targetFps))
+                                    : std::chrono::steady_clock::duration::zero();
+    for (int loop = 0; loop < this->options.loops; loop++) {
+      for (const cv::Mat &frame : this->frames) {
+        // the buffer the filter gets, not part of the measured path
+        frame.copyTo(this->mat);
+        uint64_t allocsBefore = allocCount;
+        uint64_t bytesBefore = allocBytes;
+        this->processFrame();
+        this->allocs += allocCount - allocsBefore;
+        this->bytes += allocBytes - bytesBefore;
+        this->frameCount++;
+        if (interval.count() > 0) {
+          nextFrame += interval;
+          std::this_thread::sleep_until(nextFrame);
+        }
+      }
+    }
+    this->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+    if (this->model != nullptr) {
+      this->pool.returnModel(this->modelName, this->model, this->sessionId);
+      this->model = nullptr;
+    }
+  }
+
+  Json::Value toJSON() const {
+    Json::Value json;
+    json["frames"] = static_cast<Json::UInt64>(this->frameCount);
+    json["inferred"] = static_cast<Json::UInt64>(this->inferCount);
+    json["fps"] = this->seconds > 0 ? this->frameCount / this->seconds : 0;
+    json["checkoutWaits"] = static_cast<Json::UInt64>(this->checkoutWaits);
+    return json;
+  }
+
+  uint64_t frameCount = 0;
+  uint64_t inferCount = 0;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+  uint64_t payloadBytes = 0;
+  uint64_t checkoutWaits = 0;
+  double firstCheckoutMs = 0;
+  double seconds = 0;
+
+private:
+  ModelPool &pool;
+  const Options &options;
+  std::string modelName;
+  const std::vector<cv::Mat> &frames;
+  std::string sessionId;
+  FramePipeline pipeline;
+
+  Detector *model = nullptr;
+  cv::Mat mat;
+  std::vector<utils::Obj> frameBoxes;
+  std::vector<utils::Obj> gatedBoxes;
+  std::vector<utils::Obj> trackedBoxes;
+
+  /// @brief get an instance, waiting while all of them are taken by other sessions
+  Detector *checkout() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Detector *model = this->pool.getModel(this->modelName);
+    while (model == nullptr) {
+      this->checkoutWaits++;
+      if (this->pool.modelExists(this->modelName) == false) {
+        throw std::runtime_error("model not found: " + this->modelName);
+      }
+      std::this_thread::yield();
+      model = this->pool.getModel(this->modelName);
+    }
+    this->pipeline.recordStage(Stage::CHECKOUT, start);
+    return model;
+  }
+
+  void processFrame() {
+    std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+    this->pipeline.countEvent(Counter::FRAMES);
+    std::vector<utils::Obj> *objs = &this->frameBoxes;
+    if (this->pipeline.isStatic(this->mat)) {
+      objs = this->pipeline.predict(this->mat.size(), this->trackedBoxes) ? &this->trackedBoxes : &this->gatedBoxes;
+    } else {
+      this->inferFrame(this->frameBoxes);
+      this->pipeline.track(this->frameBoxes);
+      this->gatedBoxes = this->frameBoxes;
+    }
+    if (this->options.isDrawing) {
+      this->pipeline.draw(this->mat, *objs);
+    }
+    this->pipeline.encode(*objs, this->mat.size(), [this](const std::string &payload) { this->payloadBytes += payload.size(); });
+    this->pipeline.recordStage(Stage::FRAME, frameStart);
+  }
+
+  void inferFrame(std::vector<utils::Obj> &objs) {
+    if (this->options.isCheckoutPerFrame) {
+      this->model = this->checkout();
+      if (this->options.inputSize > 0) {
+        this->model->setInputSize(this->options.inputSize);
+      }
+    }
+    this->pipeline.infer(*this->model, this->mat, this->options.confidence, this->options.boxLimit, objs);
+    this->inferCount++;
+    if (this->options.isCheckoutPerFrame) {
+      this->pool.returnModel(this->modelName, this->model, this->sessionId);
+      this->model = nullptr;
+    }
+  }
+};
+
+/// @brief nanoseconds of one histogram record, the cost the metrics add to every stage
+double measureRecordNs() {
+  const int records = 1000000;
+  StageMetrics scratch;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < records; i++) {
+    scratch.record(Stage::FRAME, static_cast<uint64_t>(i & 0xffff));
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / records;
+}
+
+/// @brief the device ids a placement ranks first over a number of checkouts
+std::vector<int> firstDevices(Placement &placement, DeviceInventory &inventory, const DeviceLoad &load, int checkouts) {
+  std::vector<int> firsts;
+  std::vector<int> order;
+  for (int i = 0; i < checkouts; i++) {
+    placement.rank(inventory, load, order);
+    firsts.push_back(placement.getDevices()[order[0]]);
+  }
+  return firsts;
+}
+
+/// @brief the placement policies on a simulated inventory of three devices, false if one ranks wrongly
+bool checkPlacement(Json::Value &report) {
+  const size_t gib = size_t(1) << 30;
+  FakeDeviceInventory inventory({2 * gib, 8 * gib, 4 * gib});
+  DeviceLoad load;
+  bool isPassed = true;
+  auto check = [&](const char *what, const std::vector<int> &firsts, const std::vector<int> &expected) {
+    Json::Value result;
+    for (int deviceId : firsts) {
+      result["devices"].append(deviceId);
+    }
+    result["passed"] = firsts == expected;
+    report["placement"][what] = result;
+    isPassed = isPassed && firsts == expected;
+  };
+
+  //// every device in turn
+  Placement placement;
+  placement.configure(PlacementPolicy::ROUND_ROBIN, {0, 1, 2});
+  check("roundRobin", firstDevices(placement, inventory, load, 4), {0, 1, 2, 0});
+
+  //// the fewest checked-out instances, equal devices in turn
+  placement.configure(PlacementPolicy::LEAST_LOADED, {0, 1, 2});
+  load.add(0, 3);
+  load.add(1, 1);
+  load.add(2, 2);
+  check("leastLoaded", firstDevices(placement, inventory, load, 2), {1, 1});
+  load.add(1, 2);
+  load.add(2, 1);
+  check("leastLoadedTie", firstDevices(placement, inventory, load, 3), {0, 1, 2});
+
+  //// the most free memory, following the inventory as it changes
+  placement.configure(PlacementPolicy::MEMORY_AWARE, {0, 1, 2});
+  std::vector<int> firsts = firstDevices(placement, inventory, load, 2);
+  inventory.setFreeBytes(1, gib);
+  std::vector<int> afterLoad = firstDevices(placement, inventory, load, 1);
+  firsts.insert(firsts.end(), afterLoad.begin(), afterLoad.end());
+  check("memoryAware", firsts, {1, 1, 2});
+
+  //// a repeated id weights its device, instances are spread in config order
+  placement.configure(PlacementPolicy::ROUND_ROBIN, {0, 0, 1});
+  std::vector<int> instanceDevices;
+  for (int i = 0; i < 4; i++) {
+    instanceDevices.push_back(placement.getDevices()[placement.getInstanceDevice(i)]);
+  }
+  check("weightedInstances", instanceDevices, {0, 0, 1, 0});
+
+  //// memory-aware ranking asks for the memory of the model's devices only, once each, and selects none of them
+  inventory.selectDevice(2);
+  inventory.takeQueriedDevices();
+  placement.configure(PlacementPolicy::MEMORY_AWARE, {1, 0});
+  firstDevices(placement, inventory, load, 1);
+  std::vector<int> queried = inventory.takeQueriedDevices();
+  std::sort(queried.begin(), queried.end());
+  check("memInfoDevices", queried, {0, 1});
+  check("currentDeviceKept", {inventory.getCurrentDevice()}, {2});
+
+  PlacementPolicy policy;
+  bool isParsed = Placement::parsePolicy("least-loaded", policy) && policy == PlacementPolicy::LEAST_LOADED &&
+                  Placement::parsePolicy("fastest", policy) == false;
+  report["placement"]["parsePolicy"]["passed"] = isParsed;
+  report["passed"] = isPassed && isParsed;
+  return isPassed && isParsed;
+}
+
+/**
+ * @brief the fused preprocess against the OpenCV one it replaced, on the replayed frames at every input size
+ *
+ * Both run loops times over the frames at each size for the timings, the tensors of the first pass are compared.
+ */
+bool checkPreprocess(const Options &options, const std::vector<cv::Mat> &frames, Json::Value &report) {
+  const float tolerance = 1.f / 255;
+  std::vector<int> sizes = options.inputSizes.empty() ? std::vector<int>{640} : options.inputSizes;
+  bool isPassed = true;
+  for (int wh : sizes) {
+    size_t tensorSize = static_cast<size_t>(3) * wh * wh;
+    std::vector<float> fused(tensorSize);
+    utils::Yolov7Input fusedInput;
+    utils::Yolov7Input referenceInput;
+    utils::LetterboxPlan plan;
+    float maxDiff = 0;
+    double sumDiff = 0;
+    bool isGeometrySame = true;
+    double fusedSeconds = 0;
+    double referenceSeconds = 0;
+    for (int loop = 0; loop < options.loops; loop++) {
+      for (const cv::Mat &frame : frames) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        utils::preprocess(frame, referenceInput, wh, 114);
+        referenceSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        utils::preprocessInto(frame, fused.data(), fusedInput, plan, wh, 114);
+        fusedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (loop > 0) {
+          continue;
+        }
+        if (referenceInput.mat.total() != tensorSize) {
+          throw std::runtime_error("reference preprocess produced " + std::to_string(referenceInput.mat.total()) + " values");
+        }
+        const float *reference = reinterpret_cast<const float *>(referenceInput.mat.data);
+        for (size_t i = 0; i < tensorSize; i++) {
+          float diff = std::abs(fused[i] - reference[i]);
+          maxDiff = std::max(maxDiff, diff);
+          sumDiff += diff;
+        }
+        isGeometrySame = isGeometrySame && fusedInput.ratio == referenceInput.ratio && fusedInput.dw == referenceInput.dw &&
+                         fusedInput.dh == referenceInput.dh;
+      }
+    }
+
+    size_t runs = frames.size() * options.loops;
+    Json::Value result;
+    result["inputSize"] = wh;
+    result["maxAbsDiff"] = maxDiff;
+    result["meanAbsDiff"] = sumDiff / (frames.size() * tensorSize);
+    result["geometrySame"] = isGeometrySame;
+    result["fusedMs"] = fusedSeconds * 1000 / runs;
+    result["referenceMs"] = referenceSeconds * 1000 / runs;
+    result["speedup"] = fusedSeconds > 0 ? referenceSeconds / fusedSeconds : 0;
+    // float sampling against 8-bit fixed point rounds a value at most one step apart
+    result["passed"] = maxDiff <= tolerance * 1.001f && isGeometrySame;
+    isPassed = isPassed && result["passed"].asBool();
+    report["preprocess"].append(result);
+  }
+  report["frameSize"].append(frames[0].cols);
+  report["frameSize"].append(frames[0].rows);
+  report["passed"] = isPassed;
+  return isPassed;
+}
+
+/**
+ * @brief the overlay against utils::drawObjs, which the filter drew with before
+ *
+ * The boxes come from the stub backend on every frame, both draw them on their own copy of the frame with the colors
+ * and font scale of the filter. The overlay draws the outer corner pixel of a box edge that the round joints of
+ * cv::rectangle leave out, any other difference counts against --max-channel-diff.
+ */
+bool checkDrawing(const Options &options, const std::vector<cv::Mat> &frames, Json::Value &report) {
+  StubDetector detector(options.stubObjects, 0, options.inputSizes, 1, stubHostAllocator);
+  detector.setOutputLimits(options.confidence, options.boxLimit);
+  OverlayRenderer overlay;
+  std::vector<utils::Obj> objs;
+  cv::Mat drawn;
+  cv::Mat reference;
+  double drawSeconds = 0;
+  double referenceSeconds = 0;
+  uint64_t pixels = 0;
+  uint64_t differingPixels = 0;
+  int maxDiff = 0;
+  int maxCornerDiff = 0;
+  uint64_t boxCount = 0;
+  std::vector<uint8_t> isCorner;
+  for (int loop = 0; loop < options.loops; loop++) {
+    for (const cv::Mat &frame : frames) {
+      detector.infer(frame, objs);
+      boxCount += objs.size();
+      isCorner.assign(static_cast<size_t>(frame.rows) * frame.cols, 0);
+      for (const utils::Obj &obj : objs) {
+        for (int x : {obj.p1.x - 1, obj.p2.x + 1}) {
+          for (int y : {obj.p1.y - 1, obj.p2.y + 1}) {
+            if (x >= 0 && x < frame.cols && y >= 0 && y < frame.rows) {
+              isCorner[static_cast<size_t>(y) * frame.cols + x] = 1;
+            }
+          }
+        }
+      }
+      frame.copyTo(drawn);
+      frame.copyTo(reference);
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      overlay.draw(drawn, objs);
+      drawSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      start = std::chrono::steady_clock::now();
+      utils::drawObjs(reference, reference, objs, false, 0.4, cv::Scalar(0, 255, 0));
+      referenceSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      int channels = drawn.channels();
+      for (int y = 0; y < drawn.rows; y++) {
+        const uint8_t *row = drawn.ptr<uint8_t>(y);
+        const uint8_t *referenceRow = reference.ptr<uint8_t>(y);
+        for (int x = 0; x < drawn.cols; x++) {
+          int pixelDiff = 0;
+          for (int c = 0; c < channels; c++) {
+            pixelDiff = std::max(pixelDiff, std::abs(row[x * channels + c] - referenceRow[x * channels + c]));
+          }
+          differingPixels += pixelDiff > 0 ? 1 : 0;
+          int &worst = isCorner[static_cast<size_t>(y) * drawn.cols + x] ? maxCornerDiff : maxDiff;
+          worst = std::max(worst, pixelDiff);
+        }
+      }
+      pixels += static_cast<uint64_t>(drawn.rows) * drawn.cols;
+    }
+  }
+
+  size_t runs = frames.size() * options.loops;
+  report["frameSize"].append(frames[0].cols);
+  report["frameSize"].append(frames[0].rows);
+  report["boxesPerFrame"] = static_cast<double>(boxCount) / runs;
+  report["drawMs"] = drawSeconds * 1000 / runs;
+  report["referenceMs"] = referenceSeconds * 1000 / runs;
+  report["speedup"] = drawSeconds > 0 ? referenceSeconds / drawSeconds : 0;
+  double differingShare = pixels > 0 ? static_cast<double>(differingPixels) / pixels : 0;
+  report["differingPixelShare"] = differingShare;
+  report["maxChannelDiff"] = maxDiff;
+  report["maxCornerChannelDiff"] = maxCornerDiff;
+  report["labelSprites"] = static_cast<Json::UInt64>(overlay.getSpriteCount());
+  report["passed"] = differingShare <= options.maxDifferingShare && maxDiff <= options.maxChannelDiff;
+  return report["passed"].asBool();
+}
+
+/// @brief the admission callbacks of the waiters of checkAdmission, called on the returning thread or on the reaper
+struct AdmissionLog {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<int> admitted;
+  std::vector<Detector *> models;
+  std::vector<uint64_t> waitUs;
+  std::vector<int> positions;
+  std::chrono::steady_clock::time_point returnedAt;
+  std::vector<double> handoffUs;
+
+  explicit AdmissionLog(int waiterCount) : models(waiterCount, nullptr), waitUs(waiterCount, 0), positions(waiterCount, 0) {}
+
+  AdmissionQueue::AdmittedCallback onAdmitted(int waiter) {
+    return [this, waiter](Detector *model, uint64_t waitUs) {
+      std::lock_guard<std::mutex> lockNow(this->lock);
+      this->handoffUs.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - this->returnedAt).count());
+      this->admitted.push_back(waiter);
+      this->models[waiter] = model;
+      this->waitUs[waiter] = waitUs;
+      this->changed.notify_all();
+    };
+  }
+
+  AdmissionQueue::PositionCallback onPosition(int waiter) {
+    return [this, waiter](int position) {
+      std::lock_guard<std::mutex> lockNow(this->lock);
+      this->positions[waiter] = position;
+    };
+  }
+
+  /// @brief wait until a number of waiters were admitted, false after timeoutMs
+  bool waitAdmitted(size_t count, int timeoutMs) {
+    std::unique_lock<std::mutex> lockNow(this->lock);
+    return this->changed.wait_for(lockNow, std::chrono::milliseconds(timeoutMs), [this, count]() { return this->admitted.size() >= count; });
+  }
+};
+
+/**
+ * @brief the models Residency::planEviction unloads for simulated footprints under a 6 GiB budget, false if one case
+ * is not planned as expected
+ */
+bool checkResidency(Json::Value &report) {
+  const size_t gib = size_t(1) << 30;
+  const size_t budget = 6 * gib;
+  bool isPassed = true;
+  auto check = [&](const char *what, const std::vector<Residency::Resident> &resident, const std::vector<size_t> &needed,
+                   size_t budget, bool isExpectedToFit, const std::vector<int> &expected) {
+    std::vector<int> victims{-1};
+    bool isFitting = Residency::planEviction(resident, needed, budget, victims);
+    Json::Value result;
+    result["victims"] = Json::Value(Json::arrayValue);
+    for (int id : victims) {
+      result["victims"].append(id);
+    }
+    result["fits"] = isFitting;
+    result["passed"] = isFitting == isExpectedToFit && victims == expected;
+    report["residency"][what] = result;
+    isPassed = isPassed && result["passed"].asBool();
+  };
+
+  //// three idle models of 2 GiB on device 0, used at 30, 10 and 20 s, and an older one on device 1
+  std::vector<Residency::Resident> resident = {
+      {1, {2 * gib}, 30, true}, {2, {2 * gib}, 10, true}, {3, {2 * gib}, 20, true}, {4, {0, 3 * gib}, 0, true}};
+  check("noBudget", resident, {5 * gib}, 0, true, {});
+  check("fits", {resident[0], resident[3]}, {4 * gib}, budget, true, {});
+
+  //// the least recently used first, only as many as needed, none from a device the new model does not use
+  check("leastRecentlyUsed", resident, {3 * gib}, budget, true, {2, 3});
+  check("oneIsEnough", resident, {1 * gib}, budget, true, {2});
+
+  //// pinned models and models with a session stay
+  std::vector<Residency::Resident> pinned = resident;
+  pinned[1].isEvictable = false;
+  check("notEvictable", pinned, {3 * gib}, budget, true, {3, 1});
+
+  //// a model on two devices needs room on both
+  check("twoDevices", resident, {2 * gib, 4 * gib}, budget, true, {4, 2});
+
+  //// nothing is unloaded for a model that cannot fit
+  check("tooLarge", resident, {7 * gib}, budget, false, {});
+  check("pinnedInTheWay", pinned, {5 * gib}, budget, false, {});
+
+  report["passed"] = isPassed;
+  return isPassed;
+}
+
+/**
+ * @brief the admission queue of a pool of --instances stub instances (default 2) with --sessions sessions (at least 3
+ * more than the instances) asking for them, false if one was served out of order, lost or not timed out
+ *
+ * The first sessions take every instance and the others queue with priorities 1 to 3, one more finds the queue full.
+ * The second waiter in serving order leaves the queue, then every instance is returned and handed on until the queue is
+ * empty: the waiters must be served by priority, in arrival order within a priority, and be told their new positions.
+ * Last, the only waiter of a pool with a 1 s queue timeout must time out.
+ */
+bool checkAdmission(const Options &options, Json::Value &report) {
+  Options poolOptions = options;
+  poolOptions.configPath.clear();
+  poolOptions.backend = "stub";
+  poolOptions.isLazy = false;
+  poolOptions.instanceCount = options.instanceCount > 0 ? options.instanceCount : 2;
+  int waiterCount = std::max(options.sessionCount - poolOptions.instanceCount, 3);
+  Json::Value config = makeConfig(poolOptions);
+  config["models"][0]["max_queue"] = waiterCount;
+  ModelPool pool(config);
+  bool isPassed = true;
+  auto check = [&](const char *what, bool isOk, Json::Value result = Json::Value(Json::objectValue)) {
+    result["passed"] = isOk;
+    report["admission"][what] = result;
+    isPassed = isPassed && isOk;
+  };
+
+  //// every instance taken, the others queue
+  std::vector<Detector *> returning;
+  for (int i = 0; i < poolOptions.instanceCount; i++) {
+    Detector *model = pool.getModel(benchModelName);
+    if (model == nullptr) {
+      throw std::runtime_error("the pool has fewer instances than configured");
+    }
+    returning.push_back(model);
+  }
+  AdmissionLog log(waiterCount);
+  std::vector<uint64_t> tickets(waiterCount);
+  std::vector<int> priorities(waiterCount);
+  std::vector<int> expected;
+  bool isQueued = true;
+  for (int i = 0; i < waiterCount; i++) {
+    tickets[i] = pool.newTicket();
+    priorities[i] = 1 + i % 3;
+    int position = 0;
+    Detector *model = pool.getModelOrWait(benchModelName, priorities[i], tickets[i], log.onAdmitted(i), log.onPosition(i), position);
+    isQueued = isQueued && model == nullptr && position > 0;
+    auto at = std::find_if(expected.begin(), expected.end(), [&](int queued) { return priorities[queued] < priorities[i]; });
+    expected.insert(at, i);
+  }
+  check("queued", isQueued);
+
+  int position = 0;
+  Detector *rejected =
+      pool.getModelOrWait(benchModelName, 3, pool.newTicket(), [](Detector *, uint64_t) {}, [](int) {}, position);
+  check("queueCap", rejected == nullptr && position == 0);
+
+  //// a waiter leaves, the ones behind it move up
+  int leaving = expected[1];
+  bool isLeft = pool.cancelWait(benchModelName, tickets[leaving]);
+  expected.erase(expected.begin() + 1);
+  bool isMovedUp = true;
+  for (size_t j = 1; j < expected.size(); j++) {
+    std::lock_guard<std::mutex> lockNow(log.lock);
+    isMovedUp = isMovedUp && log.positions[expected[j]] == static_cast<int>(j) + 1;
+  }
+  check("cancel", isLeft && isMovedUp && pool.cancelWait(benchModelName, tickets[leaving]) == false);
+
+  //// every returned instance goes to the head waiter, which returns it in turn
+  bool isServed = true;
+  while (returning.empty() == false) {
+    Detector *model = returning.back();
+    returning.pop_back();
+    size_t admittedBefore;
+    {
+      std::lock_guard<std::mutex> lockNow(log.lock);
+      admittedBefore = log.admitted.size();
+      log.returnedAt = std::chrono::steady_clock::now();
+    }
+    pool.returnModel(benchModelName, model, "");
+    if (admittedBefore == expected.size()) {
+      continue;
+    }
+    if (log.waitAdmitted(admittedBefore + 1, 1000) == false) {
+      isServed = false;
+      break;
+    }
+    std::lock_guard<std::mutex> lockNow(log.lock);
+    int waiter = log.admitted.back();
+    isServed = isServed && log.models[waiter] != nullptr;
+    if (log.models[waiter] != nullptr) {
+      returning.push_back(log.models[waiter]);
+    }
+    // the waiters still queued were told their new positions
+    for (size_t j = log.admitted.size(); j < expected.size(); j++) {
+      isServed = isServed && log.positions[expected[j]] == static_cast<int>(j - log.admitted.size()) + 1;
+    }
+  }
+  Json::Value order;
+  {
+    std::lock_guard<std::mutex> lockNow(log.lock);
+    for (int waiter : log.admitted) {
+      order["admitted"].append(waiter);
+      order["priorities"].append(priorities[waiter]);
+    }
+    for (int waiter : expected) {
+      order["expected"].append(waiter);
+    }
+    std::sort(log.handoffUs.begin(), log.handoffUs.end());
+    if (log.handoffUs.empty() == false) {
+      order["handoffP50Us"] = log.handoffUs[log.handoffUs.size() / 2];
+      order["handoffMaxUs"] = log.handoffUs.back();
+    }
+    isServed = isServed && log.admitted == expected;
+  }
+  check("order", isServed, order);
+  check("allReturned", pool.getModel(benchModelName) != nullptr);
+
+  //// a wait longer than queue_timeout_sec ends without a model, the reaper checks every second
+  config["models"][0]["max_model_limit"] = 1;
+  config["models"][0]["queue_timeout_sec"] = 1;
+  ModelPool timeoutPool(config);
+  Detector *held = timeoutPool.getModel(benchModelName);
+  AdmissionLog timeoutLog(1);
+  Detector *model =
+      timeoutPool.getModelOrWait(benchModelName, 1, timeoutPool.newTicket(), timeoutLog.onAdmitted(0), timeoutLog.onPosition(0), position);
+  bool isTimedOut = model == nullptr && position == 1 && timeoutLog.waitAdmitted(1, 3000);
+  Json::Value timeout;
+  {
+    std::lock_guard<std::mutex> lockNow(timeoutLog.lock);
+    isTimedOut = isTimedOut && timeoutLog.models[0] == nullptr && timeoutLog.waitUs[0] >= 1000000;
+    timeout["waitMs"] = static_cast<Json::UInt64>(timeoutLog.waitUs[0] / 1000);
+  }
+  timeoutPool.returnModel(benchModelName, held, "");
+  check("timeout", isTimedOut, timeout);
+
+  report["admission"]["instances"] = poolOptions.instanceCount;
+  report["admission"]["waiters"] = waiterCount;
+  report["passed"] = isPassed;
+  return isPassed;
+}
+
+/**
+ * @brief a pool of stub instances loaded from a config file that is rewritten and reloaded, false if the pool does not
+ * follow a reload
+ *
+ * The default model is shrunk while all of its instances are checked out, grown, and a second model is added, retired
+ * with a live session and added again. A malformed file must leave the pool as it is and a limit above max_instances
+ * must be clamped. The stub instances alive are counted with their host buffers.
+ */
+bool checkReload(const Options &options, Json::Value &report) {
+  Options poolOptions = options;
+  poolOptions.configPath.clear();
+  poolOptions.backend = "stub";
+  poolOptions.isLazy = false;
+  Json::Value baseModel = makeConfig(poolOptions)["models"][0];
+  const char *otherModelName = "other";
+  std::string path = (fs::temp_directory_path() / ("objdet-bench-reload-" + std::to_string(getpid()) + ".json")).string();
+  // written aside and moved into place, as the pool may read it at any time
+  auto writeConfig = [&](int limit, int otherLimit) {
+    Json::Value config;
+    config["default_model_name"] = benchModelName;
+    Json::Value model = baseModel;
+    model["max_model_limit"] = limit;
+    config["models"].append(model);
+    if (otherLimit > 0) {
+      model["name"] = otherModelName;
+      model["max_model_limit"] = otherLimit;
+      config["models"].append(model);
+    }
+    std::ofstream(path + ".tmp") << config;
+    fs::rename(path + ".tmp", path);
+  };
+  auto liveInstances = [] {
+    return static_cast<int>(stubHostAllocator.allocations.load() - stubHostAllocator.deallocations.load());
+  };
+  // the watcher applies a reload right away and releases returned instances within a second
+  auto waitFor = [](const std::function<bool()> &isReached) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (isReached() == false) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+  };
+  bool isPassed = true;
+  auto check = [&](const char *what, bool isOk, ModelPool &pool) {
+    Json::Value result;
+    result["passed"] = isOk;
+    result["live"] = liveInstances();
+    result["free"] = pool.getAvailableCount(benchModelName);
+    report["reload"][what] = result;
+    isPassed = isPassed && isOk;
+  };
+
+  writeConfig(2, 0);
+  setenv("OBJDET_CONFIG", path.c_str(), 1);
+  {
+    ModelPool pool;
+    check("loaded", liveInstances() == 2 && pool.getAvailableCount(benchModelName) == 2, pool);
+
+    //// checked-out instances are kept, the one above the new limit is released once returned
+    Detector *first = pool.getModel(benchModelName);
+    Detector *second = pool.getModel(benchModelName);
+    pool.registerSession(benchModelName, first, "first");
+    pool.registerSession(benchModelName, second, "second");
+    writeConfig(1, 0);
+    bool isShrunk = pool.requestReload();
+    isShrunk = waitFor([&] { return liveInstances() == 2; }) && isShrunk;
+    pool.returnModel(benchModelName, second, "second");
+    pool.returnModel(benchModelName, first, "first");
+    isShrunk = waitFor([&] { return liveInstances() == 1 && pool.getAvailableCount(benchModelName) == 1; }) && isShrunk;
+    check("shrunkWhileBusy", isShrunk, pool);
+
+    //// instances and models are added
+    writeConfig(3, 2);
+    bool isGrown = pool.requestReload();
+    isGrown = waitFor([&] {
+      return liveInstances() == 5 && pool.getAvailableCount(benchModelName) == 3 && pool.getAvailableCount(otherModelName) == 2;
+    }) && isGrown;
+    check("grown", isGrown, pool);
+
+    //// a retired model takes no sessions, its last one keeps inferring until it returns the instance
+    Detector *other = pool.getModel(otherModelName);
+    pool.registerSession(otherModelName, other, "other");
+    writeConfig(3, 0);
+    bool isRetired = pool.requestReload();
+    isRetired = waitFor([&] { return pool.modelExists(otherModelName) == false && liveInstances() == 4; }) && isRetired;
+    isRetired = isRetired && pool.getModel(otherModelName) == nullptr;
+    std::vector<utils::Obj> objs;
+    other->infer(cv::Mat(options.frameSize, CV_8UC3, cv::Scalar(90, 110, 120)), objs);
+    pool.returnModel(otherModelName, other, "other");
+    isRetired = waitFor([&] { return liveInstances() == 3; }) && isRetired;
+    check("retiredWithSession", isRetired, pool);
+
+    writeConfig(3, 1);
+    bool isReadded = pool.requestReload();
+    Detector *readded = nullptr;
+    isReadded = waitFor([&] { return pool.modelExists(otherModelName) && (readded = pool.getModel(otherModelName)) != nullptr; }) &&
+                isReadded;
+    if (readded != nullptr) {
+      pool.returnModel(otherModelName, readded, "");
+    }
+    check("readded", isReadded, pool);
+
+    //// a file that cannot be read changes nothing
+    std::ofstream(path) << "{broken";
+    bool isKept = pool.requestReload() == false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    isKept = isKept && liveInstances() == 4 && pool.getAvailableCount(benchModelName) == 3;
+    check("malformedKept", isKept, pool);
+
+    //// the handles of a model are sized at load, max_instances defaults to at least 8
+    writeConfig(20, 1);
+    bool isClamped = pool.requestReload();
+    isClamped = waitFor([&] { return pool.getAvailableCount(benchModelName) == 8; }) && isClamped;
+    check("clampedToMaxInstances", isClamped, pool);
+  }
+  fs::remove(path);
+  report["passed"] = isPassed;
+  return isPassed;
+}
+
+/// @brief write a report to --output or stdout
+void writeReport(const Json::Value &report, const Options &options) {
+  Json::StyledWriter writer;
+  if (options.outputPath.empty()) {
+    std::cout << writer.write(report);
+  } else {
+    std::ofstream(options.outputPath) << writer.write(report);
+  }
+}
+
+/// @brief compare a report with a baseline report, false and the reasons on stderr if it regressed beyond the tolerance
+bool checkBaseline(const Json::Value &report, const std::string &baselinePath, float tolerance) {
+  Json::Value baseline;
+  std::ifstream fileStream(baselinePath, std::ifstream::binary);
+  Json::Reader reader;
+  if (reader.parse(fileStream, baseline) == false) {
+    throw std::runtime_error("baseline cannot be parsed: " + baselinePath);
+  }
+  bool isPassed = true;
+  auto check = [&](const char *what, double value, double reference, bool isHigherBetter) {
+    if (reference <= 0) {
+      return;
+    }
+    bool isRegressed = isHigherBetter ? value < reference * (1 - tolerance) : value > reference * (1 + tolerance);
+    if (isRegressed) {
+      std::cerr << "regression: " << what << " " << value << " against " << reference << "\n";
+      isPassed = false;
+    }
+  };
+  check("fps", report["fps"].asDouble(), baseline["fps"].asDouble(), true);
+  check("frame p95 ms", report["stages"]["frame"]["p95Ms"].asDouble(), baseline["stages"]["frame"]["p95Ms"].asDouble(), false);
+  // allocations are deterministic, only a fraction of an allocation per frame is noise
+  if (report["allocsPerFrame"].asDouble() > baseline["allocsPerFrame"].asDouble() + 0.5) {
+    std::cerr << "regression: allocations per frame " << report["allocsPerFrame"].asDouble() << " against "
+              << baseline["allocsPerFrame"].asDouble() << "\n";
+    isPassed = false;
+  }
+  return isPassed;
+}
+
+int runBench(const Options &options) {
+  if (options.isPlacementCheck) {
+    Json::Value report;
+    bool isPassed = checkPlacement(report);
+    writeReport(report, options);
+    return isPassed ? 0 : 2;
+  }
+  if (options.isResidencyCheck) {
+    Json::Value report;
+    bool isPassed = checkResidency(report);
+    writeReport(report, options);
+    return isPassed ? 0 : 2;
+  }
+
+  DetectorFactory::registerBackend("stub", [](const Json::Value &modelParam) { return std::make_unique<StubDetectorFactory>(modelParam); });
+
+  if (options.isAdmissionCheck) {
+    Json::Value report;
+    bool isPassed = checkAdmission(options, report);
+    writeReport(report, options);
+    return isPassed ? 0 : 2;
+  }
+  if (options.isReloadCheck) {
+    Json::Value report;
+    bool isPassed = checkReload(options, report);
+    writeReport(report, options);
+    return isPassed ? 0 : 2;
+  }
+
+  std::vector<cv::Mat> frames;
+  loadFrames(options, frames);
+  if (options.isDrawReference) {
+    Json::Value report;
+    bool isPassed = checkDrawing(options, frames, report);
+    writeReport(report, options);
+    return isPassed ? 0 : 2;
+  }
+  if (options.isPreprocessReference) {
+    Json::Value report;
+    bool isPassed = checkPreprocess(options, frames, report);
+    writeReport(report, options);
+    return isPassed ? 0 : 2;
+  }
+
+  Json::Value config = makeConfig(options);
+
+  //// cold start: the pool loads (or with lazy loading, registers) the models
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ModelPool pool(config);
+  double startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  std::string modelName = options.modelName.empty() ? pool.getDefaultModelName() : options.modelName;
+  if (pool.modelExists(modelName) == false) {
+    throw std::runtime_error("model not found: " + modelName);
+  }
+
+  std::vector<std::unique_ptr<BenchSession>> sessions;
+  for (int i = 0; i < options.sessionCount; i++) {
+    sessions.push_back(std::make_unique<BenchSession>(pool, options, modelName, frames, i));
+  }
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(sessions.size());
+  size_t hostAllocsBefore = stubHostAllocator.allocations.load(std::memory_order_relaxed);
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < sessions.size(); i++) {
+    threads.emplace_back([&sessions, &errors, i]() {
+      try {
+        sessions[i]->run();
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for (const std::exception_ptr &error : errors) {
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  //// report
+  Json::Value report = pool.getModelMetrics(modelName)->toJSON();
+  uint64_t frameCount = 0;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+  uint64_t payloadBytes = 0;
+  double firstCheckoutMs = 0;
+  for (const std::unique_ptr<BenchSession> &session : sessions) {
+    frameCount += session->frameCount;
+    allocs += session->allocs;
+    bytes += session->bytes;
+    payloadBytes += session->payloadBytes;
+    firstCheckoutMs = std::max(firstCheckoutMs, session->firstCheckoutMs);
+    report["sessions"].append(session->toJSON());
+  }
+  report["model"] = modelName;
+  report["backend"] = options.configPath.empty() ? options.backend : "config";
+  report["frameSize"].append(frames[0].cols);
+  report["frameSize"].append(frames[0].rows);
+  report["sessionCount"] = options.sessionCount;
+  report["startupMs"] = startupMs;
+  report["firstCheckoutMs"] = firstCheckoutMs;
+  report["frames"] = static_cast<Json::UInt64>(frameCount);
+  report["seconds"] = seconds;
+  report["fps"] = frameCount / seconds;
+  report["allocsPerFrame"] = static_cast<double>(allocs) / frameCount;
+  report["allocBytesPerFrame"] = static_cast<double>(bytes) / frameCount;
+  report["payloadBytesPerFrame"] = static_cast<double>(payloadBytes) / frameCount;
+  // stub backend only, the other backends allocate their own buffers; lazy instances are created during the run
+  report["hostAllocs"] = static_cast<Json::UInt64>(stubHostAllocator.allocations.load(std::memory_order_relaxed));
+  report["hostAllocsDuringRun"] =
+      static_cast<Json::UInt64>(stubHostAllocator.allocations.load(std::memory_order_relaxed) - hostAllocsBefore);
+  report["metricsRecordNs"] = measureRecordNs();
+
+  writeReport(report, options);
+
+  if (options.baselinePath.empty() == false && checkBaseline(report, options.baselinePath, options.tolerance) == false) {
+    return 2;
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  gst_init(&argc, &argv);
+  Options options;
+  try {
+    if (parseOptions(argc, argv, options) == false) {
+      printUsage();
+      return 1;
+    }
+    return runBench(options);
+  } catch (const std::exception &e) {
+    std::cerr << "objdet-bench: " << e.what() << "\n";
+    return 1;
+  }
+}
@@ -16,7 +16,33 @@ namespace module {
 namespace objdet {
 
 ObjDetImpl::ObjDetImpl(const boost::property_tree::ptree &config, std::shared_ptr<MediaPipeline> mediaPipeline)
-    : OpenCVFilterImpl(config, std::dynamic_pointer_cast<MediaPipelineImpl>(mediaPipeline)) {}
+    : OpenCVFilterImpl(config, std::dynamic_pointer_cast<MediaPipelineImpl>(mediaPipeline)) {
+  GstElement *opencvfilter = nullptr;
+  g_object_get(G_OBJECT(this->element), "filter", &opencvfilter, NULL);
+  if (opencvfilter != nullptr) {
+    this->filterSinkPad = gst_element_get_static_pad(opencvfilter, "sink");
+    g_object_unref(opencvfilter);
+  }
+  if (this->filterSinkPad == nullptr) {
+    GST_WARNING("no sink pad on the OpenCV filter, shared frames are matched by their pixels only");
+    return;
+  }
+  this->ptsProbeId = gst_pad_add_probe(this->filterSinkPad, GST_PAD_PROBE_TYPE_BUFFER, ObjDetImpl::onFilterBuffer, this, nullptr);
+}
+
+ObjDetImpl::~ObjDetImpl() {
+  if (this->filterSinkPad != nullptr) {
+    gst_pad_remove_probe(this->filterSinkPad, this->ptsProbeId);
+    gst_object_unref(this->filterSinkPad);
+  }
+  ObjDetOpenCVImpl::stopAsyncWorker();
+}
+
+GstPadProbeReturn ObjDetImpl::onFilterBuffer(GstPad *pad, GstPadProbeInfo *info, gpointer self) {
+  // the filter processes the buffer right after on the same thread
+  static_cast<ObjDetImpl *>(self)->setFramePts(GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+  return GST_PAD_PROBE_OK;
+}
 
 MediaObjectImpl *ObjDetImplFactory::createObject(const boost::property_tree::ptree &config,
                                                  std::shared_ptr<MediaPipeline> mediaPipeline) const {
@@ -73,6 +99,66 @@ void ObjDetImpl::setInferringDelay(const int msec) {
   ObjDetOpenCVImpl::setInferringDelay(msec);
 }
 
+void ObjDetImpl::setAsyncMode(bool isAsync, int queueSize) {
+  GST_INFO("set async mode %s, queue size %d", isAsync ? "true" : "false", queueSize);
+  ObjDetOpenCVImpl::setAsyncMode(isAsync, queueSize);
+}
+
+void ObjDetImpl::setOutputFormat(const std::string &format) {
+  GST_INFO("set output format %s", format.c_str());
+  ObjDetOpenCVImpl::setOutputFormat(format);
+}
+
+void ObjDetImpl::setDeltaMode(bool isDelta, int keyframeMsec, float iouThresh) {
+  GST_INFO("set delta mode %s, keyframe %d ms, iou %f", isDelta ? "true" : "false", keyframeMsec, iouThresh);
+  ObjDetOpenCVImpl::setDeltaMode(isDelta, keyframeMsec, iouThresh);
+}
+
+void ObjDetImpl::setTracking(bool isTracking, int maxAgeMsec) {
+  GST_INFO("set tracking %s, max age %d ms", isTracking ? "true" : "false", maxAgeMsec);
+  ObjDetOpenCVImpl::setTracking(isTracking, maxAgeMsec);
+}
+
+void ObjDetImpl::setMotionGate(bool isGating, float threshold, int refreshMsec) {
+  GST_INFO("set motion gate %s, threshold %f, refresh %d ms", isGating ? "true" : "false", threshold, refreshMsec);
+  ObjDetOpenCVImpl::setMotionGate(isGating, threshold, refreshMsec);
+}
+
+void ObjDetImpl::setTargetFps(float fps, int priority) {
+  GST_INFO("set target fps %f, priority %d", fps, priority);
+  ObjDetOpenCVImpl::setTargetFps(fps, priority);
+}
+
+void ObjDetImpl::setInputSize(int size) {
+  GST_INFO("set input size %d", size);
+  ObjDetOpenCVImpl::setInputSize(size);
+}
+
+void ObjDetImpl::setRegions(const std::string &regionsJSON) {
+  GST_INFO("set regions %s", regionsJSON.c_str());
+  ObjDetOpenCVImpl::setRegions(regionsJSON);
+}
+
+void ObjDetImpl::setTiling(bool isTiling, float overlap) {
+  GST_INFO("set tiling %s, overlap %f", isTiling ? "true" : "false", overlap);
+  ObjDetOpenCVImpl::setTiling(isTiling, overlap);
+}
+
+void ObjDetImpl::getMetrics() {
+  GST_INFO("get metrics");
+  ObjDetOpenCVImpl::getMetrics();
+}
+
+void ObjDetImpl::reloadConfig() {
+  GST_INFO("reload config");
+  ObjDetOpenCVImpl::reloadConfig();
+}
+
+void ObjDetImpl::setSharedSource(const std::string &sourceKey) {
+  GST_INFO("set shared source %s", sourceKey.c_str());
+  ObjDetOpenCVImpl::setSharedSource(sourceKey);
+}
+
 void ObjDetImpl::destroy() {
   GST_INFO("destroy");
   ObjDetOpenCVImpl::destroy();
@@ -34,7 +34,7 @@ class ObjDetImpl : public OpenCVFilterImpl, public virtual ObjDet, public virtua
 public:
   ObjDetImpl(const boost::property_tree::ptree &config, std::shared_ptr<MediaPipeline> mediaPipeline);
 
-  virtual ~ObjDetImpl() = default;
+  virtual ~ObjDetImpl();
 
   /* Next methods are automatically implemented by code generator */
   virtual bool connect(const std::string &eventType, std::shared_ptr<EventHandler> handler);
@@ -54,9 +54,27 @@ public:
   void changeModel(const std::string &modelName);
   void getModelNames();
   void setInferringDelay(const int msec);
+  void setAsyncMode(bool isAsync, int queueSize);
+  void setOutputFormat(const std::string &format);
+  void setDeltaMode(bool isDelta, int keyframeMsec, float iouThresh);
+  void setTracking(bool isTracking, int maxAgeMsec);
+  void setMotionGate(bool isGating, float threshold, int refreshMsec);
+  void setTargetFps(float fps, int priority);
+  void setInputSize(int size);
+  void setRegions(const std::string &regionsJSON);
+  void setTiling(bool isTiling, float overlap);
+  void getMetrics();
+  void reloadConfig();
+  void setSharedSource(const std::string &sourceKey);
   void destroy();
 
 private:
+  /// @brief sink pad of the OpenCV filter, its buffers carry the PTS that process() does not get
+  GstPad *filterSinkPad = nullptr;
+  gulong ptsProbeId = 0;
+
+  static GstPadProbeReturn onFilterBuffer(GstPad *pad, GstPadProbeInfo *info, gpointer self);
+
   class StaticConstructor {
   public:
     StaticConstructor();
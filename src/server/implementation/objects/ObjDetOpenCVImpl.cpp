@@ -6,6 +6,7 @@
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <chrono>
+#include <cmath>
 #include <gst/gst.h>
 #include <json/json.h>
 
@@ -17,17 +18,21 @@ namespace module {
 namespace objdet {
 
 ModelPool modelPool;
+Governor governor;
+SharedInference sharedInference;
+
+static inline int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 ObjDetOpenCVImpl::ObjDetOpenCVImpl() {
   this->sessionId = boost::uuids::to_string(uuidGenerator());
   GST_DEBUG_CATEGORY_INIT(kurento_obj_det_core, (std::string("ObjDetCore-") + this->sessionId).c_str(), GST_DEBUG_FG_CYAN,
                           "ObjDetCore");
   GST_INFO("session started %s", this->sessionId.c_str());
-  auto now = std::chrono::system_clock::now();
-
-  std::time_t nowMilliSec = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-  this->lastInferringTimestampMs = nowMilliSec;
   this->inferringDelayMsec = 0;
+  this->governed = objdet::governor.join();
+  this->pipeline.setSessionMetrics(objdet::modelPool.getMetrics().addSession(this->sessionId));
 }
 
 /*
@@ -43,43 +48,10 @@ void ObjDetOpenCVImpl::process(cv::Mat &mat) {
     return;
   }
 
-  std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-
-  // inferring delay
-
-  if (this->checkDelay(mat, now) == false) {
-    return;
-  }
-
-  if (this->checkSession() == false) {
-    return;
-  }
-
-  if (this->checkModel() == false) {
-    return;
-  }
-
-  if (this->checkSessionIsValid(now) == false) {
-    return;
-  }
-
-  GST_DEBUG("do inferring");
-  std::vector<utils::Obj> objs;
-  GST_DEBUG("feed mat into model");
-  this->model->infer(mat, objs);
-  GST_DEBUG("inferred %d objs", static_cast<int>(objs.size()));
-
-  this->filterByConfidence(objs);
-
-  this->filterByBoxLimit(objs);
-
-  this->drawObjects(mat, objs);
-
-  this->sendBoxes(objs, mat.size());
-
-  if (this->isDrawing && this->keepBoxes == true) {
-    this->lastBoxes = objs;
-  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  this->pipeline.countEvent(Counter::FRAMES);
+  this->processFrame(mat);
+  this->recordLatency(start);
 }
 
 bool ObjDetOpenCVImpl::setConfidence(float confidence) {
@@ -130,7 +102,8 @@ bool ObjDetOpenCVImpl::stopInferring() {
 
 bool ObjDetOpenCVImpl::heartbeat() {
   GST_DEBUG("heartbeat %s", this->sessionId.c_str());
-  objdet::modelPool.heartbeat(this->modelName, this->sessionId);
+  std::lock_guard<std::mutex> lockNow(this->modelLock);
+  objdet::modelPool.heartbeat(this->modelName, this->model, this->sessionId);
   return true;
 }
 
@@ -141,8 +114,10 @@ bool ObjDetOpenCVImpl::initSession() {
 
 bool ObjDetOpenCVImpl::changeModel(const std::string &modelName) {
   GST_INFO("change model to %s", modelName.c_str());
+  // a model picked explicitly replaces the one initSession is waiting for
+  this->cancelWait();
 
-  Yolov7trt *targetModel = objdet::modelPool.getModel(modelName);
+  Detector *targetModel = this->checkoutModel(modelName);
 
   if (targetModel == nullptr) {
     GST_WARNING("target model is not available %s", modelName.c_str());
@@ -157,20 +132,28 @@ bool ObjDetOpenCVImpl::changeModel(const std::string &modelName) {
   bool isInfer = this->isInferring;
   this->isInferring = false;
 
-  if (this->model != nullptr) {
-    objdet::modelPool.returnModel(this->modelName, this->model, this->sessionId);
-  }
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    if (this->model != nullptr) {
+      objdet::modelPool.returnModel(this->modelName, this->model, this->sessionId);
+    }
 
-  this->model = targetModel;
-  this->modelName = modelName;
-  objdet::modelPool.registerSession(this->modelName, this->model, this->sessionId);
+    this->model = targetModel;
+    this->modelName = modelName;
+    this->pipeline.setModelMetrics(targetModel != nullptr ? objdet::modelPool.getModelMetrics(modelName) : nullptr);
+    this->registerModel();
+    if (targetModel != nullptr && this->inputSize != 0 && targetModel->setInputSize(this->inputSize) == false) {
+      GST_WARNING("model %s does not support input size %d, use its default", modelName.c_str(), this->inputSize);
+    }
+  }
+  objdet::governor.setModel(this->governed, targetModel != nullptr ? modelName : "");
+  this->pipeline.reset();
 
   Json::Value modelState;
   GST_INFO("model is ready");
   modelState["state"] = "000";
   modelState["targetModel"] = modelName;
   modelState["msg"] = "";
-  this->sessCheckTimestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 
   modelChanged event(this->getSharedFromThis(), modelChanged::getName(), utils::jsonToString(modelState));
   signalmodelChanged(event);
@@ -201,11 +184,206 @@ bool ObjDetOpenCVImpl::setInferringDelay(const int msec) {
   return true;
 }
 
+bool ObjDetOpenCVImpl::setAsyncMode(bool isAsync, int queueSize) {
+  GST_INFO("set async mode to %s with queue size %d", isAsync ? "true" : "false", queueSize);
+  if (isAsync && (queueSize <= 0 || queueSize > 8)) {
+    GST_WARNING("queue size set error");
+    this->sendSetParamSetResult("asyncMode", "E004");
+    return false;
+  }
+
+  std::shared_ptr<AsyncWorker> worker;
+  if (isAsync) {
+    worker = std::make_shared<AsyncWorker>([this](const cv::Mat &frame, uint64_t pts) { this->inferAsyncFrame(frame, pts); },
+                                           static_cast<size_t>(queueSize));
+  }
+  // the previous worker (if any) finishes its current frame and stops here
+  std::atomic_store(&this->asyncWorker, worker);
+  {
+    std::lock_guard<std::mutex> lockNow(this->asyncBoxesLock);
+    this->asyncBoxes.clear();
+  }
+  this->sendSetParamSetResult("asyncMode", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setOutputFormat(const std::string &format) {
+  GST_INFO("set output format to %s", format.c_str());
+  BoxFormat boxFormat;
+  if (BoxEncoder::parseFormat(format, boxFormat) == false) {
+    GST_WARNING("output format set error");
+    this->sendSetParamSetResult("outputFormat", "E004");
+    return false;
+  }
+  this->pipeline.setFormat(boxFormat);
+  this->sendSetParamSetResult("outputFormat", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setDeltaMode(bool isDelta, int keyframeMsec, float iouThresh) {
+  GST_INFO("set delta mode to %s, keyframe %d ms, iou %f", isDelta ? "true" : "false", keyframeMsec, iouThresh);
+  if (isDelta && (keyframeMsec < 100 || keyframeMsec > 60000 || iouThresh <= 0 || iouThresh > 1)) {
+    GST_WARNING("delta mode set error");
+    this->sendSetParamSetResult("deltaMode", "E004");
+    return false;
+  }
+  this->pipeline.setDeltaMode(isDelta, keyframeMsec, iouThresh);
+  this->sendSetParamSetResult("deltaMode", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setTracking(bool isTracking, int maxAgeMsec) {
+  GST_INFO("set tracking to %s, max age %d ms", isTracking ? "true" : "false", maxAgeMsec);
+  if (isTracking && (maxAgeMsec < 100 || maxAgeMsec > 10000)) {
+    GST_WARNING("tracking set error");
+    this->sendSetParamSetResult("tracking", "E004");
+    return false;
+  }
+  this->pipeline.setTracking(isTracking, maxAgeMsec);
+  this->sendSetParamSetResult("tracking", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setMotionGate(bool isGating, float threshold, int refreshMsec) {
+  GST_INFO("set motion gate to %s, threshold %f, refresh %d ms", isGating ? "true" : "false", threshold, refreshMsec);
+  if (isGating && (threshold <= 0 || threshold > 1 || refreshMsec < 100 || refreshMsec > 600000)) {
+    GST_WARNING("motion gate set error");
+    this->sendSetParamSetResult("motionGate", "E004");
+    return false;
+  }
+  this->pipeline.setMotionGate(isGating, threshold, refreshMsec);
+  this->sendSetParamSetResult("motionGate", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setTargetFps(float fps, int priority) {
+  GST_INFO("set target fps to %f with priority %d", fps, priority);
+  if (fps < 0 || fps > 120 || priority < 1 || priority > 100) {
+    GST_WARNING("target fps set error");
+    this->sendSetParamSetResult("targetFps", "E004");
+    return false;
+  }
+  objdet::governor.setTarget(this->governed, fps, priority);
+  this->sendSetParamSetResult("targetFps", "000");
+  this->sendRate(this->governed->getEffectiveFps());
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setInputSize(int size) {
+  GST_INFO("set input size to %d", size);
+  std::lock_guard<std::mutex> lockNow(this->modelLock);
+  if (this->model == nullptr || this->model->setInputSize(size) == false) {
+    GST_WARNING("input size set error");
+    this->sendSetParamSetResult("inputSize", "E004");
+    return false;
+  }
+  this->inputSize = size;
+  this->sendSetParamSetResult("inputSize", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setRegions(const std::string &regionsJSON) {
+  GST_INFO("set regions to %s", regionsJSON.c_str());
+  Json::Value regionsValue;
+  Json::Reader reader;
+  bool isValid = reader.parse(regionsJSON, regionsValue) && regionsValue.isArray();
+  std::vector<cv::Rect2f> regions;
+  for (Json::ArrayIndex i = 0; isValid && i < regionsValue.size(); i++) {
+    const Json::Value &region = regionsValue[i];
+    if (region.isArray() == false || region.size() != 4) {
+      isValid = false;
+      break;
+    }
+    for (Json::ArrayIndex k = 0; k < 4; k++) {
+      isValid = isValid && region[k].isNumeric() && region[k].asFloat() >= 0 && region[k].asFloat() <= 1;
+    }
+    if (isValid) {
+      cv::Rect2f rect(region[0].asFloat(), region[1].asFloat(), region[2].asFloat(), region[3].asFloat());
+      isValid = rect.width > 0 && rect.height > 0 && rect.x + rect.width <= 1 && rect.y + rect.height <= 1;
+      regions.push_back(rect);
+    }
+  }
+  if (isValid == false) {
+    GST_WARNING("regions set error");
+    this->sendSetParamSetResult("regions", "E004");
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    this->pipeline.getTiling().setRegions(regions);
+  }
+  this->sendSetParamSetResult("regions", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setTiling(bool isTiling, float overlap) {
+  GST_INFO("set tiling to %s, overlap %f", isTiling ? "true" : "false", overlap);
+  if (isTiling && (overlap < 0 || overlap > 0.5)) {
+    GST_WARNING("tiling set error");
+    this->sendSetParamSetResult("tiling", "E004");
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    if (isTiling) {
+      this->pipeline.getTiling().setGrid(overlap);
+    } else {
+      this->pipeline.getTiling().disable();
+    }
+  }
+  this->sendSetParamSetResult("tiling", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::getMetrics() {
+  GST_INFO("get metrics");
+  Json::Value metrics;
+  metrics["sessionId"] = this->sessionId;
+  metrics["session"] = this->pipeline.getSessionMetrics().toJSON();
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    metrics["modelName"] = this->model != nullptr ? this->modelName : "";
+  }
+  StageMetrics *modelMetrics = this->pipeline.getModelMetrics();
+  if (modelMetrics != nullptr) {
+    metrics["model"] = modelMetrics->toJSON();
+  }
+  statsReport event(this->getSharedFromThis(), statsReport::getName(), utils::jsonToString(metrics));
+  signalstatsReport(event);
+  return true;
+}
+
+bool ObjDetOpenCVImpl::reloadConfig() {
+  if (objdet::modelPool.requestReload() == false) {
+    this->sendSetParamSetResult("reloadconfig", "E007");
+    return false;
+  }
+  this->sendSetParamSetResult("reloadconfig", "000");
+  return true;
+}
+
+bool ObjDetOpenCVImpl::setSharedSource(const std::string &sourceKey) {
+  GST_INFO("set shared source to %s", sourceKey.c_str());
+  std::lock_guard<std::mutex> lockNow(this->modelLock);
+  if (this->sharedSource != nullptr) {
+    objdet::sharedInference.unsubscribe(this->sharedSource);
+    this->sharedSource = nullptr;
+  }
+  if (sourceKey.empty() == false) {
+    this->sharedSource = objdet::sharedInference.subscribe(sourceKey);
+  }
+  this->sendSetParamSetResult("sharedsource", "000");
+  return true;
+}
+
 bool ObjDetOpenCVImpl::destroy() {
+  this->cancelWait();
+  std::lock_guard<std::mutex> lockNow(this->modelLock);
   if (this->model != nullptr) {
     objdet::modelPool.returnModel(this->modelName, this->model, this->sessionId);
     GST_INFO("release a model");
     this->model = nullptr;
+    objdet::governor.setModel(this->governed, "");
     this->sendSetParamSetResult("destroy", "000");
     return true;
   } else {
@@ -215,7 +393,15 @@ bool ObjDetOpenCVImpl::destroy() {
   }
 }
 
+void ObjDetOpenCVImpl::stopAsyncWorker() { std::atomic_store(&this->asyncWorker, std::shared_ptr<AsyncWorker>()); }
+
 ObjDetOpenCVImpl::~ObjDetOpenCVImpl() {
+  this->stopAsyncWorker();
+  objdet::governor.leave(this->governed);
+  this->cancelWait();
+  if (this->sharedSource != nullptr) {
+    objdet::sharedInference.unsubscribe(this->sharedSource);
+  }
   if (this->model != nullptr) {
     objdet::modelPool.returnModel(this->modelName, this->model, this->sessionId);
     this->model = nullptr;
@@ -227,22 +413,206 @@ ObjDetOpenCVImpl::~ObjDetOpenCVImpl() {
 // private
 // ================================================================================================================
 
-inline bool ObjDetOpenCVImpl::checkDelay(cv::Mat &mat, const std::chrono::system_clock::time_point &now) {
-  if (this->inferringDelayMsec > 0) {
-    std::time_t nowMilliSec = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-    if (nowMilliSec - this->lastInferringTimestampMs < this->inferringDelayMsec) {
+inline void ObjDetOpenCVImpl::processFrame(cv::Mat &mat) {
+  this->checkRate();
+
+  // inferring delay and governed rate
+
+  if (this->checkDelay(mat, steadyNowMs()) == false) {
+    return;
+  }
+
+  if (this->checkSession() == false) {
+    return;
+  }
+
+  if (this->checkModel() == false) {
+    return;
+  }
+
+  if (this->checkSessionIsValid() == false) {
+    return;
+  }
+
+  std::shared_ptr<AsyncWorker> worker = std::atomic_load(&this->asyncWorker);
+  if (this->checkMotion(mat, worker != nullptr) == false) {
+    return;
+  }
+
+  if (worker != nullptr) {
+    this->submitFrame(worker, mat);
+  } else {
+    this->inferFrame(mat);
+  }
+}
+
+inline void ObjDetOpenCVImpl::inferFrame(cv::Mat &mat) {
+  GST_DEBUG("do inferring");
+  std::vector<utils::Obj> &objs = this->frameBoxes;
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    if (this->model == nullptr) {
+      return;
+    }
+    GST_DEBUG("feed mat into model");
+    this->runModel(mat, this->framePts.load(std::memory_order_relaxed), objs);
+  }
+  GST_DEBUG("inferred %d objs", static_cast<int>(objs.size()));
+
+  this->pipeline.track(objs);
+
+  this->drawObjects(mat, objs);
+
+  this->sendBoxes(objs, mat.size());
+
+  if (this->isDrawing && this->keepBoxes == true) {
+    this->lastBoxes = objs;
+  }
+  this->gatedBoxes = objs;
+}
+
+inline void ObjDetOpenCVImpl::runModel(const cv::Mat &mat, uint64_t pts, std::vector<utils::Obj> &objs) {
+  // tiles and regions are this session's own view of the frame, only whole frames are shared
+  if (this->sharedSource != nullptr && this->pipeline.getTiling().isEnabled() == false) {
+    this->pipeline.infer(*this->model, mat, this->confiThresh, this->boxLimit, objs,
+                         [this, pts](const cv::Mat &mat, std::vector<utils::Obj> &objs) { this->inferShared(mat, pts, objs); });
+  } else {
+    // a failed inference must not stay in flight, the governor would keep lowering the cost of the model
+    GovernedInfer governedInfer(objdet::governor, this->governed);
+    this->pipeline.infer(*this->model, mat, this->confiThresh, this->boxLimit, objs);
+  }
+}
+
+inline void ObjDetOpenCVImpl::inferShared(const cv::Mat &mat, uint64_t pts, std::vector<utils::Obj> &objs) {
+  std::string variant = this->modelName + ":" + std::to_string(this->model->getInputSize());
+  bool isShared = objdet::sharedInference.infer(
+      *this->sharedSource, mat, pts, variant, this->confiThresh, this->boxLimit,
+      [this, &mat](float minConfidence, int maxCount, std::vector<utils::Obj> &output) {
+        GovernedInfer governedInfer(objdet::governor, this->governed);
+        this->model->setOutputLimits(minConfidence, maxCount);
+        this->model->infer(mat, output);
+      },
+      objs);
+  if (isShared) {
+    this->pipeline.countEvent(Counter::SHARED_HITS);
+  }
+}
+
+inline void ObjDetOpenCVImpl::submitFrame(const std::shared_ptr<AsyncWorker> &worker, cv::Mat &mat) {
+  GST_DEBUG("submit frame to async worker");
+  worker->submit(mat, this->framePts.load(std::memory_order_relaxed));
+
+  // draw the tracks at this frame's time, the worker sends them when its inference finishes
+  if (this->pipeline.predict(mat.size(), this->trackedBoxes)) {
+    this->drawObjects(mat, this->trackedBoxes);
+    return;
+  }
+
+  // attach the latest finished result to this frame
+  std::lock_guard<std::mutex> lockNow(this->asyncBoxesLock);
+  this->drawObjects(mat, this->asyncBoxes);
+  if (this->isDrawing && this->keepBoxes == true) {
+    this->lastBoxes = this->asyncBoxes;
+  }
+}
+
+void ObjDetOpenCVImpl::inferAsyncFrame(const cv::Mat &frame, uint64_t pts) {
+  GST_DEBUG("do async inferring");
+  std::vector<utils::Obj> &objs = this->workerBoxes;
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    if (this->model == nullptr) {
+      return;
+    }
+    this->runModel(frame, pts, objs);
+  }
+  GST_DEBUG("inferred %d objs", static_cast<int>(objs.size()));
+
+  this->pipeline.track(objs);
+
+  this->sendBoxes(objs, frame.size());
+
+  std::lock_guard<std::mutex> lockNow(this->asyncBoxesLock);
+  this->asyncBoxes = objs;
+}
+
+inline void ObjDetOpenCVImpl::recordLatency(const std::chrono::steady_clock::time_point &start) {
+  this->pipeline.recordStage(Stage::FRAME, start);
+  double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  this->latencyFrames++;
+  this->latencySumMs += elapsedMs;
+  this->latencyMaxMs = std::max(this->latencyMaxMs, elapsedMs);
+  if (this->latencyFrames < latencyReportFrames) {
+    return;
+  }
+
+  std::shared_ptr<AsyncWorker> worker = std::atomic_load(&this->asyncWorker);
+  GST_INFO("process latency avg %.3f ms, max %.3f ms over %d frames (%s, %zu frames dropped)",
+           this->latencySumMs / this->latencyFrames, this->latencyMaxMs, this->latencyFrames, worker != nullptr ? "async" : "sync",
+           worker != nullptr ? worker->getDroppedCount() : static_cast<size_t>(0));
+
+  Json::Value stats;
+  stats["frames"] = this->latencyFrames;
+  stats["latencyAvgMs"] = this->latencySumMs / this->latencyFrames;
+  stats["latencyMaxMs"] = this->latencyMaxMs;
+  stats["mode"] = worker != nullptr ? "async" : "sync";
+  stats["dropped"] = static_cast<Json::UInt64>(worker != nullptr ? worker->getDroppedCount() : 0);
+  uint64_t gateHits;
+  uint64_t gateMisses;
+  if (this->pipeline.getGateCounts(gateHits, gateMisses)) {
+    stats["gateHits"] = static_cast<Json::UInt64>(gateHits);
+    stats["gateMisses"] = static_cast<Json::UInt64>(gateMisses);
+  }
+  statsReport event(this->getSharedFromThis(), statsReport::getName(), utils::jsonToString(stats));
+  signalstatsReport(event);
+  this->latencyFrames = 0;
+  this->latencySumMs = 0;
+  this->latencyMaxMs = 0;
+}
+
+inline Detector *ObjDetOpenCVImpl::checkoutModel(const std::string &modelName) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Detector *model = objdet::modelPool.getModel(modelName);
+  uint64_t micros = elapsedUs(start);
+  this->pipeline.getSessionMetrics().record(Stage::CHECKOUT, micros);
+  StageMetrics *modelMetrics = objdet::modelPool.getModelMetrics(modelName);
+  if (modelMetrics != nullptr) {
+    modelMetrics->record(Stage::CHECKOUT, micros);
+  }
+  return model;
+}
+
+inline bool ObjDetOpenCVImpl::checkDelay(cv::Mat &mat, int64_t nowMs) {
+  float effectiveFps = this->governed->getEffectiveFps();
+  int intervalMs = std::max(this->inferringDelayMsec, effectiveFps > 0 ? static_cast<int>(1000 / effectiveFps) : 0);
+  if (intervalMs > 0) {
+    if (nowMs < this->nextInferringMs) {
       GST_LOG("skip inferring due to delay inferring");
-      if (this->isDrawing && this->keepBoxes && lastBoxes.size() > 0) {
-        utils::drawObjs(mat, mat, lastBoxes, false, 0.4, cv::Scalar(0, 255, 0));
+      this->pipeline.countEvent(Counter::SKIPPED_DELAY);
+      if (this->pipeline.predict(mat.size(), this->trackedBoxes)) {
+        this->drawObjects(mat, this->trackedBoxes);
+        this->sendBoxes(this->trackedBoxes, mat.size());
+      } else if (this->isDrawing && this->keepBoxes && lastBoxes.size() > 0) {
+        this->drawObjects(mat, lastBoxes);
         this->sendBoxes(lastBoxes, mat.size());
       }
       return false;
     }
-    this->lastInferringTimestampMs = nowMilliSec;
+    // keep the schedule's phase so that the rate does not round down to whole frame intervals, unless it fell behind
+    this->nextInferringMs = nowMs - this->nextInferringMs >= intervalMs ? nowMs + intervalMs : this->nextInferringMs + intervalMs;
   }
   return true;
 }
 
+inline void ObjDetOpenCVImpl::checkRate() {
+  float effectiveFps = this->governed->getEffectiveFps();
+  float reportedFps = this->reportedFps.load(std::memory_order_relaxed);
+  // report changes beyond 5 percent, or between limited and unlimited
+  if (reportedFps < 0 || (effectiveFps == 0) != (reportedFps == 0) || std::abs(effectiveFps - reportedFps) > 0.05f * reportedFps) {
+    this->sendRate(effectiveFps);
+  }
+}
+
 inline bool ObjDetOpenCVImpl::checkSession() {
   if (this->sessionId == "") {
     GST_WARNING("session is not init");
@@ -263,73 +633,54 @@ inline bool ObjDetOpenCVImpl::checkModel() {
   return true;
 }
 
-inline bool ObjDetOpenCVImpl::checkSessionIsValid(const std::chrono::system_clock::time_point &now) {
-  std::time_t nowStamp = std::chrono::system_clock::to_time_t(now);
-  if (nowStamp - this->sessCheckTimestamp > 60) {
-    if (objdet::modelPool.sessionExists(this->modelName, this->sessionId) == false) {
-      GST_WARNING("session expired %s", this->sessionId.c_str());
-      sendErrorMessage("E003", "session expired");
+inline bool ObjDetOpenCVImpl::checkSessionIsValid() {
+  if (this->sessionExpired->load(std::memory_order_acquire)) {
+    GST_WARNING("session expired %s", this->sessionId.c_str());
+    sendErrorMessage("E003", "session expired");
+    {
+      std::lock_guard<std::mutex> lockNow(this->modelLock);
       this->model = nullptr;
-      this->isInferring = false;
-      return false;
     }
-
-    this->sessCheckTimestamp = nowStamp;
+    objdet::governor.setModel(this->governed, "");
+    this->isInferring = false;
+    return false;
   }
   return true;
 }
 
-inline void ObjDetOpenCVImpl::filterByConfidence(std::vector<utils::Obj> &objs) {
+inline bool ObjDetOpenCVImpl::checkMotion(cv::Mat &mat, bool isAsync) {
+  if (this->pipeline.isStatic(mat) == false) {
+    return true;
+  }
 
-  std::vector<utils::Obj> objsTmp;
-  for (utils::Obj &obj : objs) {
-    if (obj.confi >= this->confiThresh) {
-      auto it = std::lower_bound(objsTmp.begin(), objsTmp.end(), obj);
-      objsTmp.insert(it, obj);
+  // repeat the last result the same way a new inference would have delivered it
+  if (this->pipeline.predict(mat.size(), this->trackedBoxes)) {
+    this->drawObjects(mat, this->trackedBoxes);
+    if (isAsync == false) {
+      this->sendBoxes(this->trackedBoxes, mat.size());
     }
+  } else if (isAsync) {
+    std::lock_guard<std::mutex> lockNow(this->asyncBoxesLock);
+    this->drawObjects(mat, this->asyncBoxes);
+  } else {
+    this->drawObjects(mat, this->gatedBoxes);
+    this->sendBoxes(this->gatedBoxes, mat.size());
   }
-  objs = objsTmp;
-  GST_DEBUG("%d objs are above confidence %f", static_cast<int>(objs.size()), this->confiThresh);
+  return false;
 }
 
 inline void ObjDetOpenCVImpl::drawObjects(cv::Mat &mat, const std::vector<utils::Obj> &objs) {
-  if (this->isDrawing == true && objs.size() > 0) {
-    GST_DEBUG("draw objs");
-    utils::drawObjs(mat, mat, objs, false, 0.4, cv::Scalar(0, 255, 0));
-  }
-}
-
-inline void ObjDetOpenCVImpl::filterByBoxLimit(std::vector<utils::Obj> &objs) {
-
-  if (static_cast<int>(objs.size()) > this->boxLimit) {
-    std::vector<utils::Obj> objsTmp(objs.begin(), objs.begin() + std::min(objs.size(), size_t(this->boxLimit)));
-    objs = objsTmp;
-    GST_DEBUG("%d objs after truncating additional objs, max= %d", static_cast<int>(objs.size()), this->boxLimit);
+  if (this->isDrawing == true) {
+    this->pipeline.draw(mat, objs);
   }
 }
 
 inline void ObjDetOpenCVImpl::sendBoxes(const std::vector<utils::Obj> &objs, const cv::Size &size) {
-  if (objs.size() == 0) {
-    return;
-  }
-  Json::Value boxes(Json::arrayValue);
-  for (const utils::Obj &obj : objs) {
-    Json::Value box;
-    box["x1"] = obj.p1.x;
-    box["y1"] = obj.p1.y;
-    box["x2"] = obj.p2.x;
-    box["y2"] = obj.p2.y;
-    box["x1r"] = obj.p1.x / static_cast<float>(size.width);
-    box["y1r"] = obj.p1.y / static_cast<float>(size.height);
-    box["x2r"] = obj.p2.x / static_cast<float>(size.width);
-    box["y2r"] = obj.p2.y / static_cast<float>(size.height);
-    box["name"] = obj.name;
-    box["confi"] = obj.confi;
-    boxes.append(box);
-  }
-  GST_DEBUG("signalboxDetected");
-  boxDetected event(this->getSharedFromThis(), boxDetected::getName(), utils::jsonToString(boxes));
-  signalboxDetected(event);
+  this->pipeline.encode(objs, size, [this](const std::string &payload) {
+    GST_DEBUG("signalboxDetected");
+    boxDetected event(this->getSharedFromThis(), boxDetected::getName(), payload);
+    signalboxDetected(event);
+  });
 }
 
 void ObjDetOpenCVImpl::sendSetParamSetResult(const std::string &param_name, const std::string &state) {
@@ -341,6 +692,18 @@ void ObjDetOpenCVImpl::sendSetParamSetResult(const std::string &param_name, cons
   signalparamSetState(event);
 }
 
+void ObjDetOpenCVImpl::sendRate(float effectiveFps) {
+  this->reportedFps.store(effectiveFps, std::memory_order_relaxed);
+  Json::Value rate;
+  rate["targetFps"] = this->governed->getTargetFps();
+  rate["effectiveFps"] = effectiveFps;
+  rate["priority"] = this->governed->getPriority();
+  rate["latencyMs"] = objdet::governor.getLatencyMs(this->modelName);
+  inferRateChanged event(this->getSharedFromThis(), inferRateChanged::getName(), utils::jsonToString(rate));
+  GST_INFO("effective inferring rate %f fps", effectiveFps);
+  signalinferRateChanged(event);
+}
+
 void ObjDetOpenCVImpl::sendErrorMessage(const std::string &state, const std::string &msg) {
   Json::Value result;
   result["state"] = state;
@@ -352,32 +715,148 @@ void ObjDetOpenCVImpl::sendErrorMessage(const std::string &state, const std::str
 
 bool ObjDetOpenCVImpl::initSession(const std::string &modelName) {
   GST_INFO("init session");
-  this->modelName = modelName;
-  if (this->modelName == "default") {
-    this->modelName = objdet::modelPool.getDefaultModelName();
+  std::string targetName = modelName == "default" ? objdet::modelPool.getDefaultModelName() : modelName;
+  this->cancelWait();
+  uint64_t ticket = objdet::modelPool.newTicket();
+  bool isReleased = false;
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    // the model held so far goes back under its own name, modelName keeps naming it until another one is admitted
+    if (this->model != nullptr) {
+      objdet::modelPool.returnModel(this->modelName, this->model, this->sessionId);
+      this->model = nullptr;
+      this->pipeline.setModelMetrics(nullptr);
+      isReleased = true;
+    }
+    this->waitTicket = ticket;
+    this->waitModelName = targetName;
+  }
+  if (isReleased) {
+    objdet::governor.setModel(this->governed, "");
+  }
+
+  //// the callbacks may outlive the filter, a model handed to a filter that is gone goes back to the pool
+  std::weak_ptr<MediaObject> self = this->getSharedFromThis();
+  auto onAdmitted = [this, self, ticket, targetName](Detector *model, uint64_t waitUs) {
+    std::shared_ptr<MediaObject> alive = self.lock();
+    if ((alive == nullptr || this->admitModel(ticket, model, waitUs) == false) && model != nullptr) {
+      objdet::modelPool.returnModel(targetName, model, "");
+    }
+  };
+  auto onPosition = [this, self, ticket](int position) {
+    if (std::shared_ptr<MediaObject> alive = self.lock()) {
+      this->sendQueuePosition(ticket, position);
+    }
+  };
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int position = 0;
+  Detector *model = objdet::modelPool.getModelOrWait(targetName, this->governed->getPriority(), ticket, onAdmitted, onPosition, position);
+  uint64_t micros = elapsedUs(start);
+  this->pipeline.getSessionMetrics().record(Stage::CHECKOUT, micros);
+  StageMetrics *modelMetrics = objdet::modelPool.getModelMetrics(targetName);
+  if (modelMetrics != nullptr) {
+    modelMetrics->record(Stage::CHECKOUT, micros);
+  }
+
+  if (model != nullptr) {
+    if (this->admitModel(ticket, model, 0) == false) {
+      objdet::modelPool.returnModel(targetName, model, "");
+    }
+  } else if (position > 0) {
+    this->sendQueuePosition(ticket, position);
+  } else {
+    // the wait is over before it began
+    this->admitModel(ticket, nullptr, 0);
   }
-  this->model = objdet::modelPool.getModel(this->modelName);
+  return true;
+}
+
+void ObjDetOpenCVImpl::registerModel() {
+  this->sessionExpired->store(false, std::memory_order_release);
+  std::weak_ptr<std::atomic<bool>> expired = this->sessionExpired;
+  objdet::modelPool.registerSession(this->modelName, this->model, this->sessionId, [expired]() {
+    if (std::shared_ptr<std::atomic<bool>> flag = expired.lock()) {
+      flag->store(true, std::memory_order_release);
+    }
+  });
+}
 
+bool ObjDetOpenCVImpl::admitModel(uint64_t ticket, Detector *model, uint64_t waitUs) {
   Json::Value modelState;
-  if (this->model != nullptr) {
-    objdet::modelPool.registerSession(this->modelName, this->model, this->sessionId);
+  std::string readyModelName;
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    if (this->waitTicket != ticket) {
+      return false;
+    }
+    this->waitTicket = 0;
+    if (model == nullptr) {
+      GST_WARNING("no model is available");
+      modelState["state"] = "E005";
+      modelState["msg"] = waitUs > 0 ? "timed out waiting for a model" : "Model not available or not found";
+      this->sendSessionInitState(modelState);
+      return true;
+    }
+    if (this->model != nullptr) {
+      objdet::modelPool.returnModel(this->modelName, this->model, this->sessionId);
+    }
+    this->model = model;
+    this->modelName = this->waitModelName;
+    readyModelName = this->modelName;
+    this->pipeline.setModelMetrics(objdet::modelPool.getModelMetrics(this->modelName));
+    this->registerModel();
+    if (this->inputSize != 0 && model->setInputSize(this->inputSize) == false) {
+      GST_WARNING("model %s does not support input size %d, use its default", this->modelName.c_str(), this->inputSize);
+    }
+    if (waitUs > 0) {
+      this->pipeline.getSessionMetrics().record(Stage::QUEUE, waitUs);
+      modelState["waitMs"] = static_cast<Json::UInt64>(waitUs / 1000);
+    }
     GST_INFO("model is ready");
     modelState["state"] = "000";
-    modelState["defaultModel"] = this->modelName;
     modelState["msg"] = "";
-    modelState["sessionId"] = this->sessionId;
-    this->sessCheckTimestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-  } else {
-    GST_WARNING("no model is available");
-    modelState["state"] = "E005";
-    modelState["defaultModel"] = "";
-    modelState["msg"] = "Model not available or not found";
-    modelState["sessionId"] = "";
+    this->sendSessionInitState(modelState);
+  }
+  objdet::governor.setModel(this->governed, readyModelName);
+  return true;
+}
+
+void ObjDetOpenCVImpl::sendQueuePosition(uint64_t ticket, int position) {
+  std::lock_guard<std::mutex> lockNow(this->modelLock);
+  // the wait may have ended on another thread while the position was on its way
+  if (this->waitTicket != ticket) {
+    return;
   }
+  GST_INFO("waiting for a %s model at position %d", this->waitModelName.c_str(), position);
+  Json::Value modelState;
+  modelState["state"] = "W002";
+  modelState["msg"] = "waiting for a model";
+  modelState["queuePosition"] = position;
+  this->sendSessionInitState(modelState);
+}
 
+void ObjDetOpenCVImpl::cancelWait() {
+  uint64_t ticket;
+  std::string modelName;
+  {
+    std::lock_guard<std::mutex> lockNow(this->modelLock);
+    ticket = this->waitTicket;
+    modelName = this->waitModelName;
+    this->waitTicket = 0;
+  }
+  // outside modelLock: leaving the queue moves up the sessions behind, which take their own lock
+  if (ticket != 0 && objdet::modelPool.cancelWait(modelName, ticket)) {
+    GST_INFO("left the %s admission queue", modelName.c_str());
+  }
+}
+
+void ObjDetOpenCVImpl::sendSessionInitState(Json::Value &modelState) {
+  bool isReady = modelState["state"].asString() == "000";
+  modelState["defaultModel"] = isReady ? this->modelName : "";
+  modelState["sessionId"] = isReady ? this->sessionId : "";
   sessionInitState event(this->getSharedFromThis(), sessionInitState::getName(), utils::jsonToString(modelState));
   signalsessionInitState(event);
-  return true;
 }
 
 } // namespace objdet
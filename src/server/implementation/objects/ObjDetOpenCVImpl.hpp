@@ -2,21 +2,32 @@
 
 #ifndef __OBJ_DET_OPENCV_IMPL_HPP__
 #define __OBJ_DET_OPENCV_IMPL_HPP__
-#include "yolov7.hpp"
+#include "Detector.hpp"
 
+#include "AsyncWorker.hpp"
+#include "FramePipeline.hpp"
+#include "Governor.hpp"
+#include "Metrics.hpp"
 #include "ModelPool.hpp"
 #include "ObjDet.hpp"
+#include "SharedInference.hpp"
 #include <EventHandler.hpp>
 #include <OpenCVProcess.hpp>
+#include <atomic>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
 
 namespace kurento {
 namespace module {
 namespace objdet {
 
 extern ModelPool modelPool;
+extern Governor governor;
+extern SharedInference sharedInference;
 
 class ObjDetOpenCVImpl : public virtual OpenCVProcess {
 
@@ -33,6 +44,8 @@ public:
   sigc::signal<void, errorMessage> signalerrorMessage;
   sigc::signal<void, modelNamesEvent> signalmodelNamesEvent;
   sigc::signal<void, modelChanged> signalmodelChanged;
+  sigc::signal<void, statsReport> signalstatsReport;
+  sigc::signal<void, inferRateChanged> signalinferRateChanged;
 
   /// @brief set confidence for filter objects
   bool setConfidence(float confidence);
@@ -62,8 +75,50 @@ public:
 
   /// @brief set inferring delay between frames, to reduce CPU/GPU usage
   bool setInferringDelay(const int msec);
+
+  /// @brief infer on a per-session worker thread instead of the streaming thread
+  bool setAsyncMode(bool isAsync, int queueSize);
+
+  /// @brief set the boxDetected payload format, "json", "binary" or "columnar"
+  bool setOutputFormat(const std::string &format);
+
+  /// @brief only send boxes that appeared, disappeared or moved, with a full keyframe every keyframeMsec
+  bool setDeltaMode(bool isDelta, int keyframeMsec, float iouThresh);
+
+  /// @brief give boxes stable ids and predict them between inferences
+  bool setTracking(bool isTracking, int maxAgeMsec);
+
+  /// @brief skip inferring on static frames and repeat the last result
+  bool setMotionGate(bool isGating, float threshold, int refreshMsec);
+
+  /// @brief request an inference rate, the governor may grant less when the host is loaded
+  bool setTargetFps(float fps, int priority);
+
+  /// @brief run the model at another square input size, trading accuracy for speed, 0 for the model default
+  bool setInputSize(int size);
+
+  /// @brief infer only inside regions, a JSON array of [x, y, width, height] fractions of the frame, [] for the whole frame
+  bool setRegions(const std::string &regionsJSON);
+
+  /// @brief infer on overlapped tiles the size of the model input, so that small objects keep their resolution
+  bool setTiling(bool isTiling, float overlap);
+
+  /// @brief send the stage latencies and counters of this session and of its model in a statsReport
+  bool getMetrics();
+
+  /// @brief reload the model pool config in the background, for every session of the server
+  bool reloadConfig();
+
+  /// @brief share the inference of each frame with the other filters of the same source key, "" to infer alone
+  bool setSharedSource(const std::string &sourceKey);
   bool destroy();
 
+  /// @brief stop the async worker, must be called before the derived filter is torn down
+  void stopAsyncWorker();
+
+  /// @brief timestamp of the buffer the next process() call gets, set on the streaming thread before it
+  void setFramePts(GstClockTime pts) { this->framePts.store(pts, std::memory_order_relaxed); }
+
 private:
   /// @brief session id
   std::string sessionId;
@@ -72,7 +127,10 @@ private:
   std::string modelName;
 
   /// @brief model object
-  Yolov7trt *model;
+  Detector *model = nullptr;
+
+  /// @brief input size picked by setInputSize, kept across model changes, 0 for the model default
+  int inputSize = 0;
 
   /// @brief maximum output objects
   int boxLimit = 10;
@@ -97,24 +155,104 @@ private:
   /// @brief store objects used during inferring delay period
   std::vector<utils::Obj> lastBoxes;
 
-  /// @brief last session check timestamp
-  std::time_t sessCheckTimestamp;
+  /// @brief set by the model pool reaper when the session timed out and lost its model
+  std::shared_ptr<std::atomic<bool>> sessionExpired = std::make_shared<std::atomic<bool>>(false);
+
+  /// @brief steady clock time in millisecond the next frame may be inferred
+  int64_t nextInferringMs = 0;
+
+  /// @brief this session's share of the host inference capacity
+  std::shared_ptr<GovernedSession> governed;
 
-  /// @brief last inferring timestamp in millisecond
-  std::time_t lastInferringTimestampMs;
+  /// @brief last effective rate sent in inferRateChanged, -1 before the first event
+  std::atomic<float> reportedFps{-1};
 
-  inline bool checkDelay(cv::Mat &mat, const std::chrono::system_clock::time_point &now);
+  /// @brief gate, inference, tracking, overlay and encoding of the frames, recording this session's stage latencies and
+  /// counters, its tiling guarded by modelLock
+  FramePipeline pipeline;
+
+  /// @brief guards the model pointer between the worker thread and model switching
+  std::mutex modelLock;
+
+  //// admission queue wait of initSession, guarded by modelLock
+  /// @brief ticket of the pending wait, 0 when not waiting
+  uint64_t waitTicket = 0;
+  /// @brief model the pending wait is for
+  std::string waitModelName;
+
+  /// @brief source whose frames are inferred once for all its filters, nullptr to infer alone, guarded by modelLock
+  std::shared_ptr<SharedSubscription> sharedSource;
+
+  /// @brief buffer timestamp of the frame being processed, GST_CLOCK_TIME_NONE until a buffer was seen
+  std::atomic<GstClockTime> framePts{GST_CLOCK_TIME_NONE};
+
+  /// @brief worker used in async mode, nullptr in sync mode (accessed with std::atomic_load/atomic_store)
+  std::shared_ptr<AsyncWorker> asyncWorker;
+
+  /// @brief guards asyncBoxes
+  std::mutex asyncBoxesLock;
+
+  /// @brief latest objects produced by the worker, drawn on the following frames
+  std::vector<utils::Obj> asyncBoxes;
+
+  /// @brief predicted objects of the current frame, reused across frames
+  std::vector<utils::Obj> trackedBoxes;
+
+  /// @brief result of the last sync inference, repeated on static frames
+  std::vector<utils::Obj> gatedBoxes;
+
+  //// results being processed on the streaming and on the worker thread, reused across frames
+  std::vector<utils::Obj> frameBoxes;
+  std::vector<utils::Obj> workerBoxes;
+
+  //// streaming thread latency of process(), reported every latencyReportFrames frames
+  static const int latencyReportFrames = 300;
+  int latencyFrames = 0;
+  double latencySumMs = 0;
+  double latencyMaxMs = 0;
+
+  inline bool checkDelay(cv::Mat &mat, int64_t nowMs);
+  inline void checkRate();
   inline bool checkSession();
   inline bool checkModel();
-  inline bool checkSessionIsValid(const std::chrono::system_clock::time_point &now);
-  inline void filterByConfidence(std::vector<utils::Obj> &objs);
-  inline void filterByBoxLimit(std::vector<utils::Obj> &objs);
+  inline bool checkSessionIsValid();
+  inline bool checkMotion(cv::Mat &mat, bool isAsync);
   inline void drawObjects(cv::Mat &mat, const std::vector<utils::Obj> &objs);
   inline void sendBoxes(const std::vector<utils::Obj> &objs, const cv::Size &size);
+  inline void recordLatency(const std::chrono::steady_clock::time_point &start);
+  inline Detector *checkoutModel(const std::string &modelName);
+  inline void processFrame(cv::Mat &mat);
+  inline void runModel(const cv::Mat &mat, uint64_t pts, std::vector<utils::Obj> &objs);
+  inline void inferShared(const cv::Mat &mat, uint64_t pts, std::vector<utils::Obj> &objs);
+  inline void inferFrame(cv::Mat &mat);
+  inline void submitFrame(const std::shared_ptr<AsyncWorker> &worker, cv::Mat &mat);
+  void inferAsyncFrame(const cv::Mat &frame, uint64_t pts);
 
   void sendSetParamSetResult(const std::string &param_name, const std::string &state);
   void sendErrorMessage(const std::string &state, const std::string &msg);
+  void sendRate(float effectiveFps);
   bool initSession(const std::string &modelName);
+
+  /// @brief register the current model with the pool and get notified if the session expires
+  void registerModel();
+
+  /**
+   * @brief take the model a wait ended with and send sessionInitState
+   *
+   * @param model nullptr if the wait timed out
+   * @param waitUs time spent in the admission queue
+   * @return false if the wait was cancelled or superseded, the caller then returns the model
+   */
+  bool admitModel(uint64_t ticket, Detector *model, uint64_t waitUs);
+
+  /// @brief send the queue position of a pending wait in sessionInitState
+  void sendQueuePosition(uint64_t ticket, int position);
+
+  /// @brief leave the admission queue, a model handed over meanwhile is returned by the callback
+  void cancelWait();
+
+  /// @brief send sessionInitState with the current model, or without a model for an error state
+  void sendSessionInitState(Json::Value &modelState);
 };
 
 } // namespace objdet
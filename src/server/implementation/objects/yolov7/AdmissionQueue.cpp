@@ -0,0 +1,65 @@
+#include "AdmissionQueue.hpp"
+#include <algorithm>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+int AdmissionQueue::push(Waiter waiter) {
+  auto at = std::find_if(this->waiters.begin(), this->waiters.end(),
+                         [&waiter](const Waiter &queued) { return queued.priority < waiter.priority; });
+  at = this->waiters.insert(at, std::move(waiter));
+  return static_cast<int>(at - this->waiters.begin()) + 1;
+}
+
+bool AdmissionQueue::pop(Waiter &waiter) {
+  if (this->waiters.empty()) {
+    return false;
+  }
+  waiter = std::move(this->waiters.front());
+  this->waiters.erase(this->waiters.begin());
+  return true;
+}
+
+bool AdmissionQueue::remove(uint64_t ticket, std::vector<Move> &moves) {
+  auto found =
+      std::find_if(this->waiters.begin(), this->waiters.end(), [ticket](const Waiter &queued) { return queued.ticket == ticket; });
+  if (found == this->waiters.end()) {
+    return false;
+  }
+  found = this->waiters.erase(found);
+  for (auto it = found; it != this->waiters.end(); ++it) {
+    moves.push_back(Move{it->onPosition, static_cast<int>(it - this->waiters.begin()) + 1});
+  }
+  return true;
+}
+
+void AdmissionQueue::expire(std::chrono::steady_clock::time_point before, std::vector<Waiter> &expired, std::vector<Move> &moves) {
+  size_t kept = 0;
+  bool isMoved = false;
+  for (size_t i = 0; i < this->waiters.size(); i++) {
+    if (this->waiters[i].since < before) {
+      expired.push_back(std::move(this->waiters[i]));
+      isMoved = true;
+      continue;
+    }
+    if (isMoved) {
+      moves.push_back(Move{this->waiters[i].onPosition, static_cast<int>(kept) + 1});
+    }
+    if (kept != i) {
+      this->waiters[kept] = std::move(this->waiters[i]);
+    }
+    kept++;
+  }
+  this->waiters.resize(kept);
+}
+
+void AdmissionQueue::collectMoves(std::vector<Move> &moves) const {
+  for (size_t i = 0; i < this->waiters.size(); i++) {
+    moves.push_back(Move{this->waiters[i].onPosition, static_cast<int>(i) + 1});
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
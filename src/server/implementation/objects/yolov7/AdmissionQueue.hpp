@@ -0,0 +1,81 @@
+#pragma once
+#include "Detector.hpp"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief sessions waiting for an instance of a model, higher priority first, then in arrival order
+ *
+ * Only the ordering, the pool guards it with the bundle's admission lock and hands the instances out, so the queue can
+ * be exercised without models.
+ */
+class AdmissionQueue {
+public:
+  /**
+   * @brief called once the wait is over, outside of the pool locks
+   *
+   * @param model the instance, checked out for the session as by getModel, nullptr if the wait timed out
+   * @param waitUs time spent in the queue
+   */
+  using AdmittedCallback = std::function<void(Detector *model, uint64_t waitUs)>;
+
+  /// @brief called with the new 1-based position when sessions ahead left the queue, outside of the pool locks
+  using PositionCallback = std::function<void(int position)>;
+
+  struct Waiter {
+    uint64_t ticket;
+    int priority;
+    std::chrono::steady_clock::time_point since;
+    AdmittedCallback onAdmitted;
+    PositionCallback onPosition;
+  };
+
+  /// @brief a waiter that moved up and the position to report to it
+  struct Move {
+    PositionCallback onPosition;
+    int position;
+  };
+
+  /// @brief add a waiter behind the ones of the same or a higher priority, returns its 1-based position
+  int push(Waiter waiter);
+
+  /// @brief take the head waiter, false if the queue is empty
+  bool pop(Waiter &waiter);
+
+  /**
+   * @brief remove a waiter
+   *
+   * @param moves appended with the waiters behind it and their new positions
+   * @return false if the ticket is not queued
+   */
+  bool remove(uint64_t ticket, std::vector<Move> &moves);
+
+  /**
+   * @brief remove the waiters queued before a time
+   *
+   * @param expired appended with the removed waiters
+   * @param moves appended with the remaining waiters that moved up and their new positions
+   */
+  void expire(std::chrono::steady_clock::time_point before, std::vector<Waiter> &expired, std::vector<Move> &moves);
+
+  /// @brief the positions of all waiters, after waiters were popped from the head
+  void collectMoves(std::vector<Move> &moves) const;
+
+  size_t size() const { return this->waiters.size(); }
+
+  bool empty() const { return this->waiters.empty(); }
+
+private:
+  /// @brief in serving order
+  std::vector<Waiter> waiters;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
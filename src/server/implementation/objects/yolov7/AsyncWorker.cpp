@@ -0,0 +1,111 @@
+#include "AsyncWorker.hpp"
+#include <algorithm>
+#include <gst/gst.h>
+
+GST_DEBUG_CATEGORY_STATIC(obj_det_async_worker);
+#define GST_CAT_DEFAULT obj_det_async_worker
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+AsyncWorker::AsyncWorker(Job job, size_t capacity) : job(std::move(job)) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_async_worker, "ObjDetAsyncWorker", GST_DEBUG_BG_BLUE, "ObjDetAsyncWorker");
+  capacity = std::max(capacity, static_cast<size_t>(1));
+  // one extra slot for the frame being processed by the worker
+  this->slots.resize(capacity + 1);
+  this->slotPts.resize(capacity + 1);
+  for (size_t i = 0; i < this->slots.size(); i++) {
+    this->freeSlots.push_back(i);
+  }
+  this->queue.resize(capacity);
+  GST_INFO("start async worker, queue capacity %zu", capacity);
+  this->thread = std::thread(&AsyncWorker::run, this);
+}
+
+AsyncWorker::~AsyncWorker() {
+  {
+    std::lock_guard<std::mutex> lockNow(this->lock);
+    this->isStopping = true;
+  }
+  this->cond.notify_all();
+  if (this->thread.joinable()) {
+    this->thread.join();
+  }
+  GST_INFO("async worker stopped, %zu frames dropped", this->droppedCount.load());
+}
+
+bool AsyncWorker::submit(const cv::Mat &frame, uint64_t pts) {
+  size_t slot;
+  bool isDropped = false;
+  {
+    std::lock_guard<std::mutex> lockNow(this->lock);
+    if (this->freeSlots.empty()) {
+      //// queue full: recycle the oldest queued frame
+      slot = this->popQueued();
+      isDropped = true;
+    } else {
+      slot = this->freeSlots.back();
+      this->freeSlots.pop_back();
+    }
+  }
+  if (isDropped) {
+    this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+    GST_LOG("queue full, drop the oldest frame");
+  }
+
+  // the slot is owned by this thread until queued
+  frame.copyTo(this->slots[slot]);
+  this->slotPts[slot] = pts;
+
+  {
+    std::lock_guard<std::mutex> lockNow(this->lock);
+    this->queue[(this->queueHead + this->queueCount) % this->queue.size()] = slot;
+    this->queueCount++;
+  }
+  this->cond.notify_one();
+  return isDropped == false;
+}
+
+size_t AsyncWorker::getQueuedCount() {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  return this->queueCount;
+}
+
+size_t AsyncWorker::getDroppedCount() const { return this->droppedCount.load(std::memory_order_relaxed); }
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void AsyncWorker::run() {
+  std::unique_lock<std::mutex> lockNow(this->lock);
+  while (true) {
+    this->cond.wait(lockNow, [this] { return this->isStopping || this->queueCount > 0; });
+    if (this->isStopping) {
+      return;
+    }
+    size_t slot = this->popQueued();
+    lockNow.unlock();
+
+    try {
+      this->job(this->slots[slot], this->slotPts[slot]);
+    } catch (const std::exception &e) {
+      GST_ERROR("async job failed: %s", e.what());
+    }
+
+    lockNow.lock();
+    this->freeSlots.push_back(slot);
+  }
+}
+
+size_t AsyncWorker::popQueued() {
+  size_t slot = this->queue[this->queueHead];
+  this->queueHead = (this->queueHead + 1) % this->queue.size();
+  this->queueCount--;
+  return slot;
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,65 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief a per-session worker thread running a job on the most recent frames, off the streaming thread
+class AsyncWorker {
+public:
+  using Job = std::function<void(const cv::Mat &frame, uint64_t pts)>;
+
+  /**
+   * @brief start the worker thread
+   *
+   * @param job called on the worker thread for every dequeued frame
+   * @param capacity maximum queued frames; the oldest one is dropped when full
+   */
+  AsyncWorker(Job job, size_t capacity);
+  ~AsyncWorker();
+
+  /// @brief copy a frame and its buffer timestamp into the queue; returns false if the oldest queued frame had to be dropped
+  bool submit(const cv::Mat &frame, uint64_t pts);
+
+  /// @brief number of queued frames not yet picked by the worker
+  size_t getQueuedCount();
+
+  /// @brief total frames dropped because the queue was full
+  size_t getDroppedCount() const;
+
+private:
+  Job job;
+  std::thread thread;
+  std::mutex lock;
+  std::condition_variable cond;
+  bool isStopping = false;
+  std::atomic<size_t> droppedCount{0};
+
+  /// @brief frame slots, reused so that copies do not reallocate once the frame size is stable
+  std::vector<cv::Mat> slots;
+  std::vector<uint64_t> slotPts;
+
+  /// @brief slots not holding a queued frame and not being processed
+  std::vector<size_t> freeSlots;
+
+  /// @brief ring of queued slot indices, oldest first
+  std::vector<size_t> queue;
+  size_t queueHead = 0;
+  size_t queueCount = 0;
+
+  void run();
+  size_t popQueued();
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
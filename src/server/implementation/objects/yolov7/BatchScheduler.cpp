@@ -0,0 +1,163 @@
+#include "BatchScheduler.hpp"
+#include "Device.hpp"
+#include <algorithm>
+#include <gst/gst.h>
+#include <stdexcept>
+#include <string>
+
+GST_DEBUG_CATEGORY_STATIC(obj_det_batch_scheduler);
+#define GST_CAT_DEFAULT obj_det_batch_scheduler
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+BatchScheduler::BatchScheduler(Detector &engine, int maxBatch, int maxWaitUs)
+    : engine(engine), maxBatch(std::max(std::min(maxBatch, engine.getMaxBatchSize()), 1)),
+      maxWait(std::max(maxWaitUs, 0)), inputSizes(engine.getInputSizes()) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_batch_scheduler, "ObjDetBatchScheduler", GST_DEBUG_BG_MAGENTA, "ObjDetBatchScheduler");
+  GST_INFO("start batch scheduler, max batch %d, max wait %d us", this->maxBatch, maxWaitUs);
+  this->batch.reserve(this->maxBatch);
+  this->batchImgs.reserve(this->maxBatch);
+  this->dispatcher = std::thread(&BatchScheduler::run, this);
+}
+
+BatchScheduler::~BatchScheduler() {
+  {
+    std::lock_guard<std::mutex> lockNow(this->lock);
+    this->isStopping = true;
+  }
+  this->pendingCond.notify_all();
+  if (this->dispatcher.joinable()) {
+    this->dispatcher.join();
+  }
+}
+
+void BatchScheduler::infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output, int inputSize, const OutputLimits &limits) {
+  Request request;
+  request.rgbImg = &rgbImg;
+  request.output = &output;
+  request.inputSize = inputSize;
+  request.limits = limits;
+  this->submit(&request, 1);
+}
+
+void BatchScheduler::inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs,
+                                int inputSize, const OutputLimits &limits) {
+  int count = static_cast<int>(rgbImgs.size());
+  outputs.resize(count);
+  std::vector<Request> requests(count);
+  for (int i = 0; i < count; i++) {
+    requests[i].rgbImg = rgbImgs[i];
+    requests[i].output = &outputs[i];
+    requests[i].inputSize = inputSize;
+    requests[i].limits = limits;
+  }
+  this->submit(requests.data(), count);
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void BatchScheduler::submit(Request *requests, int count) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    if (requests[i].inputSize == 0 && this->inputSizes.empty() == false) {
+      requests[i].inputSize = this->inputSizes.front();
+    }
+    requests[i].submitted = now;
+  }
+
+  std::unique_lock<std::mutex> lockNow(this->lock);
+  if (this->isStopping) {
+    throw std::runtime_error("batch scheduler is stopping");
+  }
+  bool wasEmpty = this->pending.empty();
+  for (int i = 0; i < count; i++) {
+    this->pending.push_back(&requests[i]);
+  }
+  if (wasEmpty || static_cast<int>(this->pending.size()) >= this->maxBatch) {
+    this->pendingCond.notify_one();
+  }
+  this->doneCond.wait(lockNow, [requests, count] {
+    return std::all_of(requests, requests + count, [](const Request &request) { return request.isDone; });
+  });
+  for (int i = 0; i < count; i++) {
+    if (requests[i].error != nullptr) {
+      std::rethrow_exception(requests[i].error);
+    }
+  }
+}
+
+void BatchScheduler::run() {
+  // the dispatcher only drives this engine, its device stays current for the life of the thread
+  if (this->engine.getDeviceId() >= 0) {
+    DeviceInventory::system().selectDevice(this->engine.getDeviceId());
+  }
+  std::unique_lock<std::mutex> lockNow(this->lock);
+  while (true) {
+    //// wait for the first frame, then for a full batch or the deadline of the oldest frame
+    this->pendingCond.wait(lockNow, [this] { return this->isStopping || this->pending.empty() == false; });
+    if (this->pending.empty()) {
+      return;
+    }
+    auto deadline = this->pending.front()->submitted + this->maxWait;
+    this->pendingCond.wait_until(lockNow, deadline,
+                                 [this] { return this->isStopping || static_cast<int>(this->pending.size()) >= this->maxBatch; });
+
+    //// the oldest frame and the frames of its input size, in submission order
+    int inputSize = this->pending.front()->inputSize;
+    this->batch.clear();
+    for (auto it = this->pending.begin(); it != this->pending.end() && static_cast<int>(this->batch.size()) < this->maxBatch;) {
+      if ((*it)->inputSize == inputSize) {
+        this->batch.push_back(*it);
+        it = this->pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    int batchSize = static_cast<int>(this->batch.size());
+    lockNow.unlock();
+
+    //// one engine run for the whole batch
+    GST_LOG("dispatch a batch of %d frames at %d", batchSize, inputSize);
+    this->batchImgs.clear();
+    for (Request *request : this->batch) {
+      this->batchImgs.push_back(request->rgbImg);
+    }
+    std::exception_ptr error;
+    try {
+      if (inputSize != 0 && inputSize != this->engine.getInputSize() && this->engine.setInputSize(inputSize) == false) {
+        throw std::runtime_error("input size not supported: " + std::to_string(inputSize));
+      }
+      this->engine.inferBatch(this->batchImgs, this->batchOutputs);
+    } catch (...) {
+      GST_ERROR("batch inferring failed");
+      error = std::current_exception();
+    }
+
+    //// every session filters its own result, outside the lock
+    if (error == nullptr) {
+      for (int i = 0; i < batchSize; i++) {
+        utils::selectTop(this->batchOutputs[i], this->batch[i]->limits.minConfidence, this->batch[i]->limits.maxCount);
+      }
+    }
+
+    //// scatter results back to the waiting sessions
+    lockNow.lock();
+    for (int i = 0; i < batchSize; i++) {
+      Request *request = this->batch[i];
+      if (error == nullptr) {
+        request->output->swap(this->batchOutputs[i]);
+      }
+      request->error = error;
+      request->isDone = true;
+    }
+    this->doneCond.notify_all();
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
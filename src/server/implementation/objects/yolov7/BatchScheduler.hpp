@@ -0,0 +1,137 @@
+#pragma once
+#include "Detector.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief result filter of one session, see Detector::setOutputLimits
+struct OutputLimits {
+  float minConfidence = 0;
+  int maxCount = std::numeric_limits<int>::max();
+};
+
+/// @brief collects frames from many sessions and runs them through one engine in batches
+class BatchScheduler {
+public:
+  /**
+   * @brief start the dispatcher thread
+   *
+   * @param engine shared engine, must outlive the scheduler
+   * @param maxBatch dispatch as soon as this many frames are pending (capped by the engine)
+   * @param maxWaitUs dispatch a partial batch once its oldest frame waited this long
+   */
+  BatchScheduler(Detector &engine, int maxBatch, int maxWaitUs);
+  ~BatchScheduler();
+
+  /**
+   * @brief submit one frame and block until its result is ready
+   *
+   * @param inputSize input size of the engine run, 0 for its default; frames of different sizes never share a batch
+   * @param limits confidence threshold and box limit of the caller, applied to its result only
+   */
+  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output, int inputSize = 0, const OutputLimits &limits = OutputLimits());
+
+  /// @brief submit several frames at once, so that they can share a batch, and block until all results are ready
+  void inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs, int inputSize = 0,
+                  const OutputLimits &limits = OutputLimits());
+
+  int getMaxBatch() const { return this->maxBatch; }
+
+  /// @brief input sizes of the engine, largest (the default) first
+  const std::vector<int> &getInputSizes() const { return this->inputSizes; }
+
+private:
+  /// @brief a pending frame, owned by the blocked caller
+  struct Request {
+    const cv::Mat *rgbImg;
+    std::vector<utils::Obj> *output;
+    int inputSize;
+    OutputLimits limits;
+    std::chrono::steady_clock::time_point submitted;
+    bool isDone = false;
+    std::exception_ptr error;
+  };
+
+  Detector &engine;
+  const int maxBatch;
+  const std::chrono::microseconds maxWait;
+  const std::vector<int> inputSizes;
+
+  std::mutex lock;
+  std::condition_variable pendingCond;
+  std::condition_variable doneCond;
+  std::deque<Request *> pending;
+  bool isStopping = false;
+  std::thread dispatcher;
+
+  //// dispatcher scratch, reused across batches
+  std::vector<Request *> batch;
+  std::vector<const cv::Mat *> batchImgs;
+  std::vector<std::vector<utils::Obj>> batchOutputs;
+
+  void run();
+
+  /// @brief queue the requests and block until they are done, rethrows the first error
+  void submit(Request *requests, int count);
+};
+
+/// @brief a session handle whose inference goes through a shared BatchScheduler
+class BatchedDetector : public Detector {
+public:
+  explicit BatchedDetector(BatchScheduler &scheduler) : scheduler(scheduler) {}
+
+  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) override {
+    this->scheduler.infer(rgbImg, output, this->inputSize.load(std::memory_order_relaxed), this->limits);
+  }
+
+  int getMaxBatchSize() const override { return this->scheduler.getMaxBatch(); }
+
+  void inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) override {
+    this->scheduler.inferBatch(rgbImgs, outputs, this->inputSize.load(std::memory_order_relaxed), this->limits);
+  }
+
+  void setOutputLimits(float minConfidence, int maxCount) override {
+    this->limits.minConfidence = minConfidence;
+    this->limits.maxCount = maxCount;
+  }
+
+  std::vector<int> getInputSizes() const override { return this->scheduler.getInputSizes(); }
+
+  int getInputSize() const override {
+    int wh = this->inputSize.load(std::memory_order_relaxed);
+    return wh != 0 || this->scheduler.getInputSizes().empty() ? wh : this->scheduler.getInputSizes().front();
+  }
+
+  bool setInputSize(int wh) override {
+    const std::vector<int> &sizes = this->scheduler.getInputSizes();
+    if (wh != 0 && std::find(sizes.begin(), sizes.end(), wh) == sizes.end()) {
+      return false;
+    }
+    this->inputSize.store(wh, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  BatchScheduler &scheduler;
+
+  /// @brief input size of this session, 0 for the engine default
+  std::atomic<int> inputSize{0};
+
+  /// @brief result filter of this session, the shared engine returns every box
+  OutputLimits limits;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,93 @@
+#include "BoxDelta.hpp"
+#include <algorithm>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief boxes of the same class overlapping less than this are different objects
+static const float minMatchIou = 0.1f;
+
+float boxIou(const utils::Obj &a, const utils::Obj &b) {
+  int left = std::max(a.p1.x, b.p1.x);
+  int top = std::max(a.p1.y, b.p1.y);
+  int right = std::min(a.p2.x, b.p2.x);
+  int bottom = std::min(a.p2.y, b.p2.y);
+  if (right <= left || bottom <= top) {
+    return 0;
+  }
+  float intersection = static_cast<float>(right - left) * (bottom - top);
+  float areaA = static_cast<float>(a.p2.x - a.p1.x) * (a.p2.y - a.p1.y);
+  float areaB = static_cast<float>(b.p2.x - b.p1.x) * (b.p2.y - b.p1.y);
+  return intersection / (areaA + areaB - intersection);
+}
+
+void BoxDelta::configure(int keyframeMsec, float iouThresh) {
+  this->keyframeMsec = keyframeMsec;
+  this->iouThresh = iouThresh;
+  this->isKeyframePending = true;
+}
+
+bool BoxDelta::update(const std::vector<utils::Obj> &objs, int64_t nowMs) {
+  this->keyframe = this->isKeyframePending || nowMs - this->lastKeyframeMs >= this->keyframeMsec;
+
+  //// pair client boxes with new boxes of the same class, best overlaps first
+  this->matches.clear();
+  for (int p = 0; p < static_cast<int>(this->boxes.size()); p++) {
+    for (int c = 0; c < static_cast<int>(objs.size()); c++) {
+      if (this->boxes[p].obj.classIdx != objs[c].classIdx) {
+        continue;
+      }
+      float iou = boxIou(this->boxes[p].obj, objs[c]);
+      if (iou >= minMatchIou) {
+        this->matches.push_back(Match{iou, p, c});
+      }
+    }
+  }
+  std::sort(this->matches.begin(), this->matches.end(), [](const Match &a, const Match &b) { return a.iou > b.iou; });
+  this->previousMatch.assign(this->boxes.size(), -1);
+  this->currentMatch.assign(objs.size(), -1);
+  for (const Match &match : this->matches) {
+    if (this->previousMatch[match.previous] < 0 && this->currentMatch[match.current] < 0) {
+      this->previousMatch[match.previous] = match.current;
+      this->currentMatch[match.current] = match.previous;
+    }
+  }
+
+  //// build the new client state
+  this->nextBoxes.clear();
+  this->added.clear();
+  this->moved.clear();
+  this->removed.clear();
+  for (int p = 0; p < static_cast<int>(this->boxes.size()); p++) {
+    if (this->previousMatch[p] < 0) {
+      this->removed.push_back(this->boxes[p].id);
+    }
+  }
+  for (int c = 0; c < static_cast<int>(objs.size()); c++) {
+    int p = this->currentMatch[c];
+    int index = static_cast<int>(this->nextBoxes.size());
+    if (p < 0) {
+      this->nextBoxes.push_back(DeltaBox{this->nextId++, objs[c]});
+      this->added.push_back(index);
+    } else if (this->keyframe || boxIou(this->boxes[p].obj, objs[c]) < this->iouThresh) {
+      this->nextBoxes.push_back(DeltaBox{this->boxes[p].id, objs[c]});
+      this->moved.push_back(index);
+    } else {
+      // within tolerance, the client keeps its copy so that slow drifts still get reported once they add up
+      this->nextBoxes.push_back(this->boxes[p]);
+    }
+  }
+  this->boxes.swap(this->nextBoxes);
+
+  if (this->keyframe) {
+    this->lastKeyframeMs = nowMs;
+    this->isKeyframePending = false;
+    return true;
+  }
+  return this->added.empty() == false || this->moved.empty() == false || this->removed.empty() == false;
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
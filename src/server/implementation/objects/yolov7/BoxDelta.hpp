@@ -0,0 +1,90 @@
+#pragma once
+#include "utils.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief a box as the client last saw it
+struct DeltaBox {
+  int id;
+  utils::Obj obj;
+};
+
+/**
+ * @brief keeps the box list the client has and works out what changed
+ *
+ * A keyframe carries every box; in between only boxes that appeared, disappeared or moved beyond the IoU tolerance
+ * are reported, and frames without such changes produce nothing.
+ */
+class BoxDelta {
+public:
+  /**
+   * @brief change the settings, the next update is a keyframe
+   *
+   * @param keyframeMsec interval between keyframes
+   * @param iouThresh a matched box whose IoU with the client's copy drops below this is reported as moved
+   */
+  void configure(int keyframeMsec, float iouThresh);
+
+  /// @brief force a keyframe on the next update
+  void reset() { this->isKeyframePending = true; }
+
+  /**
+   * @brief compare a new frame with the client's state
+   *
+   * @param objs detected objects of the frame
+   * @param nowMs monotonic time in milliseconds
+   * @return false if there is nothing to send
+   */
+  bool update(const std::vector<utils::Obj> &objs, int64_t nowMs);
+
+  bool isKeyframe() const { return this->keyframe; }
+
+  /// @brief the client's state after the update
+  const std::vector<DeltaBox> &getBoxes() const { return this->boxes; }
+
+  /// @brief indices into getBoxes() of the boxes added by the update
+  const std::vector<int> &getAdded() const { return this->added; }
+
+  /// @brief indices into getBoxes() of the boxes moved by the update
+  const std::vector<int> &getMoved() const { return this->moved; }
+
+  /// @brief ids removed by the update
+  const std::vector<int> &getRemoved() const { return this->removed; }
+
+private:
+  /// @brief a candidate pairing of a client box and a new box
+  struct Match {
+    float iou;
+    int previous;
+    int current;
+  };
+
+  int keyframeMsec = 1000;
+  float iouThresh = 0.9f;
+  bool isKeyframePending = true;
+  int64_t lastKeyframeMs = 0;
+  int nextId = 1;
+
+  bool keyframe = false;
+  std::vector<DeltaBox> boxes;
+
+  //// scratch, reused across frames
+  std::vector<DeltaBox> nextBoxes;
+  std::vector<Match> matches;
+  std::vector<int> previousMatch;
+  std::vector<int> currentMatch;
+  std::vector<int> added;
+  std::vector<int> moved;
+  std::vector<int> removed;
+};
+
+/// @brief intersection over union of two boxes
+float boxIou(const utils::Obj &a, const utils::Obj &b);
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
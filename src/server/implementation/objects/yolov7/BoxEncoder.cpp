@@ -0,0 +1,326 @@
+#include "BoxEncoder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+static const uint8_t binaryVersion = 1;
+static const size_t binaryHeaderSize = 8;
+static const size_t binaryRecordSize = 12;
+static const size_t binaryTrackedRecordSize = 14;
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline void putU16(uint8_t *dst, uint16_t value) {
+  dst[0] = static_cast<uint8_t>(value);
+  dst[1] = static_cast<uint8_t>(value >> 8);
+}
+
+/// @brief the tracker gives either every object of a frame an id or none
+static inline bool hasTrackIds(const std::vector<utils::Obj> &objs) { return objs.empty() == false && objs[0].trackId >= 0; }
+
+BoxEncoder::BoxEncoder() {
+  this->buffer.reserve(4096);
+  this->raw.reserve(binaryHeaderSize + 100 * binaryTrackedRecordSize);
+}
+
+bool BoxEncoder::parseFormat(const std::string &name, BoxFormat &format) {
+  if (name == "json") {
+    format = BoxFormat::JSON;
+  } else if (name == "binary") {
+    format = BoxFormat::BINARY;
+  } else if (name == "columnar") {
+    format = BoxFormat::COLUMNAR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+uint16_t BoxEncoder::floatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = (bits >> 16) & 0x8000;
+  uint32_t rawExponent = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (rawExponent == 0xff) {
+    return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0)); // inf or nan
+  }
+  int exponent = static_cast<int>(rawExponent) - 127 + 15;
+  if (exponent >= 31) {
+    return static_cast<uint16_t>(sign | 0x7c00);
+  }
+  if (exponent <= 0) {
+    //// subnormal half, or zero
+    if (exponent < -10) {
+      return static_cast<uint16_t>(sign);
+    }
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return static_cast<uint16_t>(sign | half);
+  }
+  uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  // a carry out of the mantissa correctly bumps the exponent
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return static_cast<uint16_t>(sign | half);
+}
+
+void BoxEncoder::setFormat(BoxFormat format) {
+  this->format = format;
+  this->isNamesSent = false;
+}
+
+const std::string &BoxEncoder::encode(const std::vector<utils::Obj> &objs, const cv::Size &size) {
+  this->buffer.clear();
+  if (this->format == BoxFormat::BINARY) {
+    this->encodeBinary(objs, size);
+  } else {
+    this->encodeColumnar(objs, size);
+  }
+  return this->buffer;
+}
+
+std::string BoxEncoder::encodeJSON(const std::vector<utils::Obj> &objs, const cv::Size &size) {
+  Json::Value boxes(Json::arrayValue);
+  for (const utils::Obj &obj : objs) {
+    Json::Value box;
+    box["x1"] = obj.p1.x;
+    box["y1"] = obj.p1.y;
+    box["x2"] = obj.p2.x;
+    box["y2"] = obj.p2.y;
+    box["x1r"] = obj.p1.x / static_cast<float>(size.width);
+    box["y1r"] = obj.p1.y / static_cast<float>(size.height);
+    box["x2r"] = obj.p2.x / static_cast<float>(size.width);
+    box["y2r"] = obj.p2.y / static_cast<float>(size.height);
+    box["name"] = obj.name;
+    box["confi"] = obj.confi;
+    if (obj.trackId >= 0) {
+      box["id"] = obj.trackId;
+    }
+    boxes.append(box);
+  }
+  return utils::jsonToString(boxes);
+}
+
+const std::string &BoxEncoder::encodeDelta(const BoxDelta &delta, const cv::Size &size) {
+  this->buffer.clear();
+  this->buffer += delta.isKeyframe() ? "{\"type\":\"key\",\"w\":" : "{\"type\":\"delta\",\"w\":";
+  this->appendInt(size.width);
+  this->buffer += ",\"h\":";
+  this->appendInt(size.height);
+
+  const std::vector<DeltaBox> &boxes = delta.getBoxes();
+  if (delta.isKeyframe()) {
+    this->buffer += ",\"boxes\":[";
+    for (size_t i = 0; i < boxes.size(); i++) {
+      if (i > 0) {
+        this->buffer += ',';
+      }
+      this->appendDeltaBox(boxes[i]);
+    }
+    this->buffer += "]}";
+    return this->buffer;
+  }
+
+  this->appendDeltaBoxes("added", boxes, delta.getAdded());
+  this->appendDeltaBoxes("moved", boxes, delta.getMoved());
+  this->buffer += ",\"removed\":[";
+  const std::vector<int> &removed = delta.getRemoved();
+  for (size_t i = 0; i < removed.size(); i++) {
+    if (i > 0) {
+      this->buffer += ',';
+    }
+    this->appendInt(removed[i]);
+  }
+  this->buffer += "]}";
+  return this->buffer;
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void BoxEncoder::encodeBinary(const std::vector<utils::Obj> &objs, const cv::Size &size) {
+  size_t count = std::min(objs.size(), static_cast<size_t>(UINT16_MAX));
+  bool isTracked = hasTrackIds(objs);
+  size_t recordSize = isTracked ? binaryTrackedRecordSize : binaryRecordSize;
+  this->raw.resize(binaryHeaderSize + count * recordSize);
+  uint8_t *dst = this->raw.data();
+  dst[0] = binaryVersion;
+  dst[1] = static_cast<uint8_t>(recordSize);
+  putU16(dst + 2, static_cast<uint16_t>(count));
+  putU16(dst + 4, static_cast<uint16_t>(std::min(size.width, static_cast<int>(UINT16_MAX))));
+  putU16(dst + 6, static_cast<uint16_t>(std::min(size.height, static_cast<int>(UINT16_MAX))));
+  dst += binaryHeaderSize;
+
+  float width = static_cast<float>(std::max(size.width, 1));
+  float height = static_cast<float>(std::max(size.height, 1));
+  for (size_t i = 0; i < count; i++) {
+    const utils::Obj &obj = objs[i];
+    dst[0] = static_cast<uint8_t>(obj.classIdx);
+    dst[1] = 0;
+    putU16(dst + 2, floatToHalf(obj.p1.x / width));
+    putU16(dst + 4, floatToHalf(obj.p1.y / height));
+    putU16(dst + 6, floatToHalf(obj.p2.x / width));
+    putU16(dst + 8, floatToHalf(obj.p2.y / height));
+    putU16(dst + 10, floatToHalf(obj.confi));
+    if (isTracked) {
+      putU16(dst + 12, static_cast<uint16_t>(std::max(obj.trackId, 0)));
+    }
+    dst += recordSize;
+  }
+  this->appendBase64(this->raw.data(), this->raw.size());
+}
+
+template <typename Getter> void BoxEncoder::appendIntColumn(const char *key, const std::vector<utils::Obj> &objs, Getter get) {
+  this->buffer += ",\"";
+  this->buffer += key;
+  this->buffer += "\":[";
+  for (size_t i = 0; i < objs.size(); i++) {
+    if (i > 0) {
+      this->buffer += ',';
+    }
+    this->appendInt(get(objs[i]));
+  }
+  this->buffer += ']';
+}
+
+void BoxEncoder::encodeColumnar(const std::vector<utils::Obj> &objs, const cv::Size &size) {
+  this->buffer += "{\"w\":";
+  this->appendInt(size.width);
+  this->buffer += ",\"h\":";
+  this->appendInt(size.height);
+
+  if (this->isNamesSent == false) {
+    this->buffer += ",\"names\":[";
+    for (size_t i = 0; i < utils::COCO_CLASSNAMES.size(); i++) {
+      if (i > 0) {
+        this->buffer += ',';
+      }
+      this->appendQuoted(utils::COCO_CLASSNAMES[i].c_str());
+    }
+    this->buffer += ']';
+    this->isNamesSent = true;
+  }
+
+  this->appendIntColumn("cls", objs, [](const utils::Obj &obj) { return obj.classIdx; });
+  this->appendIntColumn("x1", objs, [](const utils::Obj &obj) { return obj.p1.x; });
+  this->appendIntColumn("y1", objs, [](const utils::Obj &obj) { return obj.p1.y; });
+  this->appendIntColumn("x2", objs, [](const utils::Obj &obj) { return obj.p2.x; });
+  this->appendIntColumn("y2", objs, [](const utils::Obj &obj) { return obj.p2.y; });
+  if (hasTrackIds(objs)) {
+    this->appendIntColumn("id", objs, [](const utils::Obj &obj) { return obj.trackId; });
+  }
+
+  this->buffer += ",\"confi\":[";
+  for (size_t i = 0; i < objs.size(); i++) {
+    if (i > 0) {
+      this->buffer += ',';
+    }
+    this->appendFixed3(objs[i].confi);
+  }
+  this->buffer += "]}";
+}
+
+void BoxEncoder::appendDeltaBox(const DeltaBox &box) {
+  this->buffer += "{\"id\":";
+  this->appendInt(box.id);
+  this->buffer += ",\"x1\":";
+  this->appendInt(box.obj.p1.x);
+  this->buffer += ",\"y1\":";
+  this->appendInt(box.obj.p1.y);
+  this->buffer += ",\"x2\":";
+  this->appendInt(box.obj.p2.x);
+  this->buffer += ",\"y2\":";
+  this->appendInt(box.obj.p2.y);
+  this->buffer += ",\"name\":";
+  this->appendQuoted(box.obj.name);
+  this->buffer += ",\"confi\":";
+  this->appendFixed3(box.obj.confi);
+  if (box.obj.trackId >= 0) {
+    this->buffer += ",\"track\":";
+    this->appendInt(box.obj.trackId);
+  }
+  this->buffer += '}';
+}
+
+void BoxEncoder::appendDeltaBoxes(const char *key, const std::vector<DeltaBox> &boxes, const std::vector<int> &indices) {
+  this->buffer += ",\"";
+  this->buffer += key;
+  this->buffer += "\":[";
+  for (size_t i = 0; i < indices.size(); i++) {
+    if (i > 0) {
+      this->buffer += ',';
+    }
+    this->appendDeltaBox(boxes[indices[i]]);
+  }
+  this->buffer += ']';
+}
+
+void BoxEncoder::appendInt(int value) {
+  char digits[12];
+  int length = 0;
+  unsigned int magnitude = value < 0 ? 0u - static_cast<unsigned int>(value) : static_cast<unsigned int>(value);
+  do {
+    digits[length++] = static_cast<char>('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) {
+    this->buffer += '-';
+  }
+  while (length > 0) {
+    this->buffer += digits[--length];
+  }
+}
+
+void BoxEncoder::appendFixed3(float value) {
+  int scaled = static_cast<int>(std::lround(std::max(value, 0.f) * 1000));
+  this->appendInt(scaled / 1000);
+  this->buffer += '.';
+  int fraction = scaled % 1000;
+  this->buffer += static_cast<char>('0' + fraction / 100);
+  this->buffer += static_cast<char>('0' + fraction / 10 % 10);
+  this->buffer += static_cast<char>('0' + fraction % 10);
+}
+
+void BoxEncoder::appendQuoted(const char *value) {
+  this->buffer += '"';
+  this->buffer += value;
+  this->buffer += '"';
+}
+
+void BoxEncoder::appendBase64(const uint8_t *data, size_t size) {
+  size_t i = 0;
+  for (; i + 2 < size; i += 3) {
+    uint32_t triple = (static_cast<uint32_t>(data[i]) << 16) | (static_cast<uint32_t>(data[i + 1]) << 8) | data[i + 2];
+    this->buffer += base64Chars[(triple >> 18) & 0x3f];
+    this->buffer += base64Chars[(triple >> 12) & 0x3f];
+    this->buffer += base64Chars[(triple >> 6) & 0x3f];
+    this->buffer += base64Chars[triple & 0x3f];
+  }
+  if (i < size) {
+    uint32_t triple = static_cast<uint32_t>(data[i]) << 16;
+    if (i + 1 < size) {
+      triple |= static_cast<uint32_t>(data[i + 1]) << 8;
+    }
+    this->buffer += base64Chars[(triple >> 18) & 0x3f];
+    this->buffer += base64Chars[(triple >> 12) & 0x3f];
+    this->buffer += i + 1 < size ? base64Chars[(triple >> 6) & 0x3f] : '=';
+    this->buffer += '=';
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,114 @@
+#pragma once
+#include "BoxDelta.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief boxDetected payload formats
+enum class BoxFormat {
+  /// @brief array of objects with absolute and ratio coordinates (the original format)
+  JSON,
+
+  /**
+   * @brief base64 of fixed-layout little-endian records
+   *
+   * 8-byte header: u8 version (1), u8 record size (12, or 14 with track ids), u16 count, u16 frame width, u16 frame height.
+   * 12-byte record: u8 class index, u8 reserved, float16 x1r, y1r, x2r, y2r (ratio coordinates), float16 confidence,
+   * followed by a u16 track id when tracking.
+   */
+  BINARY,
+
+  /**
+   * @brief one JSON array per field, plus "id" when tracking
+   *
+   * The class names come once with the first payload of a session or format switch.
+   */
+  COLUMNAR
+};
+
+/// @brief encodes boxes into a reused buffer without per-frame allocations once the buffer has grown
+class BoxEncoder {
+public:
+  BoxEncoder();
+
+  /// @brief parse "json", "binary" or "columnar", returns false for anything else
+  static bool parseFormat(const std::string &name, BoxFormat &format);
+
+  /// @brief IEEE 754 half precision, rounded to nearest even
+  static uint16_t floatToHalf(float value);
+
+  void setFormat(BoxFormat format);
+  BoxFormat getFormat() const { return this->format; }
+
+  /// @brief send the class names again with the next columnar payload
+  void resetNames() { this->isNamesSent = false; }
+
+  /**
+   * @brief encode boxes in the binary or columnar format
+   *
+   * @param objs detected objects
+   * @param size frame size
+   * @return the payload, valid until the next call
+   */
+  const std::string &encode(const std::vector<utils::Obj> &objs, const cv::Size &size);
+
+  /**
+   * @brief encode boxes in the original JSON format, an array of {"x1","y1","x2","y2","x1r","y1r","x2r","y2r","name","confi"}
+   * plus "id" when tracking
+   *
+   * @param objs detected objects
+   * @param size frame size
+   */
+  static std::string encodeJSON(const std::vector<utils::Obj> &objs, const cv::Size &size);
+
+  /**
+   * @brief encode the result of a delta update as JSON
+   *
+   * A keyframe is {"type":"key","w","h","boxes":[box...]}, otherwise {"type":"delta","w","h","added":[box...],
+   * "moved":[box...],"removed":[id...]}, where a box is {"id","x1","y1","x2","y2","name","confi"} plus "track" when
+   * tracking.
+   *
+   * @param delta the updated delta state
+   * @param size frame size
+   * @return the payload, valid until the next call
+   */
+  const std::string &encodeDelta(const BoxDelta &delta, const cv::Size &size);
+
+private:
+  BoxFormat format = BoxFormat::JSON;
+  bool isNamesSent = false;
+  std::string buffer;
+  std::vector<uint8_t> raw;
+
+  void encodeBinary(const std::vector<utils::Obj> &objs, const cv::Size &size);
+  void encodeColumnar(const std::vector<utils::Obj> &objs, const cv::Size &size);
+
+  void appendInt(int value);
+
+  /// @brief append one box of a delta payload
+  void appendDeltaBox(const DeltaBox &box);
+
+  /// @brief append a named array of the boxes at the given indices
+  void appendDeltaBoxes(const char *key, const std::vector<DeltaBox> &boxes, const std::vector<int> &indices);
+
+  /// @brief append a non-negative number with 3 decimals
+  void appendFixed3(float value);
+
+  /// @brief append a JSON string, the class names need no escaping
+  void appendQuoted(const char *value);
+
+  void appendBase64(const uint8_t *data, size_t size);
+
+  /// @brief append a named integer column, e.g. "x1":[1,2]
+  template <typename Getter> void appendIntColumn(const char *key, const std::vector<utils::Obj> &objs, Getter get);
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,67 @@
+#pragma once
+#include "Metrics.hpp"
+#include "utils.hpp"
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/// @brief an object detector instance handed out by the model pool
+class Detector {
+public:
+  virtual ~Detector() = default;
+
+  /**
+   * @brief detect objects in one image
+   *
+   * @param rgbImg RGB or RGBA image
+   * @param output detected objects
+   */
+  virtual void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) = 0;
+
+  /// @brief square input sizes in pixels the instance can run at, largest (the default) first, empty if not selectable
+  virtual std::vector<int> getInputSizes() const { return {}; }
+
+  /// @brief square input size in pixels of the next inference, 0 if not selectable
+  virtual int getInputSize() const { return 0; }
+
+  /**
+   * @brief run the next inferences at another input size, boxes are still mapped back to the original image
+   *
+   * @param wh one of getInputSizes(), 0 for the default
+   * @return false if the size is not supported, the current one is kept
+   */
+  virtual bool setInputSize(int wh) { return wh == 0; }
+
+  /**
+   * @brief filter the results of the next inferences in the postprocess, instead of copying them around afterwards
+   *
+   * @param minConfidence objects below this confidence are dropped
+   * @param maxCount at most this many objects of the highest confidence are kept, in descending confidence
+   */
+  virtual void setOutputLimits(float minConfidence, int maxCount) {}
+
+  /**
+   * @brief record the backend stages (preprocess, copies, engine run, postprocess) of the next inferences
+   *
+   * @param metrics the model's metrics, nullptr to stop recording
+   */
+  virtual void setMetrics(kurento::module::objdet::StageMetrics *metrics) {}
+
+  /// @brief the device the instance runs on, to be made current by threads driving it, -1 if not on a device
+  virtual int getDeviceId() const { return -1; }
+
+  /// @brief maximum number of images accepted by inferBatch in one call
+  virtual int getMaxBatchSize() const { return 1; }
+
+  /**
+   * @brief detect objects in several images with as few engine runs as possible
+   *
+   * @param rgbImgs RGB or RGBA images, at most getMaxBatchSize()
+   * @param outputs detected objects per image, resized to the number of images
+   */
+  virtual void inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) {
+    outputs.resize(rgbImgs.size());
+    for (size_t i = 0; i < rgbImgs.size(); i++) {
+      this->infer(*rgbImgs[i], outputs[i]);
+    }
+  }
+};
@@ -0,0 +1,154 @@
+#include "DetectorFactory.hpp"
+#include "yolov7cv.hpp"
+#ifdef OBJDET_WITH_TENSORRT
+#include "yolov7.hpp"
+#endif
+#include <algorithm>
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+GST_DEBUG_CATEGORY_STATIC(obj_det_detector_factory);
+#define GST_CAT_DEFAULT obj_det_detector_factory
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+namespace {
+
+/// @brief the "input_sizes" of a model entry, sizes that are not a positive multiple of the model stride are skipped
+std::vector<int> parseInputSizes(const Json::Value &modelParam) {
+  std::vector<int> sizes;
+  for (const Json::Value &size : modelParam["input_sizes"]) {
+    int wh = size.asInt();
+    if (wh <= 0 || wh % 32 != 0) {
+      GST_WARNING("input size %d of %s is not a positive multiple of 32, skipped", wh, modelParam["name"].asString().c_str());
+      continue;
+    }
+    sizes.push_back(wh);
+  }
+  return sizes;
+}
+
+#ifdef OBJDET_WITH_TENSORRT
+/// @brief one deserialized TensorRT engine per device, every instance is an execution context on the engine of its device
+class TrtDetectorFactory : public DetectorFactory {
+public:
+  explicit TrtDetectorFactory(const Json::Value &modelParam)
+      : name(modelParam["name"].asString()), modelPath(modelParam["model_abs_path"].asString()),
+        inputSizes(parseInputSizes(modelParam)), tileBatch(std::max(modelParam.get("tile_batch", 1).asInt(), 1)),
+        warmup(std::max(modelParam.get("warmup", 10).asInt(), 0)) {}
+
+  bool usesDevice() const override { return true; }
+
+  Detector *createDetector(int index, int deviceId) override {
+    bool isNew = false;
+    std::shared_ptr<TrtEngine> engine = this->engineFor(deviceId, isNew);
+    // the first context of a device warms its engine up, later ones only need their lazy allocations done
+    return new Yolov7trt(engine, std::to_string(index), this->tileBatch, isNew ? this->warmup : std::min(this->warmup, 1));
+  }
+
+  Detector *createBatchEngine(int maxBatch, int deviceId) override {
+    bool isNew = false;
+    Yolov7trt *context = new Yolov7trt(this->engineFor(deviceId, isNew), this->name + "-batch-" + std::to_string(deviceId), maxBatch,
+                                       this->warmup);
+    if (context->getMaxBatchSize() <= 1) {
+      GST_WARNING("%s engine does not support batch > 1 (rebuild it with a dynamic batch profile)", this->name.c_str());
+      delete context;
+      return nullptr;
+    }
+    return context;
+  }
+
+  void unload() override { this->engines.clear(); }
+
+private:
+  std::string name;
+  std::string modelPath;
+  std::vector<int> inputSizes;
+
+  /// @brief batch capacity of a session's own context, so that its tiles or regions share an engine run
+  int tileBatch;
+
+  /// @brief warmup inferences of the first context of a device
+  int warmup;
+
+  std::map<int, std::shared_ptr<TrtEngine>> engines;
+
+  /// @brief the engine of a device, deserialized on first use
+  std::shared_ptr<TrtEngine> engineFor(int deviceId, bool &isNew) {
+    auto found = this->engines.find(deviceId);
+    isNew = found == this->engines.end();
+    if (isNew) {
+      GST_INFO("load %s engine on device %d", this->name.c_str(), deviceId);
+      found = this->engines.emplace(deviceId, std::make_shared<TrtEngine>(this->modelPath, deviceId, this->inputSizes)).first;
+    }
+    return found->second;
+  }
+};
+#endif
+
+/// @brief CPU instances with the OpenCV DNN module, each with its own network since a network is not reentrant
+class OpenCVDetectorFactory : public DetectorFactory {
+public:
+  explicit OpenCVDetectorFactory(const Json::Value &modelParam)
+      : name(modelParam["name"].asString()), modelPath(modelParam["model_abs_path"].asString()),
+        inputSizes(parseInputSizes(modelParam)), warmup(std::max(modelParam.get("warmup", 1).asInt(), 1)) {}
+
+  bool usesDevice() const override { return false; }
+
+  Detector *createDetector(int index, int deviceId) override {
+    return new Yolov7cv(this->modelPath, this->name + "-" + std::to_string(index), this->warmup, this->inputSizes);
+  }
+
+private:
+  std::string name;
+  std::string modelPath;
+  std::vector<int> inputSizes;
+
+  /// @brief warmup inferences per input size, at least one since it validates the export
+  int warmup;
+};
+
+std::mutex registryLock;
+
+std::map<std::string, DetectorFactory::Creator> &registry() {
+  static std::map<std::string, DetectorFactory::Creator> backends = {
+#ifdef OBJDET_WITH_TENSORRT
+      {"tensorrt", [](const Json::Value &modelParam) { return std::make_unique<TrtDetectorFactory>(modelParam); }},
+#endif
+      {"opencv-cpu", [](const Json::Value &modelParam) { return std::make_unique<OpenCVDetectorFactory>(modelParam); }},
+  };
+  return backends;
+}
+
+} // namespace
+
+void DetectorFactory::registerBackend(const std::string &name, Creator creator) {
+  std::lock_guard<std::mutex> lockNow(registryLock);
+  registry()[name] = std::move(creator);
+}
+
+std::unique_ptr<DetectorFactory> DetectorFactory::forModel(const Json::Value &modelParam) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_detector_factory, "ObjDetDetectorFactory", GST_DEBUG_BG_YELLOW, "ObjDetDetectorFactory");
+  std::string backend = modelParam.get("backend", "tensorrt").asString();
+  Creator creator;
+  {
+    std::lock_guard<std::mutex> lockNow(registryLock);
+    auto found = registry().find(backend);
+    if (found == registry().end()) {
+      GST_ERROR("backend %s is not available in this build", backend.c_str());
+      throw std::runtime_error("backend not available: " + backend);
+    }
+    creator = found->second;
+  }
+  GST_INFO("create %s backend for model %s", backend.c_str(), modelParam["name"].asString().c_str());
+  return creator(modelParam);
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
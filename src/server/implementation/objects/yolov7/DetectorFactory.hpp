@@ -0,0 +1,46 @@
+#pragma once
+#include "Detector.hpp"
+#include <functional>
+#include <json/json.h>
+#include <memory>
+#include <string>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief creates the instances of one configured model on an inference backend
+class DetectorFactory {
+public:
+  /// @brief builds the factory of a model entry, throws if the model entry is invalid
+  using Creator = std::function<std::unique_ptr<DetectorFactory>(const Json::Value &modelParam)>;
+
+  virtual ~DetectorFactory() = default;
+
+  /// @brief whether instances live on the GPU, the pool then checks free VRAM before creating them
+  virtual bool usesDevice() const = 0;
+
+  /**
+   * @brief create an instance serving one session at a time
+   *
+   * @param index instance number within the model, 0 for the first one
+   * @param deviceId the device to create it on, ignored by backends not using devices
+   */
+  virtual Detector *createDetector(int index, int deviceId) = 0;
+
+  /// @brief create the instance shared by the batched sessions of a device, nullptr if the backend or the model cannot batch
+  virtual Detector *createBatchEngine(int maxBatch, int deviceId) { return nullptr; }
+
+  /// @brief drop what the instances shared (e.g. the loaded engines), called once all instances are deleted
+  virtual void unload() {}
+
+  /// @brief register a backend under the name used by the "backend" config key, replacing any previous one
+  static void registerBackend(const std::string &name, Creator creator);
+
+  /// @brief create the factory of the backend named by the "backend" key of a model entry (default "tensorrt")
+  static std::unique_ptr<DetectorFactory> forModel(const Json::Value &modelParam);
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
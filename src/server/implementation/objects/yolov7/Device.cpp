@@ -0,0 +1,63 @@
+#include "Device.hpp"
+#ifdef OBJDET_WITH_TENSORRT
+#include <cuda_runtime_api.h>
+#endif
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+namespace {
+
+#ifdef OBJDET_WITH_TENSORRT
+class CudaDeviceInventory : public DeviceInventory {
+public:
+  int getDeviceCount() override {
+    int count = 0;
+    if (cudaGetDeviceCount(&count) != cudaSuccess) {
+      return 0;
+    }
+    return count;
+  }
+
+  bool selectDevice(int deviceId) override { return cudaSetDevice(deviceId) == cudaSuccess; }
+
+  bool getMemInfo(int deviceId, size_t &freeBytes, size_t &totalBytes) override {
+    // called on the streaming thread by memory-aware placement, whose current device must not change
+    int current = 0;
+    if (cudaGetDevice(&current) != cudaSuccess) {
+      return false;
+    }
+    if (this->selectDevice(deviceId) == false) {
+      return false;
+    }
+    bool isOk = cudaMemGetInfo(&freeBytes, &totalBytes) == cudaSuccess;
+    cudaSetDevice(current);
+    return isOk;
+  }
+};
+using SystemDeviceInventory = CudaDeviceInventory;
+#else
+class NoDeviceInventory : public DeviceInventory {
+public:
+  int getDeviceCount() override { return 0; }
+  bool selectDevice(int) override { return false; }
+  bool getMemInfo(int, size_t &freeBytes, size_t &totalBytes) override {
+    freeBytes = 0;
+    totalBytes = 0;
+    return false;
+  }
+};
+using SystemDeviceInventory = NoDeviceInventory;
+#endif
+
+} // namespace
+
+DeviceInventory &DeviceInventory::system() {
+  static SystemDeviceInventory inventory;
+  return inventory;
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
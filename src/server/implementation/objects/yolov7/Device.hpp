@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief the accelerators visible to the module, abstracted so the pool does not depend on CUDA directly
+class DeviceInventory {
+public:
+  virtual ~DeviceInventory() = default;
+
+  /// @brief number of usable devices, 0 on CPU-only hosts
+  virtual int getDeviceCount() = 0;
+
+  /// @brief make a device current for the calling thread
+  virtual bool selectDevice(int deviceId) = 0;
+
+  /// @brief free and total memory of a device
+  virtual bool getMemInfo(int deviceId, size_t &freeBytes, size_t &totalBytes) = 0;
+
+  /// @brief the CUDA devices when built with TensorRT, otherwise an empty inventory
+  static DeviceInventory &system();
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
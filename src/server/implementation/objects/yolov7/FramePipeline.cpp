@@ -0,0 +1,169 @@
+#include "FramePipeline.hpp"
+#include <gst/gst.h>
+
+GST_DEBUG_CATEGORY_STATIC(obj_det_frame_pipeline);
+#define GST_CAT_DEFAULT obj_det_frame_pipeline
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+static inline int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FramePipeline::FramePipeline() {
+  GST_DEBUG_CATEGORY_INIT(obj_det_frame_pipeline, "ObjDetFramePipeline", GST_DEBUG_BG_CYAN, "ObjDetFramePipeline");
+}
+
+void FramePipeline::recordStage(Stage stage, const std::chrono::steady_clock::time_point &start) {
+  this->recordStage(stage, elapsedUs(start));
+}
+
+void FramePipeline::recordStage(Stage stage, uint64_t micros) {
+  this->sessionMetrics->record(stage, micros);
+  StageMetrics *modelMetrics = this->modelMetrics.load(std::memory_order_relaxed);
+  if (modelMetrics != nullptr) {
+    modelMetrics->record(stage, micros);
+  }
+}
+
+void FramePipeline::countEvent(Counter counter) {
+  this->sessionMetrics->count(counter);
+  StageMetrics *modelMetrics = this->modelMetrics.load(std::memory_order_relaxed);
+  if (modelMetrics != nullptr) {
+    modelMetrics->count(counter);
+  }
+}
+
+void FramePipeline::setFormat(BoxFormat format) {
+  std::lock_guard<std::mutex> lockNow(this->encoderLock);
+  this->boxEncoder.setFormat(format);
+}
+
+void FramePipeline::setDeltaMode(bool isDelta, int keyframeMsec, float iouThresh) {
+  std::lock_guard<std::mutex> lockNow(this->encoderLock);
+  this->isDeltaMode = isDelta;
+  if (isDelta) {
+    this->boxDelta.configure(keyframeMsec, iouThresh);
+  }
+}
+
+void FramePipeline::setTracking(bool isTracking, int maxAgeMsec) {
+  std::lock_guard<std::mutex> lockNow(this->trackerLock);
+  this->isTracking = isTracking;
+  this->tracker.configure(maxAgeMsec, 0.3f);
+}
+
+void FramePipeline::setMotionGate(bool isGating, float threshold, int refreshMsec) {
+  std::lock_guard<std::mutex> lockNow(this->motionGateLock);
+  this->isGating = isGating;
+  this->motionGate.configure(threshold, refreshMsec);
+}
+
+void FramePipeline::reset() {
+  {
+    std::lock_guard<std::mutex> lockNow(this->trackerLock);
+    this->tracker.reset();
+  }
+  std::lock_guard<std::mutex> lockNow(this->motionGateLock);
+  this->motionGate.reset();
+}
+
+bool FramePipeline::getGateCounts(uint64_t &hits, uint64_t &misses) {
+  std::lock_guard<std::mutex> lockNow(this->motionGateLock);
+  hits = this->motionGate.getHitCount();
+  misses = this->motionGate.getMissCount();
+  return this->isGating;
+}
+
+bool FramePipeline::isStatic(const cv::Mat &mat) {
+  {
+    std::lock_guard<std::mutex> lockNow(this->motionGateLock);
+    if (this->isGating == false || this->motionGate.isStatic(mat, steadyNowMs()) == false) {
+      return false;
+    }
+  }
+  GST_LOG("skip inferring on a static frame");
+  this->countEvent(Counter::SKIPPED_MOTION);
+  return true;
+}
+
+void FramePipeline::infer(Detector &model, const cv::Mat &mat, float minConfidence, int maxCount, std::vector<utils::Obj> &objs,
+                          const WholeFrameRun &runWhole) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (this->tiling.isEnabled()) {
+    // the postprocess drops what this session does not want, pooled instances are set on every call
+    model.setOutputLimits(minConfidence, maxCount);
+    this->tiling.infer(model, mat, objs);
+    this->recordStage(Stage::TILE, this->tiling.getSplitUs());
+    this->recordStage(Stage::MERGE, this->tiling.getMergeUs());
+  } else if (runWhole != nullptr) {
+    runWhole(mat, objs);
+  } else {
+    model.setOutputLimits(minConfidence, maxCount);
+    model.infer(mat, objs);
+  }
+  this->recordStage(Stage::INFER, start);
+
+  // a no-op on a filtered result, the merged parts of a tiled frame and a shared result are cut back to the limits here
+  utils::selectTop(objs, minConfidence, maxCount);
+  GST_DEBUG("%d objs above confidence %f, max= %d", static_cast<int>(objs.size()), minConfidence, maxCount);
+}
+
+void FramePipeline::track(std::vector<utils::Obj> &objs) {
+  std::lock_guard<std::mutex> lockNow(this->trackerLock);
+  if (this->isTracking) {
+    this->tracker.update(objs, steadyNowMs());
+    GST_DEBUG("%d tracks", static_cast<int>(this->tracker.getTrackCount()));
+  }
+}
+
+bool FramePipeline::predict(const cv::Size &size, std::vector<utils::Obj> &objs) {
+  std::lock_guard<std::mutex> lockNow(this->trackerLock);
+  if (this->isTracking == false) {
+    return false;
+  }
+  this->tracker.predict(steadyNowMs(), size, objs);
+  return true;
+}
+
+void FramePipeline::draw(cv::Mat &mat, const std::vector<utils::Obj> &objs) {
+  if (objs.size() > 0) {
+    GST_DEBUG("draw objs");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    this->overlay.draw(mat, objs);
+    this->recordStage(Stage::DRAW, start);
+  }
+}
+
+void FramePipeline::encode(const std::vector<utils::Obj> &objs, const cv::Size &size, const Send &send) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lockNow(this->encoderLock);
+    if (this->isDeltaMode) {
+      // an empty frame matters here, it removes the boxes the client has
+      if (this->boxDelta.update(objs, steadyNowMs())) {
+        send(this->boxEncoder.encodeDelta(this->boxDelta, size));
+      } else {
+        GST_LOG("no box changes");
+      }
+      this->recordStage(Stage::ENCODE, start);
+      return;
+    }
+    if (objs.size() > 0 && this->boxEncoder.getFormat() != BoxFormat::JSON) {
+      send(this->boxEncoder.encode(objs, size));
+      this->recordStage(Stage::ENCODE, start);
+      return;
+    }
+  }
+  // the JSON format keeps no state, it is encoded and sent without the lock
+  if (objs.size() > 0) {
+    send(BoxEncoder::encodeJSON(objs, size));
+  }
+  this->recordStage(Stage::ENCODE, start);
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,131 @@
+#pragma once
+#include "BoxDelta.hpp"
+#include "BoxEncoder.hpp"
+#include "Detector.hpp"
+#include "Metrics.hpp"
+#include "MotionGate.hpp"
+#include "OverlayRenderer.hpp"
+#include "Tiling.hpp"
+#include "Tracker.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief the per-frame path of a session holding a model: motion gate, inference on the whole frame, its regions or its
+ * tiles, tracking, overlay and box encoding, each stage recorded in the metrics of the session and of its model
+ *
+ * The filter runs its frames through it on the streaming thread and on its async worker, objdet-bench in its simulated
+ * sessions. The gate, the tracker and the encoder have their own locks as their settings change on the control thread;
+ * the tiling is guarded by the caller along with the model, the overlay is used on one thread only. Confidence, box
+ * limit and drawing stay with the caller and are passed with each frame.
+ */
+class FramePipeline {
+public:
+  /// @brief runs the model on a whole frame instead of Detector::infer, e.g. to share the result with other sessions
+  using WholeFrameRun = std::function<void(const cv::Mat &mat, std::vector<utils::Obj> &objs)>;
+
+  /// @brief gets a boxDetected payload, called under the encoder lock so that delta payloads go out in order
+  using Send = std::function<void(const std::string &payload)>;
+
+  FramePipeline();
+
+  //// metrics
+  /// @brief the metrics of the session, set before the first frame
+  void setSessionMetrics(std::shared_ptr<StageMetrics> metrics) { this->sessionMetrics = std::move(metrics); }
+
+  StageMetrics &getSessionMetrics() { return *this->sessionMetrics; }
+
+  /// @brief the metrics of the model the session holds, owned by the pool, nullptr without a model
+  void setModelMetrics(StageMetrics *metrics) { this->modelMetrics.store(metrics, std::memory_order_relaxed); }
+
+  StageMetrics *getModelMetrics() const { return this->modelMetrics.load(std::memory_order_relaxed); }
+
+  void recordStage(Stage stage, const std::chrono::steady_clock::time_point &start);
+  void recordStage(Stage stage, uint64_t micros);
+  void countEvent(Counter counter);
+
+  //// settings
+  void setFormat(BoxFormat format);
+  void setDeltaMode(bool isDelta, int keyframeMsec, float iouThresh);
+  void setTracking(bool isTracking, int maxAgeMsec);
+  void setMotionGate(bool isGating, float threshold, int refreshMsec);
+
+  /// @brief regions or tiles inferred instead of the whole frame, guarded by the caller
+  Tiling &getTiling() { return this->tiling; }
+
+  /// @brief forget the tracks and let the next frame through the gate, the model changed
+  void reset();
+
+  /**
+   * @brief the motion gate's counts
+   *
+   * @return false if the gate is off
+   */
+  bool getGateCounts(uint64_t &hits, uint64_t &misses);
+
+  //// per frame
+  /// @brief true if the gate is on and the frame did not change enough to be inferred, counted as skipped
+  bool isStatic(const cv::Mat &mat);
+
+  /**
+   * @brief infer a frame and keep the objects within the limits
+   *
+   * @param minConfidence the session's confidence threshold
+   * @param maxCount the session's box limit
+   * @param runWhole replaces Detector::infer when the frame is inferred whole, the regions and tiles always run the model
+   */
+  void infer(Detector &model, const cv::Mat &mat, float minConfidence, int maxCount, std::vector<utils::Obj> &objs,
+             const WholeFrameRun &runWhole = nullptr);
+
+  /// @brief update the tracks with the objects of an inference, track ids are set on the objects
+  void track(std::vector<utils::Obj> &objs);
+
+  /**
+   * @brief the tracked objects extrapolated to now
+   *
+   * @return false if tracking is off
+   */
+  bool predict(const cv::Size &size, std::vector<utils::Obj> &objs);
+
+  void draw(cv::Mat &mat, const std::vector<utils::Obj> &objs);
+
+  /// @brief encode the objects of a frame in the session's format, nothing is sent without objects or box changes
+  void encode(const std::vector<utils::Obj> &objs, const cv::Size &size, const Send &send);
+
+private:
+  std::shared_ptr<StageMetrics> sessionMetrics = std::make_shared<StageMetrics>();
+  std::atomic<StageMetrics *> modelMetrics{nullptr};
+
+  Tiling tiling;
+  OverlayRenderer overlay;
+
+  //// payload encoding, guarded by encoderLock
+  BoxEncoder boxEncoder;
+  BoxDelta boxDelta;
+  bool isDeltaMode = false;
+  std::mutex encoderLock;
+
+  //// tracking, guarded by trackerLock
+  Tracker tracker;
+  bool isTracking = false;
+  std::mutex trackerLock;
+
+  //// motion gate, guarded by motionGateLock
+  MotionGate motionGate;
+  bool isGating = false;
+  std::mutex motionGateLock;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
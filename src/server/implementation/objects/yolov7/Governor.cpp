@@ -0,0 +1,141 @@
+#include "Governor.hpp"
+#include "Device.hpp"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief weight of a new sample in the latency and depth EWMAs
+static const double ewmaAlpha = 0.1;
+
+/// @brief fraction of every device handed out, the rest absorbs bursts
+static const double budgetHeadroom = 0.9;
+
+/// @brief the rates are recomputed at most this often from latency updates
+static const int64_t allocationIntervalMs = 500;
+
+/// @brief no session is throttled below this rate, so every one keeps updating its boxes
+static const float minFps = 0.2f;
+
+static inline int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::shared_ptr<GovernedSession> Governor::join() {
+  std::shared_ptr<GovernedSession> session = std::make_shared<GovernedSession>();
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  this->sessions.push_back(session);
+  return session;
+}
+
+void Governor::leave(const std::shared_ptr<GovernedSession> &session) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  this->sessions.erase(std::remove(this->sessions.begin(), this->sessions.end(), session), this->sessions.end());
+  this->allocate(steadyNowMs());
+}
+
+void Governor::setModel(const std::shared_ptr<GovernedSession> &session, const std::string &modelName) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  session->modelName = modelName;
+  this->allocate(steadyNowMs());
+}
+
+void Governor::setTarget(const std::shared_ptr<GovernedSession> &session, float targetFps, int priority) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  session->targetFps.store(std::max(targetFps, 0.f), std::memory_order_relaxed);
+  session->priority.store(std::max(priority, 1), std::memory_order_relaxed);
+  this->allocate(steadyNowMs());
+}
+
+Governor::ModelLoad *Governor::beginInfer(const std::shared_ptr<GovernedSession> &session) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  // entries are never erased, and unordered_map keeps their addresses on rehash
+  ModelLoad &load = this->models[session->modelName];
+  load.inFlight++;
+  load.depth += ewmaAlpha * (load.inFlight - load.depth);
+  return &load;
+}
+
+void Governor::endInfer(ModelLoad *load, double latencyMs) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  load->inFlight = std::max(load->inFlight - 1, 0);
+  load->latencyMs = load->latencyMs == 0 ? latencyMs : load->latencyMs + ewmaAlpha * (latencyMs - load->latencyMs);
+
+  int64_t nowMs = steadyNowMs();
+  if (nowMs - this->lastAllocationMs >= allocationIntervalMs) {
+    this->allocate(nowMs);
+  }
+}
+
+void Governor::cancelInfer(ModelLoad *load) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  load->inFlight = std::max(load->inFlight - 1, 0);
+}
+
+double Governor::getLatencyMs(const std::string &modelName) {
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  auto it = this->models.find(modelName);
+  return it == this->models.end() ? 0 : it->second.latencyMs;
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void Governor::allocate(int64_t nowMs) {
+  this->lastAllocationMs = nowMs;
+  if (this->budgetMsPerSec == 0) {
+    // queried on first use rather than at static initialization, before the devices are ready
+    this->budgetMsPerSec = 1000 * budgetHeadroom * std::max(DeviceInventory::system().getDeviceCount(), 1);
+  }
+
+  //// demand of every session in accelerator milliseconds per second, sessions without a measured model are free
+  struct Demand {
+    GovernedSession *session;
+    double cost;
+    double demand;
+    double weight;
+  };
+  std::vector<Demand> demands;
+  demands.reserve(this->sessions.size());
+  for (const std::shared_ptr<GovernedSession> &session : this->sessions) {
+    float targetFps = session->targetFps.load(std::memory_order_relaxed);
+    auto it = this->models.find(session->modelName);
+    if (session->modelName.empty() || it == this->models.end() || it->second.latencyMs == 0) {
+      session->effectiveFps.store(targetFps, std::memory_order_relaxed);
+      continue;
+    }
+    double cost = it->second.latencyMs / std::max(it->second.depth, 1.0);
+    double demand = targetFps > 0 ? targetFps * cost : std::numeric_limits<double>::infinity();
+    demands.push_back(Demand{session.get(), cost, demand, static_cast<double>(session->priority.load(std::memory_order_relaxed))});
+  }
+
+  //// water-filling, smallest demand per weight first
+  std::sort(demands.begin(), demands.end(),
+            [](const Demand &a, const Demand &b) { return a.demand / a.weight < b.demand / b.weight; });
+  double remaining = this->budgetMsPerSec;
+  double remainingWeight = 0;
+  for (const Demand &demand : demands) {
+    remainingWeight += demand.weight;
+  }
+  for (const Demand &demand : demands) {
+    double share = remaining * demand.weight / remainingWeight;
+    double granted = std::min(demand.demand, share);
+    remaining = std::max(remaining - granted, 0.0);
+    remainingWeight -= demand.weight;
+
+    float targetFps = demand.session->targetFps.load(std::memory_order_relaxed);
+    float fps = static_cast<float>(granted / demand.cost);
+    if (targetFps > 0 && fps >= targetFps) {
+      fps = targetFps;
+    }
+    demand.session->effectiveFps.store(std::max(fps, minFps), std::memory_order_relaxed);
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief the inference rate of one session as the governor sees it
+class GovernedSession {
+public:
+  /// @brief inferences per second granted by the governor, 0 if unlimited
+  float getEffectiveFps() const { return this->effectiveFps.load(std::memory_order_relaxed); }
+
+  /// @brief requested inferences per second, 0 if unlimited
+  float getTargetFps() const { return this->targetFps.load(std::memory_order_relaxed); }
+
+  int getPriority() const { return this->priority.load(std::memory_order_relaxed); }
+
+private:
+  friend class Governor;
+
+  //// written under the governor lock, read lock-free by the owning filter
+  std::atomic<float> targetFps{0};
+  std::atomic<int> priority{1};
+  std::atomic<float> effectiveFps{0};
+
+  /// @brief guarded by the governor lock, empty until a model is assigned
+  std::string modelName;
+};
+
+/**
+ * @brief shares the inference capacity of the host between sessions
+ *
+ * Every model keeps an EWMA of its inference latency and of the number of inferences in flight when one starts; their
+ * ratio estimates the accelerator time one inference really costs when calls overlap. The budget (accelerator
+ * milliseconds per second over all devices, with some headroom) is water-filled between the sessions by priority:
+ * sessions asking for less than their weighted share get what they ask for and the rest is split between the others.
+ * As the accelerators saturate the latencies grow, the costs with them, and every session is granted a lower rate
+ * instead of the streaming threads stalling on inference.
+ */
+class Governor {
+public:
+  /// @brief latency and concurrency of one model, kept as long as the governor so that an inference ends on the model it began on
+  struct ModelLoad {
+    double latencyMs = 0;
+    double depth = 1;
+    int inFlight = 0;
+  };
+
+  /// @brief a session with an unlimited rate and no model
+  std::shared_ptr<GovernedSession> join();
+
+  /// @brief remove a session from the allocation
+  void leave(const std::shared_ptr<GovernedSession> &session);
+
+  /// @brief the model the session infers with, an empty name if none
+  void setModel(const std::shared_ptr<GovernedSession> &session, const std::string &modelName);
+
+  /**
+   * @brief request a rate
+   *
+   * @param targetFps inferences per second, 0 for as fast as granted
+   * @param priority weight of the session when the budget is short, at least 1
+   */
+  void setTarget(const std::shared_ptr<GovernedSession> &session, float targetFps, int priority);
+
+  /// @brief an inference of the session starts on its current model, whose load is returned for the end of the inference
+  ModelLoad *beginInfer(const std::shared_ptr<GovernedSession> &session);
+
+  /// @brief an inference begun on a model finished after latencyMs, even if the session changed models meanwhile
+  void endInfer(ModelLoad *load, double latencyMs);
+
+  /// @brief an inference begun on a model failed, it no longer counts as in flight and its latency is not recorded
+  void cancelInfer(ModelLoad *load);
+
+  /// @brief latency EWMA of a model in milliseconds, 0 before the first inference
+  double getLatencyMs(const std::string &modelName);
+
+private:
+  std::mutex lock;
+  std::vector<std::shared_ptr<GovernedSession>> sessions;
+  std::unordered_map<std::string, ModelLoad> models;
+  double budgetMsPerSec = 0;
+  int64_t lastAllocationMs = 0;
+
+  /// @brief recompute every effective rate, called with the lock held
+  void allocate(int64_t nowMs);
+};
+
+/// @brief one inference of a session, begun on construction and ended on destruction, cancelled if it throws
+class GovernedInfer {
+public:
+  GovernedInfer(Governor &governor, const std::shared_ptr<GovernedSession> &session)
+      : governor(governor), load(governor.beginInfer(session)), exceptions(std::uncaught_exceptions()),
+        start(std::chrono::steady_clock::now()) {}
+
+  ~GovernedInfer() {
+    if (std::uncaught_exceptions() > this->exceptions) {
+      this->governor.cancelInfer(this->load);
+      return;
+    }
+    this->governor.endInfer(this->load,
+                            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count());
+  }
+
+  GovernedInfer(const GovernedInfer &) = delete;
+  GovernedInfer &operator=(const GovernedInfer &) = delete;
+
+private:
+  Governor &governor;
+  Governor::ModelLoad *load;
+  int exceptions;
+  std::chrono::steady_clock::time_point start;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,209 @@
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+namespace {
+
+/// @brief the value at a quantile, the middle of the bucket it falls in
+double quantileOf(const uint64_t *buckets, uint64_t count, double quantile) {
+  uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(quantile * count)), 1);
+  uint64_t seen = 0;
+  for (int i = 0; i < Histogram::bucketCount; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return Histogram::bucketMiddle(i);
+    }
+  }
+  return 0;
+}
+
+/// @brief a Prometheus label value with backslash, quote and newline escaped
+std::string escapeLabel(const std::string &value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+/// @brief the samples of one model or session, labels is the inside of the braces without the stage
+void appendSamples(std::ostringstream &text, const std::string &labels, const StageMetrics &metrics) {
+  static const std::pair<const char *, double Histogram::Snapshot::*> quantiles[] = {
+      {"0.5", &Histogram::Snapshot::p50Us}, {"0.95", &Histogram::Snapshot::p95Us}, {"0.99", &Histogram::Snapshot::p99Us}};
+  for (int i = 0; i < static_cast<int>(Stage::COUNT); i++) {
+    Histogram::Snapshot snapshot;
+    metrics.get(static_cast<Stage>(i)).snapshot(snapshot);
+    if (snapshot.count == 0) {
+      continue;
+    }
+    std::string stageLabels = labels + ",stage=\"" + Metrics::stageName(static_cast<Stage>(i)) + "\"";
+    for (const auto &[quantile, field] : quantiles) {
+      text << "objdet_stage_seconds{" << stageLabels << ",quantile=\"" << quantile << "\"} " << snapshot.*field / 1e6 << "\n";
+    }
+    text << "objdet_stage_seconds_sum{" << stageLabels << "} " << snapshot.sumUs / 1e6 << "\n";
+    text << "objdet_stage_seconds_count{" << stageLabels << "} " << snapshot.count << "\n";
+  }
+  for (int i = 0; i < static_cast<int>(Counter::COUNT); i++) {
+    text << "objdet_events_total{" << labels << ",event=\"" << Metrics::counterName(static_cast<Counter>(i)) << "\"} "
+         << metrics.get(static_cast<Counter>(i)) << "\n";
+  }
+}
+
+} // namespace
+
+void Histogram::record(uint64_t micros) {
+  this->buckets[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+  this->sumUs.fetch_add(micros, std::memory_order_relaxed);
+  uint64_t max = this->maxUs.load(std::memory_order_relaxed);
+  while (micros > max && this->maxUs.compare_exchange_weak(max, micros, std::memory_order_relaxed) == false) {
+  }
+}
+
+void Histogram::snapshot(Snapshot &snapshot) const {
+  uint64_t counts[bucketCount];
+  snapshot.count = 0;
+  for (int i = 0; i < bucketCount; i++) {
+    counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+    snapshot.count += counts[i];
+  }
+  snapshot.sumUs = this->sumUs.load(std::memory_order_relaxed);
+  snapshot.maxUs = this->maxUs.load(std::memory_order_relaxed);
+  if (snapshot.count == 0) {
+    return;
+  }
+  snapshot.p50Us = quantileOf(counts, snapshot.count, 0.5);
+  snapshot.p95Us = quantileOf(counts, snapshot.count, 0.95);
+  snapshot.p99Us = quantileOf(counts, snapshot.count, 0.99);
+}
+
+int Histogram::bucketOf(uint64_t micros) {
+  if (micros < 8) {
+    return static_cast<int>(micros);
+  }
+  int exponent = 63 - __builtin_clzll(micros);
+  int bucket = (exponent - 2) * 8 + static_cast<int>((micros >> (exponent - 3)) & 7);
+  return std::min(bucket, bucketCount - 1);
+}
+
+double Histogram::bucketMiddle(int bucket) {
+  if (bucket < 8) {
+    return bucket;
+  }
+  int exponent = bucket / 8 + 2;
+  double width = static_cast<double>(uint64_t(1) << (exponent - 3));
+  return (8 + bucket % 8) * width + (width - 1) / 2;
+}
+
+Json::Value StageMetrics::toJSON() const {
+  Json::Value json;
+  json["stages"] = Json::Value(Json::objectValue);
+  for (int i = 0; i < static_cast<int>(Stage::COUNT); i++) {
+    Histogram::Snapshot snapshot;
+    this->stages[i].snapshot(snapshot);
+    if (snapshot.count == 0) {
+      continue;
+    }
+    Json::Value &stage = json["stages"][Metrics::stageName(static_cast<Stage>(i))];
+    stage["count"] = static_cast<Json::UInt64>(snapshot.count);
+    stage["avgMs"] = snapshot.sumUs / 1e3 / snapshot.count;
+    stage["p50Ms"] = snapshot.p50Us / 1e3;
+    stage["p95Ms"] = snapshot.p95Us / 1e3;
+    stage["p99Ms"] = snapshot.p99Us / 1e3;
+    stage["maxMs"] = snapshot.maxUs / 1e3;
+  }
+  for (int i = 0; i < static_cast<int>(Counter::COUNT); i++) {
+    json["counters"][Metrics::counterName(static_cast<Counter>(i))] = static_cast<Json::UInt64>(this->get(static_cast<Counter>(i)));
+  }
+  return json;
+}
+
+const char *Metrics::stageName(Stage stage) {
+  static const char *names[] = {"checkout", "queue", "tile", "preprocess", "h2d", "compute", "d2h",
+                                "postprocess", "merge", "infer", "draw", "encode", "frame"};
+  return names[static_cast<int>(stage)];
+}
+
+const char *Metrics::counterName(Counter counter) {
+  static const char *names[] = {"frames", "skipped_delay", "skipped_motion", "sessions_reaped", "sessions_queued",
+                                "shared_hits"};
+  return names[static_cast<int>(counter)];
+}
+
+StageMetrics *Metrics::forModel(const std::string &modelName) {
+  std::lock_guard<std::mutex> lockNow(this->registryLock);
+  std::unique_ptr<StageMetrics> &metrics = this->models[modelName];
+  if (metrics == nullptr) {
+    metrics = std::make_unique<StageMetrics>();
+  }
+  return metrics.get();
+}
+
+std::shared_ptr<StageMetrics> Metrics::addSession(const std::string &sessionId) {
+  std::shared_ptr<StageMetrics> metrics = std::make_shared<StageMetrics>();
+  std::lock_guard<std::mutex> lockNow(this->registryLock);
+  for (auto it = this->sessions.begin(); it != this->sessions.end();) {
+    it = it->second.expired() ? this->sessions.erase(it) : std::next(it);
+  }
+  this->sessions[sessionId] = metrics;
+  return metrics;
+}
+
+std::string Metrics::toPrometheus(bool withSessions) {
+  std::ostringstream text;
+  text << "# HELP objdet_stage_seconds latency of a stage of the detection path\n";
+  text << "# TYPE objdet_stage_seconds summary\n";
+  text << "# HELP objdet_events_total frames processed, frames not inferred, sessions that timed out, sessions that waited for a model "
+          "and frames inferred by another session of the same source\n";
+  text << "# TYPE objdet_events_total counter\n";
+  std::lock_guard<std::mutex> lockNow(this->registryLock);
+  for (const auto &[modelName, metrics] : this->models) {
+    appendSamples(text, "model=\"" + escapeLabel(modelName) + "\"", *metrics);
+  }
+  for (auto it = this->sessions.begin(); it != this->sessions.end();) {
+    std::shared_ptr<StageMetrics> metrics = it->second.lock();
+    if (metrics == nullptr) {
+      it = this->sessions.erase(it);
+      continue;
+    }
+    if (withSessions) {
+      appendSamples(text, "session=\"" + escapeLabel(it->first) + "\"", *metrics);
+    }
+    ++it;
+  }
+  return text.str();
+}
+
+bool Metrics::writePrometheus(const std::string &path, bool withSessions) {
+  std::string text = this->toPrometheus(withSessions);
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (file.good() == false) {
+      return false;
+    }
+    file << text;
+    if (file.good() == false) {
+      return false;
+    }
+  }
+  return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
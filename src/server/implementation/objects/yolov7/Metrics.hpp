@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <json/json.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief microseconds since a start time
+inline uint64_t elapsedUs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// @brief a timed step of the detection path
+enum class Stage {
+  /// @brief getModel of a session, including a load on demand
+  CHECKOUT,
+  /// @brief admission queue wait of a session that found every instance taken
+  QUEUE,
+  /// @brief planning the tiles or regions of a frame and cutting it into views
+  TILE,
+  PREPROCESS,
+  /// @brief host to device copy of the input, GPU time
+  H2D,
+  /// @brief engine run, GPU time (the whole forward pass on the CPU backend)
+  COMPUTE,
+  /// @brief device to host copy of the outputs, GPU time
+  D2H,
+  POSTPROCESS,
+  /// @brief shifting the boxes of the tiles or regions back to the frame and the NMS across them
+  MERGE,
+  /// @brief the model call of a session, the stages above and the wait for a shared engine
+  INFER,
+  DRAW,
+  /// @brief encoding and emitting boxDetected
+  ENCODE,
+  /// @brief process() on the streaming thread
+  FRAME,
+  COUNT
+};
+
+/// @brief an event counted by the metrics
+enum class Counter { FRAMES, SKIPPED_DELAY, SKIPPED_MOTION, SESSIONS_REAPED, SESSIONS_QUEUED, SHARED_HITS, COUNT };
+
+/**
+ * @brief lock-free latency histogram in microseconds, log-linear like an HDR histogram
+ *
+ * Values below 8 us have a bucket each, above every power of two is split in 8 buckets, so a percentile is within 6.25%
+ * of the recorded values. Recording is a few relaxed atomic adds; a snapshot taken meanwhile may be off by the records in
+ * flight.
+ */
+class Histogram {
+public:
+  /// @brief values up to 2^40 us, larger ones land in the last bucket
+  static const int bucketCount = 38 * 8;
+
+  struct Snapshot {
+    uint64_t count = 0;
+    uint64_t sumUs = 0;
+    uint64_t maxUs = 0;
+    double p50Us = 0;
+    double p95Us = 0;
+    double p99Us = 0;
+  };
+
+  void record(uint64_t micros);
+
+  void snapshot(Snapshot &snapshot) const;
+
+  /// @brief bucket of a value
+  static int bucketOf(uint64_t micros);
+
+  /// @brief middle of the values of a bucket
+  static double bucketMiddle(int bucket);
+
+private:
+  std::atomic<uint64_t> buckets[bucketCount] = {};
+  std::atomic<uint64_t> sumUs{0};
+  std::atomic<uint64_t> maxUs{0};
+};
+
+/// @brief one histogram per stage and the counters, of a model or a session
+class StageMetrics {
+public:
+  void record(Stage stage, uint64_t micros) { this->stages[static_cast<int>(stage)].record(micros); }
+
+  void count(Counter counter, uint64_t delta = 1) {
+    this->counters[static_cast<int>(counter)].fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  const Histogram &get(Stage stage) const { return this->stages[static_cast<int>(stage)]; }
+
+  uint64_t get(Counter counter) const { return this->counters[static_cast<int>(counter)].load(std::memory_order_relaxed); }
+
+  /// @brief {stages: {name: {count, avgMs, p50Ms, p95Ms, p99Ms, maxMs}}, counters: {name: value}}, stages without records omitted
+  Json::Value toJSON() const;
+
+private:
+  Histogram stages[static_cast<int>(Stage::COUNT)];
+  std::atomic<uint64_t> counters[static_cast<int>(Counter::COUNT)] = {};
+};
+
+/**
+ * @brief the metrics of all models and sessions
+ *
+ * The hot path only touches the StageMetrics it holds a pointer to; the registry lock is taken when a model or session
+ * is added and when exporting.
+ */
+class Metrics {
+public:
+  static const char *stageName(Stage stage);
+  static const char *counterName(Counter counter);
+
+  /// @brief the metrics of a model, created on first use and kept for the life of the registry
+  StageMetrics *forModel(const std::string &modelName);
+
+  /// @brief new metrics of a session, dropped from the exports once the session releases them
+  std::shared_ptr<StageMetrics> addSession(const std::string &sessionId);
+
+  /// @brief Prometheus text exposition of the models, and of the live sessions if withSessions
+  std::string toPrometheus(bool withSessions);
+
+  /// @brief write the Prometheus text to a file atomically (temporary file and rename), for the node exporter textfile collector
+  bool writePrometheus(const std::string &path, bool withSessions);
+
+private:
+  std::mutex registryLock;
+  std::map<std::string, std::unique_ptr<StageMetrics>> models;
+  std::map<std::string, std::weak_ptr<StageMetrics>> sessions;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -1,13 +1,19 @@
 #include "ModelPool.hpp"
+#include "Device.hpp"
 #include "utils.hpp"
-#include "yolov7.hpp"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <gst/gst.h>
 #include <json/json.h>
-#include <mutex>
+#include <set>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -18,110 +24,293 @@ namespace kurento {
 namespace module {
 namespace objdet {
 
+namespace {
+
+int64_t nowSec() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief milliseconds since a start time, for the startup phase logs
+long long elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// @brief read the pending inotify events, true if one is about the file or about the ..data link a config map swaps
+bool isFileChanged(int inotifyFd, const std::string &fileName) {
+  alignas(struct inotify_event) char buffer[4096];
+  bool isChanged = false;
+  ssize_t length;
+  while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+    for (char *at = buffer; at < buffer + length;) {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(at);
+      if (event->len > 0 && (fileName == event->name || std::strncmp(event->name, "..", 2) == 0)) {
+        isChanged = true;
+      }
+      at += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return isChanged;
+}
+
+/// @brief the owner key of a session, never collides with the FREE and CHECKED_OUT states
+uint64_t sessionKey(const std::string &sessionId) {
+  uint64_t key = std::hash<std::string>{}(sessionId);
+  return key <= ModelSlot::CHECKED_OUT ? key + 2 : key;
+}
+
+} // namespace
+
+void ModelBundle::initSlots() {
+  this->freeLists = std::make_unique<FreeList[]>(this->placement.getDevices().size());
+  this->slots = std::vector<ModelSlot>(this->models.size());
+  for (int i = 0; i < static_cast<int>(this->models.size()); i++) {
+    this->slots[i].model = this->models[i];
+    this->slots[i].device = i < static_cast<int>(this->modelDevices.size()) ? this->modelDevices[i] : 0;
+    this->slotIndex[this->models[i]] = i;
+  }
+}
+
+ModelSlot *ModelBundle::findSlot(const Detector *model) {
+  auto found = this->slotIndex.find(model);
+  return found == this->slotIndex.end() ? nullptr : &this->slots[found->second];
+}
+
+void ModelBundle::pushFree(int index) {
+  std::atomic<uint64_t> &freeHead = this->freeLists[this->slots[index].device].head;
+  uint64_t head = freeHead.load(std::memory_order_acquire);
+  uint64_t newHead;
+  do {
+    this->slots[index].next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    newHead = (((head >> 32) + 1) << 32) | static_cast<uint32_t>(index + 1);
+  } while (freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_acquire) == false);
+  this->freeCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+int ModelBundle::popFree(int device) {
+  std::atomic<uint64_t> &freeHead = this->freeLists[device].head;
+  uint64_t head = freeHead.load(std::memory_order_acquire);
+  while (true) {
+    uint32_t top = static_cast<uint32_t>(head);
+    if (top == 0) {
+      return -1;
+    }
+    // the link may be stale if another thread popped meanwhile, the tag then fails the exchange
+    uint32_t next = this->slots[top - 1].next.load(std::memory_order_relaxed);
+    uint64_t newHead = (((head >> 32) + 1) << 32) | next;
+    if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      this->freeCount.fetch_sub(1, std::memory_order_relaxed);
+      return static_cast<int>(top - 1);
+    }
+  }
+}
+
 ModelBundle::~ModelBundle() {
-  for (Yolov7trt *model : this->models) {
+  for (ResidentDetector *model : this->models) {
     delete model;
   }
+  for (BatchScheduler *scheduler : this->batchSchedulers) {
+    delete scheduler;
+  }
+  for (Detector *engine : this->batchEngines) {
+    delete engine;
+  }
 }
 
-ModelPool::ModelPool() {
+ModelPool::ModelPool() : reaperWheel(nowSec()) {
 
   GST_DEBUG_CATEGORY_INIT(obj_det_model_pool, "ObjDetModelPool", GST_DEBUG_BG_YELLOW, "ObjDetModelPool");
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
   GST_INFO("init");
 
   GST_INFO("read config");
+  auto start = std::chrono::steady_clock::now();
   Json::Value config;
   this->readConfig(config);
+  GST_INFO("config read in %lld ms", elapsedMs(start));
 
   GST_INFO("init models");
   this->initModels(config);
+  this->configPath = std::getenv("OBJDET_CONFIG");
+  this->isWatchingConfig = config.get("watch_config", false).asBool();
+  this->appliedConfig = config;
+
+  GST_INFO("start session reaper");
+  this->reaper = std::thread(&ModelPool::runReaper, this);
+  GST_INFO("start config watcher%s", this->isWatchingConfig ? ", reload on change" : "");
+  this->watcher = std::thread(&ModelPool::runWatcher, this);
+  GST_INFO("model pool ready in %lld ms", elapsedMs(start));
+}
+
+ModelPool::ModelPool(const Json::Value &config) : reaperWheel(nowSec()) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_model_pool, "ObjDetModelPool", GST_DEBUG_BG_YELLOW, "ObjDetModelPool");
+  GST_INFO("init models");
+  this->initModels(config);
+
+  GST_INFO("start session reaper");
+  this->reaper = std::thread(&ModelPool::runReaper, this);
 }
 
 int ModelPool::getAvailableCount(const std::string &modelName) {
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model bundle %s not found", modelName.c_str());
     return -1;
   }
-  int count = 0;
-  for (auto const &[_, used] : this->modelBundles[modelName]->isUsed) {
-    count += used ? 1 : 0;
-  }
+  // a model that is not loaded has all its instances to offer
+  int count =
+      bundle->isResident.load(std::memory_order_acquire) ? bundle->getFreeCount() : bundle->limit.load(std::memory_order_relaxed);
   GST_DEBUG("available %s model is %d", modelName.c_str(), count);
   return count;
 }
 
 bool ModelPool::isAvailable(const std::string &modelName) {
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model %s not found", modelName.c_str());
     return false;
   }
-  for (auto const &[_, used] : this->modelBundles[modelName]->isUsed) {
-    if (used == false) {
-      GST_DEBUG("is available=true");
-      return true;
-    }
-  }
-  GST_DEBUG("is available=false");
-  return false;
+  bool available = bundle->isResident.load(std::memory_order_acquire) ? bundle->getFreeCount() > 0
+                                                                      : bundle->limit.load(std::memory_order_relaxed) > 0;
+  GST_DEBUG("is available=%s", available ? "true" : "false");
+  return available;
 }
 
-Yolov7trt *ModelPool::getModel(const std::string &modelName) {
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+Detector *ModelPool::getModel(const std::string &modelName) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model %s not found", modelName.c_str());
     return nullptr;
   }
   GST_INFO("get a %s model", modelName.c_str());
-  ModelBundle *bundle = this->modelBundles[modelName];
-  for (Yolov7trt *model : bundle->models) {
-    uintptr_t address = reinterpret_cast<uintptr_t>(model);
-    if (bundle->isUsed[address] == false) {
-      bundle->isUsed[address] = true;
-      GST_DEBUG("get a model successfully");
-      return model;
+  if (bundle->isRetired.load(std::memory_order_acquire)) {
+    GST_WARNING("%s was removed from the config", modelName.c_str());
+    return nullptr;
+  }
+  bundle->lastUse.store(nowSec(), std::memory_order_relaxed);
+  if (bundle->waiterCount.load(std::memory_order_seq_cst) > 0) {
+    // a returned instance belongs to the sessions already waiting for one
+    GST_WARNING("sessions are waiting for a %s model", modelName.c_str());
+    return nullptr;
+  }
+  if (bundle->isResident.load(std::memory_order_acquire) == false && this->ensureResident(bundle) == false) {
+    GST_WARNING("%s model cannot be loaded", modelName.c_str());
+    return nullptr;
+  }
+  int index = this->checkout(bundle);
+  if (index < 0 && this->vramBudget > 0 && this->ensureResident(bundle)) {
+    // an eviction may have been taking the free instances out meanwhile, it is over once the lock is ours
+    index = this->checkout(bundle);
+  }
+  if (index < 0) {
+    GST_WARNING("try to get %s model but no model is available", modelName.c_str());
+    GST_WARNING("you could try to increase the number of models if config file");
+    return nullptr;
+  }
+  GST_DEBUG("get a model successfully");
+  return this->handOut(bundle, index);
+}
+
+Detector *ModelPool::getModelOrWait(const std::string &modelName, int priority, uint64_t ticket,
+                                    AdmissionQueue::AdmittedCallback onAdmitted, AdmissionQueue::PositionCallback onPosition,
+                                    int &position) {
+  position = 0;
+  Detector *model = this->getModel(modelName);
+  if (model != nullptr) {
+    return model;
+  }
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr || bundle->maxQueue <= 0 || bundle->isResident.load(std::memory_order_acquire) == false) {
+    // a model that cannot be loaded would never serve the queue
+    return nullptr;
+  }
+
+  //// queue up, then look for a free instance again: one returned before the queue was visible is not handed to anyone
+  std::vector<Admitted> admitted;
+  std::vector<AdmissionQueue::Move> moves;
+  {
+    std::lock_guard<std::mutex> lockNow(bundle->admissionLock);
+    if (bundle->isRetired.load(std::memory_order_acquire)) {
+      // retiring empties the queue under this lock, a session queued later would never be served
+      return nullptr;
     }
+    if (static_cast<int>(bundle->admission.size()) >= bundle->maxQueue) {
+      GST_WARNING("the %s admission queue is full, %d sessions waiting", modelName.c_str(), bundle->maxQueue.load());
+      return nullptr;
+    }
+    position = bundle->admission.push(
+        AdmissionQueue::Waiter{ticket, priority, std::chrono::steady_clock::now(), std::move(onAdmitted), std::move(onPosition)});
+    bundle->waiterCount.store(static_cast<int>(bundle->admission.size()), std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    this->serveWaiters(bundle, admitted, moves);
   }
 
-  //// check if there is a timeout session to get the model
-  GST_INFO("try get a timeout model");
-  bool isModelReleased = this->updateSession(modelName);
-  if (isModelReleased) {
-    return this->getModel(modelName);
+  //// served at once, the model is returned here instead of through the callback
+  auto self = std::find_if(admitted.begin(), admitted.end(), [ticket](const Admitted &one) { return one.ticket == ticket; });
+  if (self != admitted.end()) {
+    model = self->model;
+    admitted.erase(self);
+    this->notifyWaiters(admitted, moves);
+    position = 0;
+    return model;
   }
-  GST_WARNING("try to get %s model but no model is available", modelName.c_str());
-  GST_WARNING("you could try to increase the number of models if config file");
+  this->notifyWaiters(admitted, moves);
+  bundle->metrics->count(Counter::SESSIONS_QUEUED);
+  GST_INFO("queued for a %s model at position %d", modelName.c_str(), position);
   return nullptr;
 }
 
+bool ModelPool::cancelWait(const std::string &modelName, uint64_t ticket) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr || ticket == 0) {
+    return false;
+  }
+  std::vector<Admitted> admitted;
+  std::vector<AdmissionQueue::Move> moves;
+  {
+    std::lock_guard<std::mutex> lockNow(bundle->admissionLock);
+    if (bundle->admission.remove(ticket, moves) == false) {
+      return false;
+    }
+    bundle->waiterCount.store(static_cast<int>(bundle->admission.size()), std::memory_order_seq_cst);
+  }
+  GST_INFO("left the %s admission queue", modelName.c_str());
+  this->notifyWaiters(admitted, moves);
+  return true;
+}
+
 std::string ModelPool::getDefaultModelName() {
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
   GST_DEBUG("get default model name %s", this->defaultModelName.c_str());
   return this->defaultModelName;
 }
 
-void ModelPool::returnModel(const std::string &modelName, Yolov7trt *model, const std::string &sessionId) {
+void ModelPool::returnModel(const std::string &modelName, Detector *model, const std::string &sessionId) {
   GST_INFO("return a %s model", modelName.c_str());
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model %s not found", modelName.c_str());
     return;
   }
-  uintptr_t address = reinterpret_cast<uintptr_t>(model);
-  ModelBundle *bundle = this->modelBundles[modelName];
-  bundle->isUsed[address] = false;
-  bundle->sessionHeartbeat.erase(sessionId);
-  bundle->sessionToModel.erase(sessionId);
+  bundle->lastUse.store(nowSec(), std::memory_order_relaxed);
+  ModelSlot *slot = bundle->findSlot(model);
+  if (slot == nullptr) {
+    GST_ERROR("model does not belong to %s", modelName.c_str());
+    return;
+  }
+  // a model checked out but never registered is returned by the same session
+  if (this->releaseSlot(bundle, slot, sessionKey(sessionId)) == false &&
+      this->releaseSlot(bundle, slot, ModelSlot::CHECKED_OUT) == false) {
+    GST_WARNING("session %s no longer owns its %s model", sessionId.c_str(), modelName.c_str());
+    return;
+  }
   GST_DEBUG("destroy session %s, release a model %s", sessionId.c_str(), modelName.c_str());
 }
 
 void ModelPool::getModelNames(std::vector<std::string> &names) {
   GST_INFO("get model names");
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
   names.clear();
-  for (auto &[modelName, _] : this->modelBundles) {
+  for (auto &[modelName, bundle] : this->getBundles()) {
+    if (bundle->isRetired.load(std::memory_order_relaxed)) {
+      continue;
+    }
     GST_DEBUG("model name %s", modelName.c_str());
     names.push_back(modelName);
   }
@@ -129,52 +318,119 @@ void ModelPool::getModelNames(std::vector<std::string> &names) {
 
 bool ModelPool::modelExists(const std::string &modelName) {
   GST_INFO("check model exists");
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  return this->modelBundles.find(modelName) != this->modelBundles.end();
+  ModelBundle *bundle = this->findBundle(modelName);
+  return bundle != nullptr && bundle->isRetired.load(std::memory_order_relaxed) == false;
 }
 
-void ModelPool::registerSession(const std::string &modelName, Yolov7trt *model, const std::string &sessionId) {
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+void ModelPool::registerSession(const std::string &modelName, Detector *model, const std::string &sessionId,
+                                std::function<void()> onExpired) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model %s not found", modelName.c_str());
     return;
   }
+  ModelSlot *slot = bundle->findSlot(model);
+  if (slot == nullptr) {
+    GST_ERROR("model does not belong to %s", modelName.c_str());
+    return;
+  }
   GST_INFO("register a session %s with model %s", sessionId.c_str(), modelName.c_str());
-  ModelBundle *bundle = this->modelBundles[modelName];
-  bundle->sessionHeartbeat[sessionId] = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-  bundle->sessionToModel[sessionId] = model;
+  slot->heartbeat.store(nowSec(), std::memory_order_relaxed);
+  uint64_t expected = ModelSlot::CHECKED_OUT;
+  uint64_t key = sessionKey(sessionId);
+  if (slot->owner.compare_exchange_strong(expected, key, std::memory_order_acq_rel) == false) {
+    GST_WARNING("register session %s on a model that is not checked out", sessionId.c_str());
+    return;
+  }
+  uint32_t generation = slot->generation.fetch_add(1, std::memory_order_relaxed) + 1;
+  this->watchSlot(bundle, *slot, generation, key, std::move(onExpired));
 }
 
-void ModelPool::heartbeat(const std::string &modelName, std::string sessionId) {
+void ModelPool::heartbeat(const std::string &modelName, Detector *model, const std::string &sessionId) {
   GST_DEBUG("heartbeat %s", sessionId.c_str());
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model %s not found", modelName.c_str());
     return;
   }
-  ModelBundle *bundle = this->modelBundles[modelName];
-  if (bundle->sessionHeartbeat.find(sessionId) == bundle->sessionHeartbeat.end()) {
+  ModelSlot *slot = bundle->findSlot(model);
+  if (slot == nullptr || slot->owner.load(std::memory_order_acquire) != sessionKey(sessionId)) {
     GST_WARNING("heartbeat on destroyed session %s", sessionId.c_str());
     return;
   }
-  bundle->sessionHeartbeat[sessionId] = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+  slot->heartbeat.store(nowSec(), std::memory_order_relaxed);
 }
 
-bool ModelPool::sessionExists(const std::string &modelName, std::string sessionId) {
+StageMetrics *ModelPool::getModelMetrics(const std::string &modelName) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  return bundle == nullptr ? nullptr : bundle->metrics;
+}
+
+bool ModelPool::sessionExists(const std::string &modelName, Detector *model, const std::string &sessionId) {
   GST_INFO("check session exists %s", sessionId.c_str());
-  std::lock_guard<std::recursive_mutex> lockNow(this->lock);
-  if (this->modelExists(modelName) == false) {
+  ModelBundle *bundle = this->findBundle(modelName);
+  if (bundle == nullptr) {
     GST_ERROR("model %s not found", modelName.c_str());
     return false;
   }
-  this->updateSession(modelName);
-  ModelBundle *bundle = this->modelBundles[modelName];
-  return bundle->sessionHeartbeat.find(sessionId) != bundle->sessionHeartbeat.end();
+  ModelSlot *slot = bundle->findSlot(model);
+  uint64_t key = sessionKey(sessionId);
+  if (slot == nullptr || slot->owner.load(std::memory_order_acquire) != key) {
+    return false;
+  }
+  if (nowSec() - slot->heartbeat.load(std::memory_order_relaxed) > bundle->sessionTimeoutSec) {
+    GST_DEBUG("release expired model resourse %s", sessionId.c_str());
+    if (this->releaseSlot(bundle, slot, key)) {
+      bundle->metrics->count(Counter::SESSIONS_REAPED);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ModelPool::requestReload() {
+  if (this->configPath.empty()) {
+    GST_WARNING("the model pool was not loaded from a config file");
+    return false;
+  }
+  auto config = std::make_unique<Json::Value>();
+  try {
+    this->readConfig(*config);
+  } catch (const std::exception &e) {
+    GST_WARNING("keep the current config: %s", e.what());
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lockNow(this->watcherLock);
+    this->pendingConfig = std::move(config);
+  }
+  this->watcherCond.notify_all();
+  return true;
 }
 
 ModelPool::~ModelPool() {
+  GST_INFO("stop config watcher");
+  {
+    std::lock_guard<std::mutex> lockNow(this->watcherLock);
+    this->isWatcherStopping = true;
+  }
+  this->watcherCond.notify_all();
+  if (this->watcher.joinable()) {
+    this->watcher.join();
+  }
+
+  GST_INFO("stop session reaper");
+  {
+    std::lock_guard<std::mutex> lockNow(this->reaperLock);
+    this->isStopping = true;
+  }
+  this->reaperCond.notify_all();
+  if (this->reaper.joinable()) {
+    this->reaper.join();
+  }
+
   GST_INFO("destroy models");
-  for (auto &[_, modelBundle] : this->modelBundles) {
+  for (auto &[_, modelBundle] : this->getBundles()) {
     delete modelBundle;
   }
 }
@@ -216,95 +472,884 @@ void ModelPool::readConfig(Json::Value &config) {
 }
 
 void ModelPool::initModels(const Json::Value &config) {
-  //// set device id
+  auto start = std::chrono::steady_clock::now();
+
+  //// the device of models without their own device list
   int deviceId = std::max(config["device_id"].asInt(), 0);
-  cudaSetDevice(deviceId);
-  GST_INFO("device id = %d", deviceId);
+  GST_INFO("default device id = %d (%d devices found)", deviceId, DeviceInventory::system().getDeviceCount());
 
   this->defaultModelName = config["default_model_name"].asString();
+  this->vramBudget = static_cast<size_t>(std::max(config.get("vram_budget_mb", 0).asInt64(), Json::Int64(0))) << 20;
   int totalModelNum = static_cast<int>(config["models"].size());
+  bool isLazy = config.get("lazy_load", false).asBool();
+  this->metricsPath = config.get("metrics_file", "").asString();
+  this->metricsIntervalSec = std::max(config.get("metrics_interval_sec", 10).asInt(), 1);
+  this->isMetricsPerSession = config.get("metrics_per_session", false).asBool();
+  std::vector<ModelBundle *> eagerBundles;
 
+  BundleMap bundles;
   for (int i = 0; i < totalModelNum; i++) {
-    //// valid parameters
-    Json::Value modelParam = config["models"][i];
+    const Json::Value &modelParam = config["models"][i];
     if (modelParam["enabled"].asBool() == false) {
       GST_INFO("Skip disabled model %s", modelParam["name"].asString().c_str());
       continue;
     }
-    if (modelParam["name"].asString() == "default") {
-      GST_ERROR("model name 'default' is a pre-defined keyword");
-      throw std::runtime_error("model name 'default' is a pre-defined keyword");
-      break;
+    ModelBundle *bundle = this->createBundle(modelParam, deviceId);
+    if (bundle == nullptr) {
+      continue;
+    }
+    bundles[modelParam["name"].asString()] = bundle;
+    if (modelParam.get("lazy_load", isLazy).asBool()) {
+      GST_INFO("%s is loaded on first use", modelParam["name"].asString().c_str());
+    } else if (bundle->isPinned) {
+      eagerBundles.insert(eagerBundles.begin(), bundle);
+    } else {
+      eagerBundles.push_back(bundle);
     }
+  }
+  this->publishBundles(bundles);
+
+  //// set default model
+  if (bundles.find(this->defaultModelName) == bundles.end()) {
+    GST_ERROR("default model name not found (%s)", this->defaultModelName.c_str());
+    throw std::runtime_error("default model name not found");
+  }
 
-    int maxModelLimit = std::max(modelParam["max_model_limit"].asInt(), 1);
-    GST_INFO("Start init %d %s models", maxModelLimit, modelParam["name"].asString().c_str());
+  //// within a budget, the pinned models and then the others in config order as long as their estimates fit
+  if (this->vramBudget > 0) {
+    std::vector<Residency::Resident> planned;
+    std::vector<int> victims;
+    std::vector<ModelBundle *> fitting;
+    for (ModelBundle *bundle : eagerBundles) {
+      if (Residency::planEviction(planned, bundle->footprint, this->vramBudget, victims) && victims.empty()) {
+        planned.push_back(Residency::Resident{static_cast<int>(planned.size()), bundle->footprint, 0, false});
+        fitting.push_back(bundle);
+      } else {
+        GST_INFO("%s does not fit the VRAM budget, it is loaded on first use", bundle->modelParam["name"].asString().c_str());
+      }
+    }
+    eagerBundles.swap(fitting);
+  }
 
-    //// check model file
-    std::string modelPath = modelParam["model_abs_path"].asString();
-    GST_INFO("check model file");
-    if (fs::exists(modelPath) == false) {
-      GST_ERROR("object detection model not found: %s", modelPath.c_str());
-      throw std::runtime_error(std::string("object detection model not found: ") + modelPath);
+  //// load the bundles concurrently, the bundle map is final already and each thread only fills its own bundle
+  // with a budget one by one, so that the footprint measured by each is its own
+  bool isParallel = config.get("parallel_init", true).asBool() && this->vramBudget == 0 && eagerBundles.size() > 1;
+  GST_INFO("load %zu models %s", eagerBundles.size(), isParallel ? "in parallel" : "one by one");
+  std::vector<std::exception_ptr> errors(eagerBundles.size());
+  auto load = [this, &eagerBundles, &errors](size_t i) {
+    try {
+      this->loadBundle(eagerBundles[i]);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  if (isParallel) {
+    std::vector<std::thread> loaders;
+    for (size_t i = 0; i < eagerBundles.size(); i++) {
+      loaders.emplace_back(load, i);
+    }
+    for (std::thread &loader : loaders) {
+      loader.join();
+    }
+  } else {
+    for (size_t i = 0; i < eagerBundles.size(); i++) {
+      load(i);
+    }
+  }
+  for (const std::exception_ptr &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  for (ModelBundle *bundle : eagerBundles) {
+    this->publishBundle(bundle);
+  }
+  GST_INFO("models loaded in %lld ms", elapsedMs(start));
+}
+
+ModelBundle *ModelPool::createBundle(const Json::Value &modelParam, int defaultDeviceId) {
+  //// valid parameters
+  if (modelParam["name"].asString() == "default") {
+    GST_ERROR("model name 'default' is a pre-defined keyword");
+    throw std::runtime_error("model name 'default' is a pre-defined keyword");
+  }
+
+  //// check model file
+  std::string modelPath = modelParam["model_abs_path"].asString();
+  GST_INFO("check model file");
+  if (fs::exists(modelPath) == false) {
+    GST_ERROR("object detection model not found: %s", modelPath.c_str());
+    throw std::runtime_error(std::string("object detection model not found: ") + modelPath);
+  }
+
+  //// the backend loads the model once per device, every instance is created from it
+  std::unique_ptr<DetectorFactory> factory;
+  try {
+    factory = DetectorFactory::forModel(modelParam);
+  } catch (const std::exception &e) {
+    GST_ERROR("Error init %s backend: %s", modelParam["name"].asString().c_str(), e.what());
+    return nullptr;
+  }
+
+  //// register the bundle and the handles of its instances, the instances are created on load or on first use
+  ModelBundle *bundle = new ModelBundle();
+  bundle->factory = std::move(factory);
+  bundle->sessionTimeoutSec = std::max(modelParam.get("session_timeout_sec", 60).asInt(), 1);
+  bundle->maxQueue = std::max(modelParam.get("max_queue", 16).asInt(), 0);
+  bundle->queueTimeoutSec = std::max(modelParam.get("queue_timeout_sec", 0).asInt(), 0);
+  if (this->initPlacement(bundle, modelParam, defaultDeviceId) == false) {
+    delete bundle;
+    return nullptr;
+  }
+  bundle->modelParam = modelParam;
+  bundle->metrics = this->metrics.forModel(modelParam["name"].asString());
+  bundle->isPinned = modelParam["name"].asString() == this->defaultModelName || modelParam.get("pinned", false).asBool();
+  int maxModelLimit = std::max(modelParam["max_model_limit"].asInt(), 1);
+  // handles are cheap, the spare ones let a reload add instances without touching the slots
+  int maxInstances = std::max(modelParam.get("max_instances", std::max(maxModelLimit, 8)).asInt(), maxModelLimit);
+  bundle->footprint.assign(DeviceLoad::maxDevices, 0);
+  for (int k = 0; k < maxInstances; k++) {
+    bundle->models.push_back(new ResidentDetector());
+    bundle->modelDevices.push_back(bundle->placement.getInstanceDevice(k));
+  }
+  bundle->initSlots();
+  this->scaleFootprint(bundle, 0, maxModelLimit);
+  bundle->limit.store(maxModelLimit, std::memory_order_relaxed);
+  return bundle;
+}
+
+void ModelPool::loadBundle(ModelBundle *bundle) {
+  auto start = std::chrono::steady_clock::now();
+  const Json::Value &modelParam = bundle->modelParam;
+  std::string name = modelParam["name"].asString();
+  int maxModelLimit = bundle->limit.load(std::memory_order_relaxed);
+  GST_INFO("Start init %d %s models", maxModelLimit, name.c_str());
+
+  //// the footprint is the free memory the instances take
+  const std::vector<int> &devices = bundle->placement.getDevices();
+  std::vector<size_t> freeBefore(devices.size(), 0);
+  size_t totalMem = 0;
+  if (bundle->factory->usesDevice()) {
+    for (size_t d = 0; d < devices.size(); d++) {
+      DeviceInventory::system().getMemInfo(devices[d], freeBefore[d], totalMem);
+    }
+  }
+  auto measure = [bundle, &devices, &freeBefore]() {
+    if (bundle->factory->usesDevice() == false) {
+      return;
     }
+    for (size_t d = 0; d < devices.size(); d++) {
+      size_t freeAfter = 0, totalMem = 0;
+      if (DeviceInventory::system().getMemInfo(devices[d], freeAfter, totalMem) && freeAfter < freeBefore[d]) {
+        bundle->footprint[devices[d]] = freeBefore[d] - freeAfter;
+      }
+    }
+  };
 
-    //// load models
-    ModelBundle *bundle = new ModelBundle();
+  if (modelParam.get("max_batch", 1).asInt() > 1 && this->initBatching(bundle, modelParam)) {
+    //// every session gets a lightweight handle on the shared instance of its device
     for (int i = 0; i < maxModelLimit; i++) {
-      this->checkVRAM(deviceId, 500000000);
-      GST_INFO("Init %d/%d %s model", i + 1, maxModelLimit, modelParam["name"].asString().c_str());
-      Yolov7trt *md;
+      bundle->models[i]->attach(new BatchedDetector(*bundle->batchSchedulers[bundle->modelDevices[i]]));
+    }
+    GST_INFO("Added %d batched %s session handles in %lld ms", maxModelLimit, name.c_str(), elapsedMs(start));
+    measure();
+    return;
+  }
+
+  for (int i = 0; i < maxModelLimit; i++) {
+    this->attachInstance(bundle, i);
+  }
+  measure();
+  GST_INFO("%s loaded in %lld ms", name.c_str(), elapsedMs(start));
+}
+
+bool ModelPool::attachInstance(ModelBundle *bundle, int index) {
+  std::string name = bundle->modelParam["name"].asString();
+  int device = bundle->modelDevices[index];
+  if (bundle->batchSchedulers.empty() == false) {
+    bundle->models[index]->attach(new BatchedDetector(*bundle->batchSchedulers[device]));
+    return true;
+  }
+  int deviceId = bundle->placement.getDevices()[device];
+  if (bundle->factory->usesDevice()) {
+    this->checkVRAM(deviceId, 500000000);
+  }
+  GST_INFO("Init %s model %d on device %d", name.c_str(), index + 1, deviceId);
+  auto instanceStart = std::chrono::steady_clock::now();
+  Detector *md;
+  try {
+    md = bundle->factory->createDetector(index, deviceId);
+    GST_INFO("Finish init %s model %d in %lld ms", name.c_str(), index + 1, elapsedMs(instanceStart));
+  } catch (const std::exception &e) {
+    GST_ERROR("Error init %s model %d", name.c_str(), index + 1);
+    return false;
+  }
+  md->setMetrics(bundle->metrics);
+  bundle->models[index]->attach(md);
+  GST_INFO("Added %s model %d", name.c_str(), index + 1);
+  return true;
+}
+
+bool ModelPool::publishBundle(ModelBundle *bundle) {
+  int count = 0;
+  for (int i = static_cast<int>(bundle->models.size()) - 1; i >= 0; i--) {
+    if (bundle->models[i]->isAttached()) {
+      bundle->pushFree(i);
+      count++;
+    }
+  }
+  if (count == 0) {
+    GST_ERROR("no %s instance could be created", bundle->modelParam["name"].asString().c_str());
+    this->releaseInstances(bundle);
+    return false;
+  }
+  bundle->instanceCount = count;
+  bundle->isResident.store(true, std::memory_order_release);
+  return true;
+}
+
+void ModelPool::releaseInstances(ModelBundle *bundle) {
+  for (ResidentDetector *model : bundle->models) {
+    model->detach();
+  }
+  for (BatchScheduler *scheduler : bundle->batchSchedulers) {
+    delete scheduler;
+  }
+  for (Detector *engine : bundle->batchEngines) {
+    delete engine;
+  }
+  bundle->batchSchedulers.clear();
+  bundle->batchEngines.clear();
+  bundle->factory->unload();
+  bundle->instanceCount = 0;
+}
+
+bool ModelPool::unloadBundle(ModelBundle *bundle) {
+  //// take every instance out of the free lists, a session holding one keeps the bundle loaded
+  std::vector<int> taken;
+  for (size_t device = 0; device < bundle->placement.getDevices().size(); device++) {
+    for (int index = bundle->popFree(static_cast<int>(device)); index >= 0; index = bundle->popFree(static_cast<int>(device))) {
+      taken.push_back(index);
+    }
+  }
+  if (static_cast<int>(taken.size()) != bundle->instanceCount) {
+    for (int index : taken) {
+      bundle->pushFree(index);
+    }
+    return false;
+  }
+  bundle->isResident.store(false, std::memory_order_release);
+  this->releaseInstances(bundle);
+  return true;
+}
+
+bool ModelPool::makeRoom(ModelBundle *bundle) {
+  std::vector<ModelBundle *> busy;
+  while (true) {
+    std::vector<Residency::Resident> resident;
+    std::vector<ModelBundle *> bundles;
+    for (auto &[_, other] : this->getBundles()) {
+      if (other == bundle || other->isResident.load(std::memory_order_relaxed) == false) {
+        continue;
+      }
+      bool isEvictable = other->isPinned == false && std::find(busy.begin(), busy.end(), other) == busy.end();
+      resident.push_back(Residency::Resident{static_cast<int>(bundles.size()), other->footprint,
+                                             other->lastUse.load(std::memory_order_relaxed), isEvictable});
+      bundles.push_back(other);
+    }
+    std::vector<int> victims;
+    if (Residency::planEviction(resident, bundle->footprint, this->vramBudget, victims) == false) {
+      GST_WARNING("%s does not fit the VRAM budget, the other models are pinned or in use",
+                  bundle->modelParam["name"].asString().c_str());
+      return false;
+    }
+    if (victims.empty()) {
+      return true;
+    }
+    for (int victim : victims) {
+      ModelBundle *other = bundles[victim];
+      if (this->unloadBundle(other)) {
+        GST_INFO("unloaded %s, unused for %lld s", other->modelParam["name"].asString().c_str(),
+                 static_cast<long long>(nowSec() - other->lastUse.load(std::memory_order_relaxed)));
+      } else {
+        // a session took an instance since the plan was made
+        busy.push_back(other);
+      }
+    }
+  }
+}
+
+bool ModelPool::ensureResident(ModelBundle *bundle) {
+  std::lock_guard<std::mutex> lockNow(this->residencyLock);
+  if (bundle->isResident.load(std::memory_order_acquire)) {
+    return true;
+  }
+  if (this->makeRoom(bundle) == false) {
+    return false;
+  }
+  try {
+    this->loadBundle(bundle);
+  } catch (const std::exception &e) {
+    GST_ERROR("Error loading %s: %s", bundle->modelParam["name"].asString().c_str(), e.what());
+  }
+  return this->publishBundle(bundle);
+}
+
+void ModelPool::publishBundles(const BundleMap &bundles) {
+  this->bundleMaps.push_back(std::make_unique<BundleMap>(bundles));
+  this->modelBundles.store(this->bundleMaps.back().get(), std::memory_order_release);
+}
+
+void ModelPool::applyConfig(const Json::Value &config) {
+  if (config == this->appliedConfig) {
+    GST_DEBUG("config unchanged");
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  GST_INFO("apply the reloaded config");
+  if (config["default_model_name"].asString() != this->defaultModelName) {
+    GST_WARNING("a change of default_model_name needs a restart");
+  }
+  int deviceId = std::max(config["device_id"].asInt(), 0);
+  bool isLazy = config.get("lazy_load", false).asBool();
+
+  //// resize the known models and add the new ones
+  BundleMap bundles = this->getBundles();
+  std::set<std::string> enabled;
+  std::vector<ModelBundle *> added;
+  for (int i = 0; i < static_cast<int>(config["models"].size()); i++) {
+    const Json::Value &modelParam = config["models"][i];
+    std::string name = modelParam["name"].asString();
+    if (modelParam["enabled"].asBool() == false) {
+      continue;
+    }
+    enabled.insert(name);
+    auto found = bundles.find(name);
+    if (found != bundles.end()) {
+      this->resizeBundle(found->second, modelParam);
+      continue;
+    }
+    ModelBundle *bundle = nullptr;
+    try {
+      bundle = this->createBundle(modelParam, deviceId);
+    } catch (const std::exception &e) {
+      GST_ERROR("cannot add %s: %s", name.c_str(), e.what());
+    }
+    if (bundle == nullptr) {
+      continue;
+    }
+    GST_INFO("add %s with %d instances", name.c_str(), bundle->limit.load(std::memory_order_relaxed));
+    bundles[name] = bundle;
+    if (modelParam.get("lazy_load", isLazy).asBool() == false) {
+      added.push_back(bundle);
+    }
+  }
+  if (bundles.size() != this->getBundles().size()) {
+    this->publishBundles(bundles);
+  }
+
+  //// retire the models that are gone or disabled, the default model stays
+  for (auto &[name, bundle] : bundles) {
+    if (enabled.count(name) > 0 || bundle->isRetired.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    if (name == this->defaultModelName) {
+      GST_WARNING("the default model %s cannot be removed", name.c_str());
+      continue;
+    }
+    this->retireBundle(bundle);
+  }
+
+  for (ModelBundle *bundle : added) {
+    if (this->ensureResident(bundle) == false) {
+      GST_WARNING("%s could not be loaded, it is tried again on first use", bundle->modelParam["name"].asString().c_str());
+    }
+  }
+  this->appliedConfig = config;
+  GST_INFO("config applied in %lld ms", elapsedMs(start));
+}
+
+void ModelPool::resizeBundle(ModelBundle *bundle, const Json::Value &modelParam) {
+  std::string name = modelParam["name"].asString();
+
+  //// the engine and the handles are fixed while the bundle exists
+  const Json::Value &current = bundle->modelParam;
+  for (const char *key : {"model_abs_path", "backend", "devices", "placement", "max_batch", "max_wait_us", "input_sizes",
+                          "tile_batch", "warmup", "max_instances"}) {
+    if (modelParam[key] != current[key]) {
+      GST_WARNING("%s: a change of %s needs a restart", name.c_str(), key);
+    }
+  }
+
+  bundle->sessionTimeoutSec = std::max(modelParam.get("session_timeout_sec", 60).asInt(), 1);
+  bundle->maxQueue = std::max(modelParam.get("max_queue", 16).asInt(), 0);
+  bundle->queueTimeoutSec = std::max(modelParam.get("queue_timeout_sec", 0).asInt(), 0);
+  {
+    std::lock_guard<std::mutex> lockNow(this->residencyLock);
+    bundle->isPinned = name == this->defaultModelName || modelParam.get("pinned", false).asBool();
+  }
+  int limit = std::max(modelParam["max_model_limit"].asInt(), 1);
+  if (limit > static_cast<int>(bundle->models.size())) {
+    GST_WARNING("%s: max_model_limit %d is above max_instances, use %zu", name.c_str(), limit, bundle->models.size());
+    limit = static_cast<int>(bundle->models.size());
+  }
+  if (bundle->isRetired.exchange(false)) {
+    GST_INFO("%s is back in the config", name.c_str());
+  }
+  this->setLimit(bundle, limit);
+}
+
+void ModelPool::setLimit(ModelBundle *bundle, int limit) {
+  std::string name = bundle->modelParam["name"].asString();
+  bool isServed = false;
+  {
+    std::lock_guard<std::mutex> lockNow(this->residencyLock);
+    int oldLimit = bundle->limit.load(std::memory_order_relaxed);
+    if (limit == oldLimit) {
+      return;
+    }
+    GST_INFO("%s instances %d -> %d", name.c_str(), oldLimit, limit);
+    this->scaleFootprint(bundle, oldLimit, limit);
+    bundle->limit.store(limit, std::memory_order_seq_cst);
+
+    //// create the missing instances, a handle still attached is held by a session or waits to be drained
+    if (bundle->isResident.load(std::memory_order_acquire)) {
+      for (int i = oldLimit; i < limit; i++) {
+        if (bundle->models[i]->isAttached()) {
+          continue;
+        }
+        bool isAttached = false;
+        try {
+          isAttached = this->attachInstance(bundle, i);
+        } catch (const std::exception &e) {
+          GST_WARNING("%s: %s", name.c_str(), e.what());
+        }
+        if (isAttached == false) {
+          GST_WARNING("%s keeps %d instances", name.c_str(), i);
+          this->scaleFootprint(bundle, limit, i);
+          bundle->limit.store(i, std::memory_order_seq_cst);
+          break;
+        }
+        bundle->instanceCount++;
+        bundle->pushFree(i);
+        isServed = true;
+      }
+      isServed = this->drainBundle(bundle) || isServed;
+    }
+  }
+  if (isServed) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (bundle->waiterCount.load(std::memory_order_relaxed) > 0) {
+      this->admitWaiters(bundle);
+    }
+  }
+}
+
+void ModelPool::retireBundle(ModelBundle *bundle) {
+  GST_INFO("%s was removed from the config, it is released once its sessions end", bundle->modelParam["name"].asString().c_str());
+  bundle->isRetired.store(true, std::memory_order_seq_cst);
+  this->setLimit(bundle, 0);
+  this->expireWaiters(bundle, std::chrono::steady_clock::time_point::max());
+}
+
+void ModelPool::scaleFootprint(ModelBundle *bundle, int fromLimit, int toLimit) {
+  if (bundle->factory->usesDevice() == false) {
+    return;
+  }
+  //// per device id, proportionally to the instances on it
+  const std::vector<int> &devices = bundle->placement.getDevices();
+  size_t estimate = static_cast<size_t>(std::max(bundle->modelParam.get("vram_mb", 500).asInt(), 0)) << 20;
+  std::map<int, std::pair<int, int>> counts;
+  for (int k = 0; k < std::max(fromLimit, toLimit); k++) {
+    std::pair<int, int> &count = counts[devices[bundle->modelDevices[k]]];
+    count.first += k < fromLimit ? 1 : 0;
+    count.second += k < toLimit ? 1 : 0;
+  }
+  for (auto &[deviceId, count] : counts) {
+    size_t &bytes = bundle->footprint[deviceId];
+    bytes = count.first > 0 ? bytes / count.first * count.second : estimate * count.second;
+  }
+}
+
+bool ModelPool::drainBundle(ModelBundle *bundle) {
+  if (bundle->isResident.load(std::memory_order_acquire) == false) {
+    return false;
+  }
+  int limit = bundle->limit.load(std::memory_order_acquire);
+  std::vector<int> taken;
+  {
+    std::lock_guard<std::mutex> lockNow(bundle->drainLock);
+    taken.swap(bundle->retiredFree);
+  }
+  int idleAbove = 0;
+  for (int i = limit; i < static_cast<int>(bundle->models.size()); i++) {
+    if (bundle->models[i]->isAttached() && bundle->slots[i].owner.load(std::memory_order_acquire) == ModelSlot::FREE) {
+      idleAbove++;
+    }
+  }
+  int takenAbove = static_cast<int>(std::count_if(taken.begin(), taken.end(), [limit](int index) { return index >= limit; }));
+  if (idleAbove > takenAbove) {
+    //// the others are in the free lists, pushed before the limit was lowered: take every free instance out
+    for (size_t device = 0; device < bundle->placement.getDevices().size(); device++) {
+      for (int index = bundle->popFree(static_cast<int>(device)); index >= 0; index = bundle->popFree(static_cast<int>(device))) {
+        taken.push_back(index);
+      }
+    }
+  }
+  if (taken.empty()) {
+    return false;
+  }
+
+  //// put back the instances below the limit, release the others
+  std::string name = bundle->modelParam["name"].asString();
+  bool isServed = false;
+  int released = 0;
+  for (int index : taken) {
+    if (index < limit) {
+      bundle->pushFree(index);
+      isServed = true;
+      continue;
+    }
+    bundle->models[index]->detach();
+    bundle->instanceCount--;
+    released++;
+  }
+  if (released > 0) {
+    GST_INFO("released %d %s instances above the limit of %d", released, name.c_str(), limit);
+  }
+  if (bundle->isRetired.load(std::memory_order_acquire) && bundle->instanceCount == 0) {
+    bundle->isResident.store(false, std::memory_order_release);
+    this->releaseInstances(bundle);
+    GST_INFO("%s drained and unloaded", name.c_str());
+  }
+  return isServed;
+}
+
+void ModelPool::drainBundles() {
+  std::vector<ModelBundle *> served;
+  {
+    std::lock_guard<std::mutex> lockNow(this->residencyLock);
+    for (auto &[_, bundle] : this->getBundles()) {
+      if (this->drainBundle(bundle)) {
+        served.push_back(bundle);
+      }
+    }
+  }
+  for (ModelBundle *bundle : served) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (bundle->waiterCount.load(std::memory_order_relaxed) > 0) {
+      this->admitWaiters(bundle);
+    }
+  }
+}
+
+void ModelPool::runWatcher() {
+  //// editors and config maps replace the file, so its directory is watched for files written or moved into it
+  int inotifyFd = -1;
+  fs::path path(this->configPath);
+  if (this->isWatchingConfig) {
+    std::string dir = path.has_parent_path() ? path.parent_path().string() : ".";
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0 || inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      GST_WARNING("cannot watch %s, reload with reloadConfig", dir.c_str());
+      if (inotifyFd >= 0) {
+        close(inotifyFd);
+      }
+      inotifyFd = -1;
+    }
+  }
+
+  std::unique_lock<std::mutex> lockNow(this->watcherLock);
+  while (true) {
+    this->watcherCond.wait_for(lockNow, std::chrono::seconds(1));
+    if (this->isWatcherStopping) {
+      break;
+    }
+    std::unique_ptr<Json::Value> config = std::move(this->pendingConfig);
+    lockNow.unlock();
+
+    // a burst of writes within the second is read once
+    if (inotifyFd >= 0 && isFileChanged(inotifyFd, path.filename().string()) && config == nullptr) {
+      GST_INFO("%s changed", this->configPath.c_str());
+      config = std::make_unique<Json::Value>();
       try {
-        md = new Yolov7trt(modelPath, deviceId, std::to_string(i));
-        GST_INFO("Finish init %d/%d %s model", i + 1, maxModelLimit, modelParam["name"].asString().c_str());
+        this->readConfig(*config);
       } catch (const std::exception &e) {
-        GST_ERROR("Error init %d/%d %s model", i + 1, maxModelLimit, modelParam["name"].asString().c_str());
-        continue;
+        GST_WARNING("keep the current config: %s", e.what());
+        config.reset();
       }
-      bundle->models.push_back(md);
-      uintptr_t modelAddress = reinterpret_cast<uintptr_t>(md);
-      bundle->isUsed[modelAddress] = false;
-      GST_INFO("Added %d/%d %s model", i + 1, maxModelLimit, modelParam["name"].asString().c_str());
     }
+    if (config != nullptr) {
+      this->applyConfig(*config);
+    }
+    this->drainBundles();
 
-    this->modelBundles[modelParam["name"].asString()] = bundle;
+    lockNow.lock();
+  }
+  lockNow.unlock();
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
   }
+}
 
-  //// set default model
-  if (this->modelBundles.find(this->defaultModelName) == this->modelBundles.end()) {
-    GST_ERROR("default model name not found (%s)", this->defaultModelName.c_str());
-    throw std::runtime_error("default model name not found");
+int ModelPool::checkout(ModelBundle *bundle) {
+  std::vector<int> order;
+  bundle->placement.rank(DeviceInventory::system(), this->deviceLoad, order);
+  for (int device : order) {
+    for (int index = bundle->popFree(device); index >= 0; index = bundle->popFree(device)) {
+      if (index < bundle->limit.load(std::memory_order_acquire)) {
+        return index;
+      }
+      // lowered by a reload, the watcher releases it
+      std::lock_guard<std::mutex> lockNow(bundle->drainLock);
+      bundle->retiredFree.push_back(index);
+    }
   }
+  return -1;
 }
 
-bool ModelPool::updateSession(const std::string &modelName) {
-  if (this->modelExists(modelName) == false) {
-    GST_ERROR("model %s not found", modelName.c_str());
+bool ModelPool::initBatching(ModelBundle *bundle, const Json::Value &modelParam) {
+  std::string name = modelParam["name"].asString();
+  int maxBatch = modelParam.get("max_batch", 1).asInt();
+  int maxWaitUs = std::max(modelParam.get("max_wait_us", 5000).asInt(), 0);
+  for (int deviceId : bundle->placement.getDevices()) {
+    GST_INFO("Init shared %s engine for batching on device %d, max batch %d, max wait %d us", name.c_str(), deviceId, maxBatch,
+             maxWaitUs);
+    if (bundle->factory->usesDevice()) {
+      this->checkVRAM(deviceId, 500000000);
+    }
+
+    Detector *context;
+    try {
+      context = bundle->factory->createBatchEngine(maxBatch, deviceId);
+    } catch (const std::exception &e) {
+      GST_ERROR("Error init shared %s context: %s", name.c_str(), e.what());
+      context = nullptr;
+    }
+    if (context == nullptr) {
+      GST_WARNING("%s cannot batch, fall back to exclusive models", name.c_str());
+      for (BatchScheduler *scheduler : bundle->batchSchedulers) {
+        delete scheduler;
+      }
+      for (Detector *engine : bundle->batchEngines) {
+        delete engine;
+      }
+      bundle->batchSchedulers.clear();
+      bundle->batchEngines.clear();
+      return false;
+    }
+
+    context->setMetrics(bundle->metrics);
+    bundle->batchEngines.push_back(context);
+    bundle->batchSchedulers.push_back(new BatchScheduler(*context, maxBatch, maxWaitUs));
+  }
+  return true;
+}
+
+bool ModelPool::initPlacement(ModelBundle *bundle, const Json::Value &modelParam, int defaultDeviceId) {
+  std::string name = modelParam["name"].asString();
+  std::vector<int> instanceDevices;
+  if (modelParam.isMember("devices")) {
+    for (const Json::Value &device : modelParam["devices"]) {
+      instanceDevices.push_back(device.asInt());
+    }
+  }
+  if (instanceDevices.empty()) {
+    instanceDevices.push_back(defaultDeviceId);
+  }
+
+  int deviceCount = DeviceInventory::system().getDeviceCount();
+  for (int deviceId : instanceDevices) {
+    if (deviceId < 0 || deviceId >= DeviceLoad::maxDevices || (bundle->factory->usesDevice() && deviceId >= deviceCount)) {
+      GST_ERROR("invalid device %d for model %s (%d devices found)", deviceId, name.c_str(), deviceCount);
+      return false;
+    }
+  }
+
+  PlacementPolicy policy;
+  std::string policyName = modelParam.get("placement", "round-robin").asString();
+  if (Placement::parsePolicy(policyName, policy) == false) {
+    GST_ERROR("unknown placement %s for model %s", policyName.c_str(), name.c_str());
+    return false;
+  }
+  bundle->placement.configure(policy, instanceDevices);
+  GST_INFO("%s instances on %d device(s), %s placement", name.c_str(), static_cast<int>(bundle->placement.getDevices().size()),
+           policyName.c_str());
+  return true;
+}
+
+ModelBundle *ModelPool::findBundle(const std::string &modelName) {
+  const BundleMap &bundles = this->getBundles();
+  auto found = bundles.find(modelName);
+  return found == bundles.end() ? nullptr : found->second;
+}
+
+void ModelPool::watchSlot(ModelBundle *bundle, ModelSlot &slot, uint32_t generation, uint64_t owner,
+                          std::function<void()> onExpired) {
+  int slotIndex = static_cast<int>(&slot - bundle->slots.data());
+  std::lock_guard<std::mutex> lockNow(this->reaperLock);
+  this->reaperInbox.push_back(ReaperEntry{bundle, slotIndex, generation, owner, std::move(onExpired)});
+}
+
+void ModelPool::runReaper() {
+  std::vector<ReaperEntry> arrived;
+  uint64_t nextExport = 0;
+  std::unique_lock<std::mutex> lockNow(this->reaperLock);
+  while (this->isStopping == false) {
+    this->reaperCond.wait_for(lockNow, std::chrono::seconds(1));
+    arrived.swap(this->reaperInbox);
+    lockNow.unlock();
+
+    uint64_t now = static_cast<uint64_t>(nowSec());
+    for (ReaperEntry &entry : arrived) {
+      ModelSlot &slot = entry.bundle->slots[entry.slotIndex];
+      uint64_t deadline = slot.heartbeat.load(std::memory_order_relaxed) + entry.bundle->sessionTimeoutSec + 1;
+      this->reaperWheel.schedule(deadline, std::move(entry));
+    }
+    arrived.clear();
+    this->reaperWheel.advance(now, [this](ReaperEntry &entry, uint64_t tick) { this->onTimer(entry, tick); });
+    for (auto &[_, bundle] : this->getBundles()) {
+      int queueTimeoutSec = bundle->queueTimeoutSec.load(std::memory_order_relaxed);
+      if (queueTimeoutSec > 0 && bundle->waiterCount.load(std::memory_order_relaxed) > 0) {
+        this->expireWaiters(bundle, std::chrono::steady_clock::now() - std::chrono::seconds(queueTimeoutSec));
+      }
+    }
+
+    if (this->metricsPath.empty() == false && now >= nextExport) {
+      nextExport = now + this->metricsIntervalSec;
+      if (this->metrics.writePrometheus(this->metricsPath, this->isMetricsPerSession) == false) {
+        GST_WARNING("cannot write metrics to %s", this->metricsPath.c_str());
+      }
+    }
+
+    lockNow.lock();
+  }
+}
+
+void ModelPool::onTimer(ReaperEntry &entry, uint64_t now) {
+  ModelSlot &slot = entry.bundle->slots[entry.slotIndex];
+  if (slot.generation.load(std::memory_order_relaxed) != entry.generation) {
+    return;
+  }
+
+  //// heartbeats only store a timestamp, a live session is re-armed here after its last one
+  uint64_t deadline = slot.heartbeat.load(std::memory_order_relaxed) + entry.bundle->sessionTimeoutSec + 1;
+  if (deadline > now) {
+    this->reaperWheel.schedule(deadline, std::move(entry));
+    return;
+  }
+  if (this->releaseSlot(entry.bundle, &slot, entry.owner) == false) {
+    return;
+  }
+  GST_INFO("release an expired model");
+  entry.bundle->metrics->count(Counter::SESSIONS_REAPED);
+  if (entry.onExpired) {
+    entry.onExpired();
+  }
+}
+
+bool ModelPool::releaseSlot(ModelBundle *bundle, ModelSlot *slot, uint64_t owner) {
+  // only the thread that moves the owner to FREE pushes the slot, so a slot is never in the free list twice
+  if (slot->owner.compare_exchange_strong(owner, ModelSlot::FREE, std::memory_order_acq_rel) == false) {
     return false;
   }
-  ModelBundle *bundle = this->modelBundles[modelName];
-  std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-  std::vector<std::string> toBeDelete;
-  for (const auto &[id, timestamp] : bundle->sessionHeartbeat) {
-    if (now - timestamp > 60) {
-      toBeDelete.push_back(id);
+  this->deviceLoad.add(bundle->placement.getDevices()[slot->device], -1);
+  int index = static_cast<int>(slot - bundle->slots.data());
+  if (index >= bundle->limit.load(std::memory_order_acquire)) {
+    // lowered by a reload, the watcher releases it
+    std::lock_guard<std::mutex> lockNow(bundle->drainLock);
+    bundle->retiredFree.push_back(index);
+    return true;
+  }
+  bundle->pushFree(index);
+  // pairs with the fence after a waiter is queued: either the waiter sees this instance free or this sees the waiter
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (bundle->waiterCount.load(std::memory_order_relaxed) > 0) {
+    this->admitWaiters(bundle);
+  }
+  return true;
+}
+
+Detector *ModelPool::handOut(ModelBundle *bundle, int index) {
+  ModelSlot &slot = bundle->slots[index];
+  uint32_t generation = slot.generation.fetch_add(1, std::memory_order_relaxed) + 1;
+  slot.heartbeat.store(nowSec(), std::memory_order_relaxed);
+  slot.owner.store(ModelSlot::CHECKED_OUT, std::memory_order_release);
+  int deviceId = bundle->placement.getDevices()[slot.device];
+  this->deviceLoad.add(deviceId, 1);
+  GST_INFO("checked out %s instance %d on device %d", bundle->modelParam["name"].asString().c_str(), index, deviceId);
+  // the previous session may have left another input size
+  slot.model->setInputSize(0);
+  // a model that is never registered goes back after the timeout
+  this->watchSlot(bundle, slot, generation, ModelSlot::CHECKED_OUT, nullptr);
+  return slot.model;
+}
+
+void ModelPool::serveWaiters(ModelBundle *bundle, std::vector<Admitted> &admitted, std::vector<AdmissionQueue::Move> &moves) {
+  size_t served = admitted.size();
+  auto now = std::chrono::steady_clock::now();
+  while (bundle->admission.empty() == false) {
+    int index = this->checkout(bundle);
+    if (index < 0) {
+      break;
     }
+    AdmissionQueue::Waiter waiter;
+    bundle->admission.pop(waiter);
+    uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - waiter.since).count();
+    bundle->metrics->record(Stage::QUEUE, waitUs);
+    admitted.push_back(Admitted{std::move(waiter.onAdmitted), this->handOut(bundle, index), waitUs, waiter.ticket});
   }
+  if (admitted.size() > served) {
+    bundle->admission.collectMoves(moves);
+  }
+  bundle->waiterCount.store(static_cast<int>(bundle->admission.size()), std::memory_order_seq_cst);
+}
 
-  for (const std::string &id : toBeDelete) {
-    GST_DEBUG("release expired model resourse %s", id.c_str());
-    bundle->sessionHeartbeat.erase(id);
-    uintptr_t address = reinterpret_cast<uintptr_t>(bundle->sessionToModel[id]);
-    bundle->isUsed[address] = false;
-    bundle->sessionToModel.erase(id);
+void ModelPool::admitWaiters(ModelBundle *bundle) {
+  std::vector<Admitted> admitted;
+  std::vector<AdmissionQueue::Move> moves;
+  {
+    std::lock_guard<std::mutex> lockNow(bundle->admissionLock);
+    this->serveWaiters(bundle, admitted, moves);
+  }
+  this->notifyWaiters(admitted, moves);
+}
+
+void ModelPool::expireWaiters(ModelBundle *bundle, std::chrono::steady_clock::time_point before) {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<AdmissionQueue::Waiter> expired;
+  std::vector<Admitted> admitted;
+  std::vector<AdmissionQueue::Move> moves;
+  {
+    std::lock_guard<std::mutex> lockNow(bundle->admissionLock);
+    bundle->admission.expire(before, expired, moves);
+    bundle->waiterCount.store(static_cast<int>(bundle->admission.size()), std::memory_order_seq_cst);
+  }
+  for (AdmissionQueue::Waiter &waiter : expired) {
+    GST_INFO("a session gave up waiting for a %s model", bundle->modelParam["name"].asString().c_str());
+    uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - waiter.since).count();
+    bundle->metrics->record(Stage::QUEUE, waitUs);
+    admitted.push_back(Admitted{std::move(waiter.onAdmitted), nullptr, waitUs, waiter.ticket});
+  }
+  this->notifyWaiters(admitted, moves);
+}
+
+void ModelPool::notifyWaiters(std::vector<Admitted> &admitted, std::vector<AdmissionQueue::Move> &moves) {
+  for (Admitted &one : admitted) {
+    if (one.onAdmitted) {
+      one.onAdmitted(one.model, one.waitUs);
+    }
+  }
+  for (AdmissionQueue::Move &move : moves) {
+    if (move.onPosition) {
+      move.onPosition(move.position);
+    }
   }
-  return toBeDelete.size() != 0;
 }
 
 void ModelPool::checkVRAM(const int deviceId, const size_t minBytes) {
-  cudaSetDevice(deviceId);
-  size_t freeMem, totalMem;
-  cudaMemGetInfo(&freeMem, &totalMem);
+  size_t freeMem = 0, totalMem = 0;
+  DeviceInventory::system().getMemInfo(deviceId, freeMem, totalMem);
   if (freeMem < minBytes) {
     GST_ERROR("GPU available memory insufficient %zu Bytes (<%zu), please disable or decrease the model number limit in config file",
               freeMem, minBytes);
@@ -1,53 +1,219 @@
-#include "yolov7.hpp"
-
+#include "AdmissionQueue.hpp"
+#include "BatchScheduler.hpp"
+#include "Detector.hpp"
+#include "DetectorFactory.hpp"
+#include "Metrics.hpp"
+#include "Placement.hpp"
+#include "Residency.hpp"
+#include "TimerWheel.hpp"
 #include "utils.hpp"
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <gst/gst.h>
 #include <json/json.h>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace fs = std::filesystem;
 namespace kurento {
 namespace module {
 namespace objdet {
 
+/// @brief checkout state of one model instance
+struct ModelSlot {
+  /// @brief owner is FREE in the free list, CHECKED_OUT until a session registers, otherwise the session key
+  static const uint64_t FREE = 0;
+  static const uint64_t CHECKED_OUT = 1;
+
+  Detector *model = nullptr;
+  std::atomic<uint64_t> owner{FREE};
+
+  /// @brief last heartbeat, in steady clock seconds
+  std::atomic<int64_t> heartbeat{0};
+
+  /// @brief bumped on every checkout and registration, so the reaper can drop timers of earlier owners
+  std::atomic<uint32_t> generation{0};
+
+  /// @brief free list link, index + 1 of the next free slot, 0 at the end
+  std::atomic<uint32_t> next{0};
+
+  /// @brief index into the bundle placement's devices
+  int device = 0;
+};
+
 class ModelBundle {
 public:
-  /// @brief all models 
-  std::vector<Yolov7trt *> models;
+  /// @brief the backend the instances are created on
+  std::unique_ptr<DetectorFactory> factory;
+
+  /// @brief one handle per possible instance up to max_instances, the instances behind the first limit handles exist while
+  /// the bundle is resident
+  std::vector<ResidentDetector *> models;
+
+  /// @brief instances to keep, a reload raises it up to the number of handles or lowers it to drain the ones above
+  std::atomic<int> limit{0};
+
+  /// @brief removed from the config: no new sessions, its instances are released once its sessions end
+  std::atomic<bool> isRetired{false};
+
+  /// @brief free instances at or above the limit that a checkout took out of the free lists, guarded by drainLock
+  std::vector<int> retiredFree;
+  std::mutex drainLock;
+
+  /// @brief device index of every model, parallel to models
+  std::vector<int> modelDevices;
+
+  /// @brief handles with an instance, all of them are in the free lists while no session holds one
+  int instanceCount = 0;
+
+  /// @brief the devices of the instances and how checkouts pick one
+  Placement placement;
+
+  /// @brief the contexts shared by the session handles, one per device, empty when not batching
+  std::vector<Detector *> batchEngines;
+
+  /// @brief the schedulers forming batches on batchEngines, empty when not batching
+  std::vector<BatchScheduler *> batchSchedulers;
+
+  /// @brief sessions silent for longer than this lose their model
+  std::atomic<int> sessionTimeoutSec{60};
+
+  /// @brief sessions allowed to wait for an instance, 0 to fail right away when all instances are taken
+  std::atomic<int> maxQueue{0};
+
+  /// @brief a session waiting for longer than this gives up, 0 to wait until it leaves the queue
+  std::atomic<int> queueTimeoutSec{0};
+
+  /// @brief sessions waiting for an instance, guarded by admissionLock
+  AdmissionQueue admission;
+  std::mutex admissionLock;
+
+  /// @brief length of the admission queue, read without the lock by checkouts and releases
+  std::atomic<int> waiterCount{0};
 
-  /// @brief the usage state of models 
-  std::map<uintptr_t, bool> isUsed;
+  /// @brief the model entry of the config file, the instances are created from it
+  Json::Value modelParam;
 
-  /// @brief to recycle a model not used for a period of time
-  std::map<std::string, std::time_t> sessionHeartbeat;
+  /// @brief whether the instances exist, changed under the pool residency lock
+  std::atomic<bool> isResident{false};
 
-  /// @brief session-dedicated model map
-  std::map<std::string, Yolov7trt *> sessionToModel;
+  /// @brief never unloaded to make room for another model, changed under the pool residency lock
+  bool isPinned = false;
+
+  /// @brief device memory per device id, estimated until the bundle has been loaded once
+  std::vector<size_t> footprint;
+
+  /// @brief last checkout or return, in steady clock seconds
+  std::atomic<int64_t> lastUse{0};
+
+  /// @brief the model's stage latencies and counters, owned by the pool metrics
+  StageMetrics *metrics = nullptr;
+
+  /// @brief one slot per model, fixed once the bundle is published
+  std::vector<ModelSlot> slots;
+
+  /// @brief model to slot index, fixed once the bundle is published
+  std::unordered_map<const Detector *, int> slotIndex;
+
+  /// @brief build the slots of all handles, empty free lists
+  void initSlots();
+
+  /// @brief slot of a model, nullptr if the model is not in this bundle
+  ModelSlot *findSlot(const Detector *model);
+
+  /// @brief push a slot to the free list of its device, the caller must have moved its owner to FREE
+  void pushFree(int index);
+
+  /// @brief pop a free slot of a device, -1 if none is free
+  int popFree(int device);
+
+  /// @brief number of slots in the free lists
+  int getFreeCount() const { return this->freeCount.load(std::memory_order_relaxed); }
 
   ~ModelBundle();
+
+private:
+  /// @brief Treiber stack, the head's low 32 bits are index + 1 of the top slot, high 32 bits an ABA tag
+  struct FreeList {
+    std::atomic<uint64_t> head{0};
+  };
+
+  /// @brief one free list per device of the placement
+  std::unique_ptr<FreeList[]> freeLists;
+  std::atomic<int> freeCount{0};
 };
 
+/**
+ * @brief model instances shared by all sessions
+ *
+ * The bundle map is only replaced as a whole, by the constructor and by config reloads, and bundles are never removed
+ * from it, so lookups take no lock. Checkout goes through a
+ * lock-free free list per bundle and a session owns its slot through an atomic key, so heartbeats and session checks of
+ * different sessions never contend. A heartbeat is a single atomic store; a reaper thread finds expired sessions with a
+ * timer wheel and re-arms timers of live sessions lazily when they come due.
+ *
+ * A model may have instances on several devices, each device with its own free list; the placement policy of the model
+ * orders the devices a checkout tries.
+ *
+ * The models are loaded on one thread each. A lazy model is only registered at startup and loaded by its first use.
+ * With a VRAM budget, loading a model first unloads the least recently used idle models until it fits; sessions hold
+ * stable handles, so unloading and loading again only swaps the instances behind them.
+ *
+ * A config reload runs on a watcher thread: it adds models, raises or lowers the number of instances of a model and
+ * retires removed models. Checked-out instances are never touched, instances above a lowered limit and the instances of
+ * retired models are released once their sessions return them.
+ */
 class ModelPool {
 public:
+  /// @brief load the models of the config file given by OBJDET_CONFIG
   ModelPool();
+
+  /// @brief load the models of an already parsed config
+  explicit ModelPool(const Json::Value &config);
+
   /// @brief get current unused models
   int getAvailableCount(const std::string &modelName);
 
   /// @brief test if specific type of model has available instances
   bool isAvailable(const std::string &modelName);
 
-  /// @brief get a model by model name
-  Yolov7trt *getModel(const std::string &modelName);
+  /// @brief get a model by model name, nullptr if none is free or sessions are waiting for one
+  Detector *getModel(const std::string &modelName);
+
+  /// @brief a ticket for getModelOrWait, known to the caller before its callbacks can run
+  uint64_t newTicket() { return this->nextTicket.fetch_add(1, std::memory_order_relaxed); }
+
+  /**
+   * @brief get a model, or wait in the model's admission queue if all of its instances are taken
+   *
+   * A returned instance goes straight to the head of the queue instead of the free list.
+   *
+   * @param priority higher is served first, the same priority in arrival order
+   * @param ticket from newTicket, identifies the wait in the callbacks and in cancelWait
+   * @param onAdmitted called once the wait is over, on the thread that returned the instance or on the reaper thread
+   * @param onPosition called when sessions ahead leave the queue
+   * @param position 1-based queue position if queued, 0 otherwise
+   * @return the model if one was free, nullptr if queued or if the model cannot be served (position 0)
+   */
+  Detector *getModelOrWait(const std::string &modelName, int priority, uint64_t ticket, AdmissionQueue::AdmittedCallback onAdmitted,
+                           AdmissionQueue::PositionCallback onPosition, int &position);
+
+  /// @brief leave an admission queue, false if the wait is already over or the ticket unknown
+  bool cancelWait(const std::string &modelName, uint64_t ticket);
 
   /// @brief get default model name
   std::string getDefaultModelName();
 
   /// @brief destroy a session and mark the model as available
-  void returnModel(const std::string &modelName, Yolov7trt *model, const std::string &sessionId);
+  void returnModel(const std::string &modelName, Detector *model, const std::string &sessionId);
 
   /// @brief get all model names
   void getModelNames(std::vector<std::string> &names);
@@ -55,32 +221,200 @@ public:
   /// @brief test if a model name exists
   bool modelExists(const std::string &modelName);
 
-  /// @brief bind a model to a session and mark the model occupied
-  void registerSession(const std::string &modelName, Yolov7trt *model, const std::string &sessionId);
+  /**
+   * @brief bind a model to a session and mark the model occupied
+   *
+   * @param onExpired called on the reaper thread if the session times out and loses the model, must not block
+   */
+  void registerSession(const std::string &modelName, Detector *model, const std::string &sessionId,
+                       std::function<void()> onExpired = nullptr);
 
   /// @brief heartbeat for a session
-  void heartbeat(const std::string &modelName, std::string sessionId);
+  void heartbeat(const std::string &modelName, Detector *model, const std::string &sessionId);
+
+  /// @brief test if a session still owns its model, releases the model if the session timed out
+  bool sessionExists(const std::string &modelName, Detector *model, const std::string &sessionId);
+
+  /// @brief the metrics of all models and sessions
+  Metrics &getMetrics() { return this->metrics; }
+
+  /// @brief the metrics of a model, nullptr if the model does not exist
+  StageMetrics *getModelMetrics(const std::string &modelName);
 
-  /// @brief test if a session exists
-  bool sessionExists(const std::string &modelName, std::string sessionId);
+  /// @brief read the config file again and apply it in the background, false if it cannot be read or the pool was not
+  /// loaded from a file
+  bool requestReload();
 
   ~ModelPool();
 
 private:
-  /// @brief all models keyed by model name
-  std::map<std::string, ModelBundle *> modelBundles;
+  using BundleMap = std::map<std::string, ModelBundle *>;
+
+  /// @brief all models keyed by model name, retired ones included, replaced as a whole by a reload
+  std::atomic<const BundleMap *> modelBundles{nullptr};
+
+  /// @brief every map published, a lookup may still be reading an earlier one
+  std::vector<std::unique_ptr<BundleMap>> bundleMaps;
 
-  std::recursive_mutex lock;
   std::string defaultModelName;
 
+  /// @brief device memory allowed per device for all resident models, 0 for no limit
+  size_t vramBudget = 0;
+
+  /// @brief serializes loading and unloading, checkouts of resident models do not take it
+  std::mutex residencyLock;
+
+  /// @brief checked-out instances per device over all bundles
+  DeviceLoad deviceLoad;
+
+  Metrics metrics;
+
+  //// Prometheus textfile export, written by the reaper thread, no export if the path is empty
+  std::string metricsPath;
+  int metricsIntervalSec = 10;
+  bool isMetricsPerSession = false;
+
+  /// @brief next admission queue ticket, 0 is never used
+  std::atomic<uint64_t> nextTicket{1};
+
+  /// @brief a waiter whose wait is over, notified once the admission lock is released
+  struct Admitted {
+    AdmissionQueue::AdmittedCallback onAdmitted;
+    Detector *model;
+    uint64_t waitUs;
+    uint64_t ticket;
+  };
+
+  /// @brief a session timer, stale once the slot generation moved on
+  struct ReaperEntry {
+    ModelBundle *bundle;
+    int slotIndex;
+    uint32_t generation;
+    uint64_t owner;
+    std::function<void()> onExpired;
+  };
+
+  //// reaper thread, the wheel is only touched by it and new timers go through the inbox
+  std::thread reaper;
+  std::mutex reaperLock;
+  std::condition_variable reaperCond;
+  std::vector<ReaperEntry> reaperInbox;
+  bool isStopping = false;
+  TimerWheel<ReaperEntry> reaperWheel;
+
+  //// config reload, applied by the watcher thread, which also drains instances above their limit
+  std::string configPath;
+  bool isWatchingConfig = false;
+  Json::Value appliedConfig;
+  std::thread watcher;
+  std::mutex watcherLock;
+  std::condition_variable watcherCond;
+  std::unique_ptr<Json::Value> pendingConfig;
+  bool isWatcherStopping = false;
+
+  /// @brief the current bundle map
+  const BundleMap &getBundles() const { return *this->modelBundles.load(std::memory_order_acquire); }
+
+  /// @brief publish a new bundle map, only one thread at a time
+  void publishBundles(const BundleMap &bundles);
+
+  /// @brief the bundle of a model name, nullptr if not found
+  ModelBundle *findBundle(const std::string &modelName);
+
   /// @brief read JSON format config file from environment parameter
   void readConfig(Json::Value &config);
 
   /// @brief init model
   void initModels(const Json::Value &config);
 
-  /// @brief destroy timeout sessions and mark the models available 
-  bool updateSession(const std::string &modelName);
+  /// @brief register a model entry and the handles of its instances, throws if the model file is missing, nullptr if the
+  /// backend or the devices are invalid
+  ModelBundle *createBundle(const Json::Value &modelParam, int defaultDeviceId);
+
+  /// @brief create the instance behind a handle, throws if its device runs out of memory, the caller holds residencyLock
+  bool attachInstance(ModelBundle *bundle, int index);
+
+  /// @brief add, resize and retire models to match a reloaded config
+  void applyConfig(const Json::Value &config);
+
+  /// @brief apply the live parameters and the instance count of a model entry to an existing bundle
+  void resizeBundle(ModelBundle *bundle, const Json::Value &modelParam);
+
+  /// @brief change the number of instances, new ones are created at once and the ones above the limit drained
+  void setLimit(ModelBundle *bundle, int limit);
+
+  /// @brief stop serving a model removed from the config, its waiters get nothing
+  void retireBundle(ModelBundle *bundle);
+
+  /// @brief scale the footprint estimate to another number of instances, the caller holds residencyLock
+  void scaleFootprint(ModelBundle *bundle, int fromLimit, int toLimit);
+
+  /**
+   * @brief release the idle instances at or above the limit and put back the ones below it, the caller holds residencyLock
+   *
+   * @return true if instances went back to the free lists, the caller then serves the waiters
+   */
+  bool drainBundle(ModelBundle *bundle);
+
+  /// @brief drain every resident bundle and serve the waiters of those that got instances back
+  void drainBundles();
+
+  /// @brief watcher thread loop, applies requested and changed configs and drains bundles once per second
+  void runWatcher();
+
+  /// @brief create the instances of a bundle behind its handles and measure its footprint, throws if a device runs out of memory
+  void loadBundle(ModelBundle *bundle);
+
+  /// @brief put the created instances in the free lists and mark the bundle resident, false if none was created
+  bool publishBundle(ModelBundle *bundle);
+
+  /// @brief delete the instances and whatever they shared, the handles and slots stay
+  void releaseInstances(ModelBundle *bundle);
+
+  /// @brief unload a bundle if no session holds one of its instances, the caller holds residencyLock
+  bool unloadBundle(ModelBundle *bundle);
+
+  /// @brief unload idle bundles until another one fits the budget, the caller holds residencyLock
+  bool makeRoom(ModelBundle *bundle);
+
+  /// @brief load a bundle that is not resident, false if it does not fit the budget or no instance could be created
+  bool ensureResident(ModelBundle *bundle);
+
+  /// @brief pop a free instance in the device order of the placement, -1 if none is free
+  int checkout(ModelBundle *bundle);
+
+  /// @brief mark a popped instance checked out and watch it until a session registers
+  Detector *handOut(ModelBundle *bundle, int index);
+
+  /// @brief hand free instances to the head waiters, the caller holds the bundle's admissionLock
+  void serveWaiters(ModelBundle *bundle, std::vector<Admitted> &admitted, std::vector<AdmissionQueue::Move> &moves);
+
+  /// @brief hand free instances to the head waiters and notify them
+  void admitWaiters(ModelBundle *bundle);
+
+  /// @brief drop the waiters of a bundle queued before a time and notify them
+  void expireWaiters(ModelBundle *bundle, std::chrono::steady_clock::time_point before);
+
+  /// @brief call the waiter callbacks, without any pool lock held
+  void notifyWaiters(std::vector<Admitted> &admitted, std::vector<AdmissionQueue::Move> &moves);
+
+  /// @brief init one batching instance and its scheduler per device, returns false if the backend cannot batch
+  bool initBatching(ModelBundle *bundle, const Json::Value &modelParam);
+
+  /// @brief read the devices and the placement policy of a model entry, returns false if they are invalid
+  bool initPlacement(ModelBundle *bundle, const Json::Value &modelParam, int defaultDeviceId);
+
+  /// @brief arm the expiry timer of a slot for its current owner
+  void watchSlot(ModelBundle *bundle, ModelSlot &slot, uint32_t generation, uint64_t owner, std::function<void()> onExpired);
+
+  /// @brief reaper thread loop, advances the wheel and writes the metrics file once per second at most
+  void runReaper();
+
+  /// @brief a timer came due, release the slot or re-arm it after the last heartbeat
+  void onTimer(ReaperEntry &entry, uint64_t now);
+
+  /// @brief release a slot if it is still owned by the given key, returns false if someone else got it first
+  bool releaseSlot(ModelBundle *bundle, ModelSlot *slot, uint64_t owner);
 
   /// @brief check GPU available memory
   void checkVRAM(const int deviceId, const size_t minBytes);
@@ -0,0 +1,122 @@
+#include "MotionGate.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief samples per cell along each axis
+static const int cellSamples = 4;
+
+/// @brief a cell changes when its luma moves by more than this, well above the averaged sensor noise
+static const uint8_t changeThresh = 12;
+
+void MotionGate::configure(float threshold, int refreshMsec) {
+  this->threshold = threshold;
+  this->refreshMsec = refreshMsec;
+  this->hitCount = 0;
+  this->missCount = 0;
+  this->reset();
+}
+
+bool MotionGate::isStatic(const cv::Mat &mat, int64_t nowMs) {
+  this->buildPlane(mat);
+
+  bool isPassing = this->isReferenceValid == false || nowMs - this->lastPassMs >= this->refreshMsec;
+  if (isPassing == false) {
+    int size = static_cast<int>(this->plane.size());
+    int changed = countChanged(this->plane.data(), this->reference.data(), size, changeThresh);
+    isPassing = changed > this->threshold * size;
+  }
+
+  if (isPassing == false) {
+    this->hitCount++;
+    return true;
+  }
+  this->reference.swap(this->plane);
+  this->isReferenceValid = true;
+  this->lastPassMs = nowMs;
+  this->missCount++;
+  return false;
+}
+
+int MotionGate::countChanged(const uint8_t *a, const uint8_t *b, int size, uint8_t pixelThresh) {
+  int changed = 0;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i thresh = _mm_set1_epi8(static_cast<char>(pixelThresh));
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= size; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    // zero where the difference is within the threshold
+    __m128i over = _mm_subs_epu8(diff, thresh);
+    int within = _mm_movemask_epi8(_mm_cmpeq_epi8(over, zero));
+    changed += 16 - __builtin_popcount(static_cast<unsigned int>(within));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t thresh = vdupq_n_u8(pixelThresh);
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+    changed += vaddvq_u8(vshrq_n_u8(vcgtq_u8(diff, thresh), 7));
+  }
+#endif
+  for (; i < size; i++) {
+    int diff = static_cast<int>(a[i]) - static_cast<int>(b[i]);
+    changed += (diff > pixelThresh || -diff > pixelThresh) ? 1 : 0;
+  }
+  return changed;
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void MotionGate::buildPlane(const cv::Mat &mat) {
+  int channels = mat.channels();
+  if (mat.size() != this->srcSize || channels != this->srcChannels) {
+    //// a new frame layout: the plane keeps the aspect ratio, the reference is stale
+    this->srcSize = mat.size();
+    this->srcChannels = channels;
+    this->planeHeight = std::max(1, (planeWidth * mat.rows + mat.cols / 2) / std::max(mat.cols, 1));
+    this->sampleX.resize(planeWidth * cellSamples);
+    for (int i = 0; i < planeWidth * cellSamples; i++) {
+      this->sampleX[i] = std::min((2 * i + 1) * mat.cols / (2 * planeWidth * cellSamples), mat.cols - 1) * channels;
+    }
+    this->sampleY.resize(this->planeHeight * cellSamples);
+    for (int i = 0; i < this->planeHeight * cellSamples; i++) {
+      this->sampleY[i] = std::min((2 * i + 1) * mat.rows / (2 * this->planeHeight * cellSamples), mat.rows - 1);
+    }
+    this->plane.assign(static_cast<size_t>(planeWidth) * this->planeHeight, 0);
+    this->reference.assign(this->plane.size(), 0);
+    this->isReferenceValid = false;
+  }
+
+  //// BT.601 luma for BGR(A), averaged over the samples of each cell
+  int sums[planeWidth];
+  for (int cy = 0; cy < this->planeHeight; cy++) {
+    std::fill(sums, sums + planeWidth, 0);
+    for (int sy = 0; sy < cellSamples; sy++) {
+      const uint8_t *row = mat.ptr<uint8_t>(this->sampleY[cy * cellSamples + sy]);
+      for (int i = 0; i < planeWidth * cellSamples; i++) {
+        const uint8_t *px = row + this->sampleX[i];
+        sums[i / cellSamples] += 29 * px[0] + 150 * px[1] + 77 * px[2];
+      }
+    }
+    uint8_t *dst = this->plane.data() + static_cast<size_t>(cy) * planeWidth;
+    for (int cx = 0; cx < planeWidth; cx++) {
+      dst[cx] = static_cast<uint8_t>(sums[cx] / (256 * cellSamples * cellSamples));
+    }
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief decides whether a frame changed enough since the last inferred one to be worth inferring
+ *
+ * Frames are reduced to a small luma plane (block averages of a few samples per cell, which also smooths the sensor
+ * noise) and compared with the plane of the last frame that passed the gate. Comparing with that frame rather than
+ * the previous one lets slow changes add up until they pass.
+ */
+class MotionGate {
+public:
+  /// @brief cells of the luma plane per row, a multiple of 16 for the SIMD compare
+  static const int planeWidth = 64;
+
+  /**
+   * @brief change the settings, the next frame passes
+   *
+   * @param threshold fraction of cells that must change for a frame to pass
+   * @param refreshMsec a frame passes at least this often, even without motion
+   */
+  void configure(float threshold, int refreshMsec);
+
+  /// @brief let the next frame pass
+  void reset() { this->isReferenceValid = false; }
+
+  /**
+   * @brief check a frame, a frame that passes becomes the new reference
+   *
+   * @param mat 8-bit 3 or 4 channel frame
+   * @param nowMs monotonic time in milliseconds
+   * @return true if the frame is static and its inference can be skipped
+   */
+  bool isStatic(const cv::Mat &mat, int64_t nowMs);
+
+  /// @brief frames skipped since configure
+  uint64_t getHitCount() const { return this->hitCount; }
+
+  /// @brief frames passed since configure
+  uint64_t getMissCount() const { return this->missCount; }
+
+  /// @brief number of cells differing by more than pixelThresh, exposed for the SIMD paths
+  static int countChanged(const uint8_t *a, const uint8_t *b, int size, uint8_t pixelThresh);
+
+private:
+  float threshold = 0.005f;
+  int refreshMsec = 5000;
+  bool isReferenceValid = false;
+  int64_t lastPassMs = 0;
+  uint64_t hitCount = 0;
+  uint64_t missCount = 0;
+  cv::Size srcSize;
+  int srcChannels = 0;
+  int planeHeight = 0;
+  std::vector<uint8_t> plane;
+  std::vector<uint8_t> reference;
+
+  //// byte offsets of the sampled columns and indices of the sampled rows, rebuilt when the frame size changes
+  std::vector<int> sampleX;
+  std::vector<int> sampleY;
+
+  void buildPlane(const cv::Mat &mat);
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,170 @@
+#include "OverlayRenderer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief pixels around a label that its glyphs may reach outside of the background
+static const int spritePad = 2;
+
+/// @brief utils::drawObjs fills label backgrounds green whatever the box color is
+static const cv::Scalar labelBackground(0, 255, 0);
+
+/// @brief cv::rectangle with thickness 2 covers one pixel on each side of the box edge
+static const int edgeHalfWidth = 1;
+
+OverlayRenderer::OverlayRenderer(double fontScale, const cv::Scalar &boxColor, const cv::Scalar &textColor)
+    : fontScale(fontScale), boxColor(boxColor), textColor(textColor) {}
+
+void OverlayRenderer::draw(cv::Mat &mat, const std::vector<utils::Obj> &objs) {
+  if (mat.depth() != CV_8U) {
+    utils::drawObjs(mat, mat, objs, false, static_cast<float>(this->fontScale), this->boxColor);
+    return;
+  }
+  this->prepare(mat);
+  for (const utils::Obj &obj : objs) {
+    int x1 = obj.p1.x - edgeHalfWidth;
+    int y1 = obj.p1.y - edgeHalfWidth;
+    int x2 = obj.p2.x + edgeHalfWidth + 1;
+    int y2 = obj.p2.y + edgeHalfWidth + 1;
+    int band = 2 * edgeHalfWidth + 1;
+    this->fillRect(mat, x1, y1, x2, y1 + band);
+    this->fillRect(mat, x1, y2 - band, x2, y2);
+    this->fillRect(mat, x1, y1 + band, x1 + band, y2 - band);
+    this->fillRect(mat, x2 - band, y1 + band, x2, y2 - band);
+
+    const Sprite &sprite = this->getSprite(obj);
+    blit(mat, sprite, obj.p1 + sprite.offset);
+  }
+}
+
+void OverlayRenderer::fillSpan(uint8_t *dst, int count, int channels, const uint8_t *pattern) {
+  int bytes = count * channels;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+  const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 16));
+  const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 32));
+  for (; i + 48 <= bytes; i += 48) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), p0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 16), p1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 32), p2);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t p0 = vld1q_u8(pattern);
+  const uint8x16_t p1 = vld1q_u8(pattern + 16);
+  const uint8x16_t p2 = vld1q_u8(pattern + 32);
+  for (; i + 48 <= bytes; i += 48) {
+    vst1q_u8(dst + i, p0);
+    vst1q_u8(dst + i + 16, p1);
+    vst1q_u8(dst + i + 32, p2);
+  }
+#endif
+  for (; i < bytes; i += 48) {
+    std::memcpy(dst + i, pattern, std::min(48, bytes - i));
+  }
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+const OverlayRenderer::Sprite &OverlayRenderer::getSprite(const utils::Obj &obj) {
+  // the confidence as utils::drawObjs prints it (std::fixed, precision 2 is "%.2f" of the value as double)
+  char confidence[32];
+  std::snprintf(confidence, sizeof(confidence), "%.2f", static_cast<double>(obj.confi));
+  int bucket = std::min(std::max(static_cast<int>(std::lround(std::strtod(confidence, nullptr) * 100)), 0), 100);
+  uint32_t key = (static_cast<uint32_t>(obj.classIdx) << 8) | static_cast<uint32_t>(bucket);
+  auto found = this->sprites.find(key);
+  if (found != this->sprites.end()) {
+    return found->second;
+  }
+  if (this->sprites.size() >= maxSprites) {
+    this->sprites.clear();
+  }
+
+  //// the label of utils::drawObjs: background below the box corner, text on it, glyphs may stick out
+  char label[64];
+  std::snprintf(label, sizeof(label), "%s-%s", obj.name, confidence);
+  int baseLine = 0;
+  cv::Size labelSize = cv::getTextSize(label, cv::FONT_HERSHEY_SIMPLEX, this->fontScale, 1, &baseLine);
+
+  Sprite &sprite = this->sprites[key];
+  cv::Size spriteSize(labelSize.width + 2 * spritePad, labelSize.height + baseLine + 2 * spritePad);
+  sprite.color = cv::Mat::zeros(spriteSize.height, spriteSize.width, this->frameType);
+  sprite.alpha = cv::Mat::zeros(spriteSize.height, spriteSize.width, CV_8UC1);
+  cv::Rect background(spritePad, spritePad, labelSize.width, labelSize.height + baseLine);
+  cv::rectangle(sprite.color, background, labelBackground, -1);
+  cv::rectangle(sprite.alpha, background, cv::Scalar(255), -1);
+  // the background starts one row below the box corner, the text baseline is labelSize.height below the corner
+  cv::Point origin(spritePad, spritePad - 1 + labelSize.height);
+  cv::putText(sprite.color, label, origin, cv::FONT_HERSHEY_SIMPLEX, this->fontScale, this->textColor, 1);
+  cv::putText(sprite.alpha, label, origin, cv::FONT_HERSHEY_SIMPLEX, this->fontScale, cv::Scalar(255), 1);
+  sprite.offset = cv::Point(-spritePad, 1 - spritePad);
+  return sprite;
+}
+
+void OverlayRenderer::prepare(const cv::Mat &mat) {
+  if (mat.type() == this->frameType) {
+    return;
+  }
+  this->frameType = mat.type();
+  this->sprites.clear();
+  int channels = mat.channels();
+  for (int i = 0; i < 48; i++) {
+    this->boxPattern[i] = cv::saturate_cast<uint8_t>(this->boxColor[std::min(i % channels, 3)]);
+  }
+}
+
+void OverlayRenderer::fillRect(cv::Mat &mat, int x1, int y1, int x2, int y2) {
+  x1 = std::max(x1, 0);
+  y1 = std::max(y1, 0);
+  x2 = std::min(x2, mat.cols);
+  y2 = std::min(y2, mat.rows);
+  if (x2 <= x1 || y2 <= y1) {
+    return;
+  }
+  int channels = mat.channels();
+  for (int y = y1; y < y2; y++) {
+    fillSpan(mat.ptr<uint8_t>(y) + x1 * channels, x2 - x1, channels, this->boxPattern);
+  }
+}
+
+void OverlayRenderer::blit(cv::Mat &mat, const Sprite &sprite, const cv::Point &at) {
+  int left = std::max(-at.x, 0);
+  int top = std::max(-at.y, 0);
+  int right = std::min(sprite.alpha.cols, mat.cols - at.x);
+  int bottom = std::min(sprite.alpha.rows, mat.rows - at.y);
+  int channels = mat.channels();
+  for (int y = top; y < bottom; y++) {
+    const uint8_t *alpha = sprite.alpha.ptr<uint8_t>(y);
+    const uint8_t *src = sprite.color.ptr<uint8_t>(y);
+    uint8_t *dst = mat.ptr<uint8_t>(at.y + y) + at.x * channels;
+    for (int x = left; x < right; x++) {
+      int a = alpha[x];
+      if (a == 255) {
+        std::memcpy(dst + x * channels, src + x * channels, channels);
+      } else if (a != 0) {
+        for (int c = 0; c < channels; c++) {
+          uint8_t &value = dst[x * channels + c];
+          value = static_cast<uint8_t>((src[x * channels + c] * a + value * (255 - a) + 127) / 255);
+        }
+      }
+    }
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
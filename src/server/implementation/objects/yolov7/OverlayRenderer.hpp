@@ -0,0 +1,80 @@
+#pragma once
+#include "utils.hpp"
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief draws boxes and labels like utils::drawObjs, without rasterizing text on every frame
+ *
+ * A label only depends on the class and the confidence printed with 2 decimals, so it is rendered once into a sprite (the
+ * label in the frame pixel format and its coverage mask) and alpha-blitted afterwards. Box edges are spans of one color,
+ * filled 16 bytes at a time.
+ */
+class OverlayRenderer {
+public:
+  /**
+   * @param fontScale Hershey simplex font scale of the labels
+   * @param boxColor color of the boxes, label backgrounds stay green as in utils::drawObjs
+   * @param textColor color of the label text
+   */
+  OverlayRenderer(double fontScale = 0.4, const cv::Scalar &boxColor = cv::Scalar(0, 255, 0),
+                  const cv::Scalar &textColor = cv::Scalar(0, 0, 0));
+
+  /// @brief draw the objects on a frame in place, in order, each box before its label
+  void draw(cv::Mat &mat, const std::vector<utils::Obj> &objs);
+
+  /// @brief cached label sprites
+  size_t getSpriteCount() const { return this->sprites.size(); }
+
+  /**
+   * @brief fill a row span with one pixel value
+   *
+   * @param dst first pixel of the span
+   * @param count pixels
+   * @param pattern the pixel value repeated over 48 bytes (16 pixels of 3 bytes, 12 of 4 or 48 of 1)
+   */
+  static void fillSpan(uint8_t *dst, int count, int channels, const uint8_t *pattern);
+
+private:
+  /// @brief a rendered label, placed relative to the top-left corner of its box
+  struct Sprite {
+    cv::Mat color;
+    cv::Mat alpha;
+    cv::Point offset;
+  };
+
+  /// @brief sprites are dropped all at once above this, a scene rarely needs more than a few dozen
+  static const size_t maxSprites = 1024;
+
+  double fontScale;
+  cv::Scalar boxColor;
+  cv::Scalar textColor;
+
+  //// frame layout the sprites and the box pattern were made for
+  int frameType = -1;
+  uint8_t boxPattern[48];
+
+  std::unordered_map<uint32_t, Sprite> sprites;
+
+  /// @brief the sprite of a label, rendered on first use
+  const Sprite &getSprite(const utils::Obj &obj);
+
+  /// @brief the label sprite and box pattern are invalid when the frame layout changes
+  void prepare(const cv::Mat &mat);
+
+  /// @brief fill a rectangle clipped to the frame
+  void fillRect(cv::Mat &mat, int x1, int y1, int x2, int y2);
+
+  /// @brief blend a sprite onto the frame at a position, clipped to the frame
+  static void blit(cv::Mat &mat, const Sprite &sprite, const cv::Point &at);
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
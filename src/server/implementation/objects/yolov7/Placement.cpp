@@ -0,0 +1,68 @@
+#include "Placement.hpp"
+#include <algorithm>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+bool Placement::parsePolicy(const std::string &name, PlacementPolicy &policy) {
+  if (name == "round-robin") {
+    policy = PlacementPolicy::ROUND_ROBIN;
+  } else if (name == "least-loaded") {
+    policy = PlacementPolicy::LEAST_LOADED;
+  } else if (name == "memory-aware") {
+    policy = PlacementPolicy::MEMORY_AWARE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void Placement::configure(PlacementPolicy policy, const std::vector<int> &instanceDevices) {
+  this->policy = policy;
+  this->devices.clear();
+  this->instanceDevices.clear();
+  for (int deviceId : instanceDevices) {
+    auto found = std::find(this->devices.begin(), this->devices.end(), deviceId);
+    if (found == this->devices.end()) {
+      this->devices.push_back(deviceId);
+      found = this->devices.end() - 1;
+    }
+    this->instanceDevices.push_back(static_cast<int>(found - this->devices.begin()));
+  }
+  if (this->devices.empty()) {
+    this->devices.push_back(0);
+    this->instanceDevices.push_back(0);
+  }
+}
+
+void Placement::rank(DeviceInventory &inventory, const DeviceLoad &load, std::vector<int> &order) {
+  int count = static_cast<int>(this->devices.size());
+  int start = static_cast<int>(this->cursor.fetch_add(1, std::memory_order_relaxed) % count);
+  order.resize(count);
+  for (int i = 0; i < count; i++) {
+    order[i] = (start + i) % count;
+  }
+  if (this->policy == PlacementPolicy::ROUND_ROBIN || count == 1) {
+    return;
+  }
+
+  //// the rotation above breaks ties, so equal devices still share the checkouts
+  std::vector<int64_t> keys(count);
+  for (int i = 0; i < count; i++) {
+    int deviceId = this->devices[i];
+    if (this->policy == PlacementPolicy::LEAST_LOADED) {
+      keys[i] = load.get(deviceId);
+    } else {
+      size_t freeBytes = 0;
+      size_t totalBytes = 0;
+      inventory.getMemInfo(deviceId, freeBytes, totalBytes);
+      keys[i] = -static_cast<int64_t>(freeBytes);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] < keys[b]; });
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,85 @@
+#pragma once
+#include "Device.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief how a checkout picks the device of a model with instances on several devices
+enum class PlacementPolicy {
+  /// @brief rotate over the devices of the model
+  ROUND_ROBIN,
+
+  /// @brief the device with the fewest checked-out instances of all models
+  LEAST_LOADED,
+
+  /// @brief the device with the most free memory
+  MEMORY_AWARE
+};
+
+/// @brief checked-out instances per device, over all models
+class DeviceLoad {
+public:
+  /// @brief device ids must be below this
+  static const int maxDevices = 16;
+
+  void add(int deviceId, int delta) { this->counts[deviceId].fetch_add(delta, std::memory_order_relaxed); }
+  int get(int deviceId) const { return this->counts[deviceId].load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int> counts[maxDevices] = {};
+};
+
+/**
+ * @brief the devices of one model and the order a checkout tries them in
+ *
+ * Only depends on the DeviceInventory interface and a DeviceLoad, so the policies can be exercised with a simulated
+ * inventory on hosts without GPUs.
+ */
+class Placement {
+public:
+  /// @brief parse "round-robin", "least-loaded" or "memory-aware", returns false for anything else
+  static bool parsePolicy(const std::string &name, PlacementPolicy &policy);
+
+  /**
+   * @brief set the policy and the instance devices
+   *
+   * @param instanceDevices instance i is created on instanceDevices[i % size]; repeating an id weights the device
+   */
+  void configure(PlacementPolicy policy, const std::vector<int> &instanceDevices);
+
+  PlacementPolicy getPolicy() const { return this->policy; }
+
+  /// @brief distinct device ids, in the order they first appear
+  const std::vector<int> &getDevices() const { return this->devices; }
+
+  /// @brief index into getDevices() of the device instance i is created on
+  int getInstanceDevice(int index) const {
+    return this->instanceDevices[static_cast<size_t>(index) % this->instanceDevices.size()];
+  }
+
+  /**
+   * @brief the devices in the order a checkout should try them
+   *
+   * @param inventory queried for free memory by the memory-aware policy
+   * @param load checked-out instances per device id, used by the least-loaded policy
+   * @param order indices into getDevices()
+   */
+  void rank(DeviceInventory &inventory, const DeviceLoad &load, std::vector<int> &order);
+
+private:
+  PlacementPolicy policy = PlacementPolicy::ROUND_ROBIN;
+  std::vector<int> devices;
+  std::vector<int> instanceDevices;
+
+  /// @brief next device for round-robin, and the tie breaker of the other policies
+  std::atomic<uint32_t> cursor{0};
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
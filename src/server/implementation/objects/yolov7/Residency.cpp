@@ -0,0 +1,64 @@
+#include "Residency.hpp"
+#include <algorithm>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+bool Residency::planEviction(const std::vector<Resident> &resident, const std::vector<size_t> &needed, size_t budget,
+                             std::vector<int> &victims) {
+  victims.clear();
+  if (budget == 0) {
+    return true;
+  }
+
+  //// usage per device with the new model
+  std::vector<size_t> usage(needed);
+  for (const Resident &model : resident) {
+    usage.resize(std::max(usage.size(), model.footprint.size()), 0);
+    for (size_t device = 0; device < model.footprint.size(); device++) {
+      usage[device] += model.footprint[device];
+    }
+  }
+  auto isOver = [&usage, budget](const std::vector<size_t> &footprint) {
+    for (size_t device = 0; device < footprint.size(); device++) {
+      if (footprint[device] > 0 && usage[device] > budget) {
+        return true;
+      }
+    }
+    return false;
+  };
+  if (isOver(needed) == false) {
+    return true;
+  }
+
+  //// unload the oldest models holding memory on a device that is still over budget
+  std::vector<const Resident *> order;
+  for (const Resident &model : resident) {
+    if (model.isEvictable) {
+      order.push_back(&model);
+    }
+  }
+  std::sort(order.begin(), order.end(), [](const Resident *a, const Resident *b) { return a->lastUse < b->lastUse; });
+  for (const Resident *model : order) {
+    if (isOver(needed) == false) {
+      break;
+    }
+    if (isOver(model->footprint) == false) {
+      continue;
+    }
+    victims.push_back(model->id);
+    for (size_t device = 0; device < model->footprint.size(); device++) {
+      usage[device] -= model->footprint[device];
+    }
+  }
+  if (isOver(needed)) {
+    victims.clear();
+    return false;
+  }
+  return true;
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,87 @@
+#pragma once
+#include "Detector.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief which idle models to unload so that another one fits into a per-device memory budget
+ *
+ * Only bookkeeping on footprints and last-use times, the pool does the unloading, so the policy can be exercised with
+ * simulated footprints on hosts without a GPU.
+ */
+class Residency {
+public:
+  /// @brief a loaded model as seen by the eviction policy
+  struct Resident {
+    /// @brief caller's identifier, returned in the victims
+    int id;
+
+    /// @brief bytes held per device id
+    std::vector<size_t> footprint;
+
+    /// @brief last checkout or return, in steady clock seconds
+    int64_t lastUse;
+
+    /// @brief false for pinned models and models with a session
+    bool isEvictable;
+  };
+
+  /**
+   * @brief least recently used evictable models to unload so that another model fits on every device it needs
+   *
+   * @param resident the loaded models
+   * @param needed bytes the model to load needs per device id
+   * @param budget bytes allowed per device, 0 for no limit
+   * @param victims ids to unload, least recently used first, empty if nothing needs to or can be unloaded
+   * @return false if the budget cannot be met even after unloading every evictable model
+   */
+  static bool planEviction(const std::vector<Resident> &resident, const std::vector<size_t> &needed, size_t budget,
+                           std::vector<int> &victims);
+};
+
+/**
+ * @brief a stable session handle on an instance that may be unloaded and created again
+ *
+ * Sessions and the pool slots keep the handle, the instance behind it only changes while no session holds it.
+ */
+class ResidentDetector : public Detector {
+public:
+  /// @brief take ownership of a new instance
+  void attach(Detector *instance) { this->instance.reset(instance); }
+
+  /// @brief delete the instance
+  void detach() { this->instance.reset(); }
+
+  bool isAttached() const { return this->instance != nullptr; }
+
+  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) override { this->instance->infer(rgbImg, output); }
+
+  std::vector<int> getInputSizes() const override { return this->instance->getInputSizes(); }
+
+  int getInputSize() const override { return this->instance->getInputSize(); }
+
+  bool setInputSize(int wh) override { return this->instance->setInputSize(wh); }
+
+  void setOutputLimits(float minConfidence, int maxCount) override { this->instance->setOutputLimits(minConfidence, maxCount); }
+
+  int getMaxBatchSize() const override { return this->instance->getMaxBatchSize(); }
+
+  int getDeviceId() const override { return this->instance->getDeviceId(); }
+
+  void inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) override {
+    this->instance->inferBatch(rgbImgs, outputs);
+  }
+
+private:
+  std::unique_ptr<Detector> instance;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
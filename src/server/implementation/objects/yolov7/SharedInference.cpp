@@ -0,0 +1,200 @@
+#include "SharedInference.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief how long a finished frame stays cached, sessions of one source see a frame within a few milliseconds
+static const int64_t cacheMs = 1000;
+
+/// @brief the longest a session waits for another session's run of the same frame before it runs the model itself
+static const int waitMs = 500;
+
+/// @brief frames cached per source, the oldest finished one makes room
+static const size_t maxFrames = 8;
+
+//// frame hash samples, enough to tell apart the frames of a live source
+static const int hashRows = 64;
+static const size_t hashWordsPerRow = 512;
+
+static inline int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief the sessions of one source key and its recent frames
+class SharedSource {
+public:
+  struct Frame {
+    uint64_t pts = 0;
+    uint64_t hash = 0;
+    std::string variant;
+    int64_t timeMs = 0;
+    /// @brief the session that ran the model, only compared
+    const SharedSubscription *producer = nullptr;
+    float minConfidence = 0;
+    int maxCount = 0;
+    bool isDone = false;
+    bool isFailed = false;
+    std::vector<utils::Obj> objs;
+  };
+
+  std::mutex lock;
+  std::condition_variable done;
+  std::vector<SharedSubscription *> subscribers;
+
+  /// @brief oldest first
+  std::vector<std::shared_ptr<Frame>> frames;
+
+  /// @brief evicted frames, reused with their object buffers
+  std::vector<std::shared_ptr<Frame>> spare;
+
+  /// @brief move a cached frame to the spare ones, unless a session still holds it
+  void evict(size_t index) {
+    if (this->frames[index].use_count() == 1) {
+      this->spare.push_back(std::move(this->frames[index]));
+    }
+    this->frames.erase(this->frames.begin() + index);
+  }
+};
+
+std::shared_ptr<SharedSubscription> SharedInference::subscribe(const std::string &sourceKey) {
+  std::shared_ptr<SharedSubscription> subscription = std::make_shared<SharedSubscription>();
+  subscription->sourceKey = sourceKey;
+  {
+    std::lock_guard<std::mutex> lockNow(this->lock);
+    std::weak_ptr<SharedSource> &source = this->sources[sourceKey];
+    subscription->source = source.lock();
+    if (subscription->source == nullptr) {
+      subscription->source = std::make_shared<SharedSource>();
+      source = subscription->source;
+    }
+  }
+  std::lock_guard<std::mutex> lockNow(subscription->source->lock);
+  subscription->source->subscribers.push_back(subscription.get());
+  return subscription;
+}
+
+void SharedInference::unsubscribe(const std::shared_ptr<SharedSubscription> &subscription) {
+  {
+    SharedSource &source = *subscription->source;
+    std::lock_guard<std::mutex> lockNow(source.lock);
+    source.subscribers.erase(std::remove(source.subscribers.begin(), source.subscribers.end(), subscription.get()),
+                             source.subscribers.end());
+  }
+  subscription->source.reset();
+  std::lock_guard<std::mutex> lockNow(this->lock);
+  auto found = this->sources.find(subscription->sourceKey);
+  if (found != this->sources.end() && found->second.expired()) {
+    this->sources.erase(found);
+  }
+}
+
+bool SharedInference::infer(SharedSubscription &subscription, const cv::Mat &mat, uint64_t pts, const std::string &variant,
+                            float minConfidence, int maxCount, const Run &run, std::vector<utils::Obj> &output) {
+  subscription.minConfidence.store(minConfidence, std::memory_order_relaxed);
+  subscription.maxCount.store(maxCount, std::memory_order_relaxed);
+  SharedSource &source = *subscription.source;
+  uint64_t hash = frameHash(mat);
+  int64_t nowMs = steadyNowMs();
+
+  std::shared_ptr<SharedSource::Frame> frame;
+  {
+    std::unique_lock<std::mutex> lockNow(source.lock);
+    for (size_t i = source.frames.size(); i-- > 0;) {
+      if (source.frames[i]->isDone && nowMs - source.frames[i]->timeMs > cacheMs) {
+        source.evict(i);
+      }
+    }
+
+    //// the newest run of this frame by another session, waited for if it is in flight
+    auto isSameFrame = [&subscription, pts, hash, &variant](const auto &cached) {
+      return cached->pts == pts && cached->hash == hash && cached->variant == variant && cached->producer != &subscription;
+    };
+    auto found = std::find_if(source.frames.rbegin(), source.frames.rend(), isSameFrame);
+    if (found != source.frames.rend()) {
+      std::shared_ptr<SharedSource::Frame> cached = *found;
+      source.done.wait_for(lockNow, std::chrono::milliseconds(waitMs), [&cached]() { return cached->isDone; });
+      // a run for sessions that wanted less than this one cannot be cut to its limits
+      if (cached->isDone && cached->isFailed == false && cached->minConfidence <= minConfidence && cached->maxCount >= maxCount) {
+        output = cached->objs;
+        subscription.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    //// run for every session of the source
+    if (source.frames.size() >= maxFrames) {
+      auto oldest = std::find_if(source.frames.begin(), source.frames.end(), [](const auto &cached) { return cached->isDone; });
+      if (oldest != source.frames.end()) {
+        source.evict(oldest - source.frames.begin());
+      }
+    }
+    if (source.spare.empty()) {
+      frame = std::make_shared<SharedSource::Frame>();
+    } else {
+      frame = std::move(source.spare.back());
+      source.spare.pop_back();
+    }
+    frame->pts = pts;
+    frame->hash = hash;
+    frame->variant = variant;
+    frame->timeMs = nowMs;
+    frame->producer = &subscription;
+    frame->minConfidence = minConfidence;
+    frame->maxCount = maxCount;
+    for (SharedSubscription *other : source.subscribers) {
+      frame->minConfidence = std::min(frame->minConfidence, other->minConfidence.load(std::memory_order_relaxed));
+      frame->maxCount = std::max(frame->maxCount, other->maxCount.load(std::memory_order_relaxed));
+    }
+    frame->isDone = false;
+    frame->isFailed = false;
+    source.frames.push_back(frame);
+  }
+
+  try {
+    run(frame->minConfidence, frame->maxCount, output);
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lockNow(source.lock);
+      frame->isFailed = true;
+      frame->isDone = true;
+    }
+    source.done.notify_all();
+    throw;
+  }
+  {
+    std::lock_guard<std::mutex> lockNow(source.lock);
+    frame->objs = output;
+    frame->isDone = true;
+  }
+  source.done.notify_all();
+  return false;
+}
+
+uint64_t SharedInference::frameHash(const cv::Mat &mat) {
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](uint64_t value) { hash = (hash ^ value) * 1099511628211ull; };
+  mix(static_cast<uint64_t>(mat.cols) << 32 | static_cast<uint32_t>(mat.rows));
+  size_t words = mat.cols * mat.elemSize() / sizeof(uint64_t);
+  if (words == 0) {
+    return hash;
+  }
+  int rowStep = std::max(mat.rows / hashRows, 1);
+  size_t wordStep = std::max(words / hashWordsPerRow, static_cast<size_t>(1));
+  for (int y = rowStep / 2; y < mat.rows; y += rowStep) {
+    const uint8_t *row = mat.ptr<uint8_t>(y);
+    for (size_t w = 0; w < words; w += wordStep) {
+      uint64_t value;
+      std::memcpy(&value, row + w * sizeof(uint64_t), sizeof(uint64_t));
+      mix(value);
+    }
+  }
+  return hash;
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
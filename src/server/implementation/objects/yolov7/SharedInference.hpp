@@ -0,0 +1,88 @@
+#pragma once
+#include "utils.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+class SharedSource;
+
+/// @brief a session fed by a shared source
+class SharedSubscription {
+public:
+  const std::string &getSourceKey() const { return this->sourceKey; }
+
+  /// @brief frames whose detections came from another session, never from one of its own earlier runs
+  uint64_t getHitCount() const { return this->hits.load(std::memory_order_relaxed); }
+
+private:
+  friend class SharedInference;
+
+  std::string sourceKey;
+  std::shared_ptr<SharedSource> source;
+  std::atomic<uint64_t> hits{0};
+
+  //// the limits of the session's last frame, a run for the source keeps what any of its sessions wants
+  std::atomic<float> minConfidence{1};
+  std::atomic<int> maxCount{0};
+};
+
+/**
+ * @brief one inference per frame for the sessions fed by the same source
+ *
+ * Filters fanned out from one camera subscribe to a source key. A frame is keyed by its buffer PTS, a hash of sampled
+ * pixels and the variant of the model that infers it (model name and input size), so sessions with different models
+ * never share. The first session to infer a frame runs the model with the loosest confidence and box limit of the
+ * source's sessions and caches the raw objects briefly; the others wait for a run in flight instead of starting their
+ * own, take a copy and cut it to their own limits. A session never takes the result of its own run, a static scene
+ * would otherwise repeat its first detections and count them as shared.
+ */
+class SharedInference {
+public:
+  /**
+   * @brief runs the model on the frame
+   *
+   * @param minConfidence the lowest confidence any session of the source keeps
+   * @param maxCount the most objects any session of the source keeps
+   */
+  using Run = std::function<void(float minConfidence, int maxCount, std::vector<utils::Obj> &output)>;
+
+  /// @brief join a source, created with its first session
+  std::shared_ptr<SharedSubscription> subscribe(const std::string &sourceKey);
+
+  /// @brief leave a source, removed with its last session
+  void unsubscribe(const std::shared_ptr<SharedSubscription> &subscription);
+
+  /**
+   * @brief the objects of a frame, from the cache, from a run of another session or from running the model
+   *
+   * @param pts buffer timestamp of the frame, all ones (GST_CLOCK_TIME_NONE) if unknown, then only the pixels match
+   * @param variant what else decides the result, frames are only shared within the same variant
+   * @param minConfidence the session's confidence threshold
+   * @param maxCount the session's box limit
+   * @param output the objects of the run, the caller cuts them to its limits
+   * @return true if another session ran the model
+   */
+  bool infer(SharedSubscription &subscription, const cv::Mat &mat, uint64_t pts, const std::string &variant, float minConfidence,
+             int maxCount, const Run &run, std::vector<utils::Obj> &output);
+
+  /// @brief FNV-1a over a grid of pixel samples, a few tens of microseconds for a 1080p frame
+  static uint64_t frameHash(const cv::Mat &mat);
+
+private:
+  std::mutex lock;
+  std::unordered_map<std::string, std::weak_ptr<SharedSource>> sources;
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
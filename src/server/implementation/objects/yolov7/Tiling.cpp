@@ -0,0 +1,174 @@
+#include "Tiling.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/// @brief IoU above which boxes of the same class are duplicates, as in the model NMS
+static const float mergeIou = 0.45f;
+
+/// @brief fraction of the smaller box inside the other above which boxes of different parts are the same object
+static const float mergeContainment = 0.6f;
+
+void Tiling::disable() {
+  this->mode = Mode::NONE;
+  this->rects.clear();
+  this->frameSize = cv::Size();
+}
+
+void Tiling::setRegions(const std::vector<cv::Rect2f> &regions) {
+  this->mode = regions.empty() ? Mode::NONE : Mode::REGIONS;
+  this->regions = regions;
+  this->frameSize = cv::Size();
+}
+
+void Tiling::setGrid(float overlap) {
+  this->mode = Mode::GRID;
+  this->overlap = std::min(std::max(overlap, 0.f), 0.5f);
+  this->frameSize = cv::Size();
+}
+
+void Tiling::infer(Detector &model, const cv::Mat &mat, std::vector<utils::Obj> &output) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int inputWH = model.getInputSize();
+  this->plan(mat.size(), inputWH > 0 ? inputWH : 640);
+
+  //// views into the frame, inferred as one batch
+  size_t count = this->rects.size();
+  this->views.resize(count);
+  this->viewPtrs.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    this->views[i] = mat(this->rects[i]);
+    this->viewPtrs[i] = &this->views[i];
+  }
+  this->splitUs = elapsedUs(start);
+  model.inferBatch(this->viewPtrs, this->outputs);
+
+  //// back to frame coordinates
+  start = std::chrono::steady_clock::now();
+  output.clear();
+  this->parts.clear();
+  for (size_t i = 0; i < count; i++) {
+    const cv::Point offset = this->rects[i].tl();
+    for (utils::Obj &obj : this->outputs[i]) {
+      obj.p1 += offset;
+      obj.p2 += offset;
+      output.push_back(std::move(obj));
+      this->parts.push_back(static_cast<int>(i));
+    }
+  }
+  if (count > 1) {
+    this->merge(output, this->parts, mergeIou);
+  }
+  this->mergeUs = elapsedUs(start);
+}
+
+void Tiling::planGrid(const cv::Size &frameSize, int tileWH, float overlap, std::vector<cv::Rect> &tiles) {
+  //// per axis: the fewest tiles that keep the overlap, spread evenly so the last one ends at the edge
+  auto axis = [tileWH, overlap](int length, std::vector<std::pair<int, int>> &spans) {
+    spans.clear();
+    if (length <= tileWH) {
+      spans.emplace_back(0, length);
+      return;
+    }
+    float stride = tileWH * (1 - overlap);
+    int count = static_cast<int>(std::ceil((length - tileWH) / stride)) + 1;
+    for (int i = 0; i < count; i++) {
+      int start = static_cast<int>(std::lround(static_cast<double>(i) * (length - tileWH) / (count - 1)));
+      spans.emplace_back(start, tileWH);
+    }
+  };
+  std::vector<std::pair<int, int>> columns;
+  std::vector<std::pair<int, int>> rows;
+  axis(frameSize.width, columns);
+  axis(frameSize.height, rows);
+
+  tiles.clear();
+  for (const auto &row : rows) {
+    for (const auto &column : columns) {
+      tiles.emplace_back(column.first, row.first, column.second, row.second);
+    }
+  }
+}
+
+void Tiling::merge(std::vector<utils::Obj> &objs, std::vector<int> &parts, float iouThresh) {
+  this->order.resize(objs.size());
+  for (size_t i = 0; i < objs.size(); i++) {
+    this->order[i] = static_cast<int>(i);
+  }
+  std::sort(this->order.begin(), this->order.end(), [&objs](int a, int b) { return objs[a].confi > objs[b].confi; });
+
+  this->kept.clear();
+  this->keptParts.clear();
+  for (int index : this->order) {
+    utils::Obj &obj = objs[index];
+    float area = static_cast<float>(obj.p2.x - obj.p1.x) * (obj.p2.y - obj.p1.y);
+    bool isDuplicate = false;
+    for (size_t k = 0; k < this->kept.size() && isDuplicate == false; k++) {
+      utils::Obj &other = this->kept[k];
+      if (other.classIdx != obj.classIdx) {
+        continue;
+      }
+      int left = std::max(obj.p1.x, other.p1.x);
+      int top = std::max(obj.p1.y, other.p1.y);
+      int right = std::min(obj.p2.x, other.p2.x);
+      int bottom = std::min(obj.p2.y, other.p2.y);
+      if (right <= left || bottom <= top) {
+        continue;
+      }
+      float intersection = static_cast<float>(right - left) * (bottom - top);
+      float otherArea = static_cast<float>(other.p2.x - other.p1.x) * (other.p2.y - other.p1.y);
+      if (intersection / (area + otherArea - intersection) > iouThresh) {
+        isDuplicate = true;
+      } else if (parts[index] != this->keptParts[k] && intersection / std::max(std::min(area, otherArea), 1.f) > mergeContainment) {
+        // the same object seen by two parts, one of them cut at its edge: keep the union
+        other.p1 = cv::Point(std::min(obj.p1.x, other.p1.x), std::min(obj.p1.y, other.p1.y));
+        other.p2 = cv::Point(std::max(obj.p2.x, other.p2.x), std::max(obj.p2.y, other.p2.y));
+        isDuplicate = true;
+      }
+    }
+    if (isDuplicate == false) {
+      this->kept.push_back(std::move(obj));
+      this->keptParts.push_back(parts[index]);
+    }
+  }
+  objs.swap(this->kept);
+  parts.swap(this->keptParts);
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void Tiling::plan(const cv::Size &frameSize, int tileWH) {
+  if (frameSize == this->frameSize && tileWH == this->tileWH) {
+    return;
+  }
+  this->frameSize = frameSize;
+  this->tileWH = tileWH;
+
+  if (this->mode == Mode::GRID) {
+    planGrid(frameSize, tileWH, this->overlap, this->rects);
+    return;
+  }
+
+  //// regions, clipped to the frame, empty ones dropped
+  this->rects.clear();
+  const cv::Rect frame(0, 0, frameSize.width, frameSize.height);
+  for (const cv::Rect2f &region : this->regions) {
+    cv::Rect rect(static_cast<int>(std::lround(region.x * frameSize.width)), static_cast<int>(std::lround(region.y * frameSize.height)),
+                  static_cast<int>(std::lround(region.width * frameSize.width)),
+                  static_cast<int>(std::lround(region.height * frameSize.height)));
+    rect &= frame;
+    if (rect.area() > 0) {
+      this->rects.push_back(rect);
+    }
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,103 @@
+#pragma once
+#include "Detector.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief infer on parts of the frame instead of the whole frame shrunk into the model input
+ *
+ * Two modes: client regions of interest, or an overlapped grid of tiles the size of the model input so that the frame is
+ * inferred at full resolution. The parts are views into the frame (no copy) and go to the model as one batch; their
+ * boxes are shifted back to frame coordinates and merged by a cross-part NMS.
+ */
+class Tiling {
+public:
+  /// @brief infer on the whole frame
+  void disable();
+
+  /**
+   * @brief infer only inside some regions
+   *
+   * @param regions x, y, width, height as fractions of the frame
+   */
+  void setRegions(const std::vector<cv::Rect2f> &regions);
+
+  /**
+   * @brief infer on a grid of tiles the size of the model input
+   *
+   * @param overlap minimum overlap of neighbouring tiles as a fraction of the tile size, 0~0.5
+   */
+  void setGrid(float overlap);
+
+  bool isEnabled() const { return this->mode != Mode::NONE; }
+
+  /// @brief microseconds the last infer took to cut the frame into parts
+  uint64_t getSplitUs() const { return this->splitUs; }
+
+  /// @brief microseconds the last infer took to bring the boxes of the parts back to the frame and merge them
+  uint64_t getMergeUs() const { return this->mergeUs; }
+
+  /**
+   * @brief infer on the parts of a frame
+   *
+   * @param model detector, its input size is the tile size
+   * @param mat the frame
+   * @param output merged objects in frame coordinates
+   */
+  void infer(Detector &model, const cv::Mat &mat, std::vector<utils::Obj> &output);
+
+  /**
+   * @brief tiles of size tileWH covering a frame with at least the given overlap, aligned to the frame edges
+   *
+   * @param tiles one rectangle per tile, a single tile of the frame size if it fits into one
+   */
+  static void planGrid(const cv::Size &frameSize, int tileWH, float overlap, std::vector<cv::Rect> &tiles);
+
+  /**
+   * @brief greedy per-class NMS over the boxes of all parts
+   *
+   * A box cut by a part edge overlaps the whole box of the neighbouring part with a low IoU, so boxes of different parts
+   * are also merged when most of the smaller one lies inside the other.
+   *
+   * @param objs boxes, the kept ones stay in descending confidence
+   * @param parts part index of every box, reordered with them
+   */
+  void merge(std::vector<utils::Obj> &objs, std::vector<int> &parts, float iouThresh);
+
+private:
+  enum class Mode { NONE, REGIONS, GRID };
+
+  Mode mode = Mode::NONE;
+  std::vector<cv::Rect2f> regions;
+  float overlap = 0.2f;
+
+  //// parts of the last frame layout, rebuilt when the frame or tile size changes
+  cv::Size frameSize;
+  int tileWH = 0;
+  std::vector<cv::Rect> rects;
+
+  uint64_t splitUs = 0;
+  uint64_t mergeUs = 0;
+
+  //// scratch, reused across frames
+  std::vector<cv::Mat> views;
+  std::vector<const cv::Mat *> viewPtrs;
+  std::vector<std::vector<utils::Obj>> outputs;
+  std::vector<int> parts;
+  std::vector<int> order;
+  std::vector<utils::Obj> kept;
+  std::vector<int> keptParts;
+
+  /// @brief rebuild the parts for a frame layout
+  void plan(const cv::Size &frameSize, int tileWH);
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief hierarchical timer wheel, not thread-safe
+ *
+ * Four levels of 64 buckets cover 64^4 ticks. Scheduling is O(1); an item is moved down at most three times before
+ * it fires, so advancing costs O(1) per item amortized regardless of how many items are pending.
+ */
+template <typename T> class TimerWheel {
+public:
+  /// @brief the latest expiry tick that can be scheduled, relative to the current tick
+  static const uint64_t maxDelay = (uint64_t(1) << 24) - 1;
+
+  explicit TimerWheel(uint64_t startTick) : current(startTick) {}
+
+  /// @brief schedule an item, expiry ticks in the past fire on the next advance
+  void schedule(uint64_t expireTick, T item) {
+    expireTick = std::min(std::max(expireTick, this->current + 1), this->current + maxDelay);
+    this->place(Entry{expireTick, std::move(item)});
+    this->count++;
+  }
+
+  /**
+   * @brief advance to a tick and fire every item expired on the way
+   *
+   * @param tick target tick, ignored if not after the current tick
+   * @param fire called as fire(item, tick), may schedule new items
+   */
+  template <typename F> void advance(uint64_t tick, F &&fire) {
+    while (this->current < tick) {
+      this->current++;
+
+      //// move the items of the higher levels due in the next 64 ticks down, highest level first
+      for (int level = levels - 1; level >= 1; level--) {
+        if ((this->current & ((uint64_t(1) << (bits * level)) - 1)) == 0) {
+          std::vector<Entry> &bucket = this->buckets[level][(this->current >> (bits * level)) & mask];
+          this->moving.swap(bucket);
+          for (Entry &entry : this->moving) {
+            this->place(std::move(entry));
+          }
+          this->moving.clear();
+        }
+      }
+
+      std::vector<Entry> &bucket = this->buckets[0][this->current & mask];
+      this->firing.swap(bucket);
+      this->count -= this->firing.size();
+      for (Entry &entry : this->firing) {
+        fire(entry.item, this->current);
+      }
+      this->firing.clear();
+    }
+  }
+
+  uint64_t getCurrentTick() const { return this->current; }
+
+  /// @brief number of pending items
+  size_t size() const { return this->count; }
+
+private:
+  static const int bits = 6;
+  static const int levels = 4;
+  static const uint64_t mask = (uint64_t(1) << bits) - 1;
+
+  struct Entry {
+    uint64_t expire;
+    T item;
+  };
+
+  std::array<std::array<std::vector<Entry>, 64>, levels> buckets;
+  uint64_t current;
+  size_t count = 0;
+
+  //// reused swap buffers of advance()
+  std::vector<Entry> moving;
+  std::vector<Entry> firing;
+
+  /// @brief put an entry in the lowest level whose span covers its delay, expire must not be before the current tick
+  void place(Entry &&entry) {
+    uint64_t delta = entry.expire - this->current;
+    int level = 0;
+    while (level < levels - 1 && delta >= (uint64_t(1) << (bits * (level + 1)))) {
+      level++;
+    }
+    this->buckets[level][(entry.expire >> (bits * level)) & mask].push_back(std::move(entry));
+  }
+};
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
@@ -0,0 +1,269 @@
+#include "Tracker.hpp"
+#include "BoxDelta.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+//// noise relative to the box size, in seconds
+static const float measurementStd = 0.05f;
+static const float accelerationStd = 1.0f;
+static const float initialVelocityStd = 2.0f;
+
+/// @brief association cost of pairs that must not be matched
+static const float noMatchCost = 1.0f;
+
+static inline float noiseScale(float w, float h) { return std::max(std::max(w, h), 1.f); }
+
+void Tracker::Axis::init(float z, float positionVar, float velocityVar) {
+  this->position = z;
+  this->velocity = 0;
+  this->p00 = positionVar;
+  this->p01 = 0;
+  this->p10 = 0;
+  this->p11 = velocityVar;
+}
+
+void Tracker::Axis::predict(float dt, float accelVar) {
+  this->position += this->velocity * dt;
+  float dt2 = dt * dt;
+  float p00 = this->p00 + dt * (this->p01 + this->p10) + dt2 * this->p11 + accelVar * dt2 * dt2 / 4;
+  float p01 = this->p01 + dt * this->p11 + accelVar * dt2 * dt / 2;
+  float p10 = this->p10 + dt * this->p11 + accelVar * dt2 * dt / 2;
+  this->p11 += accelVar * dt2;
+  this->p00 = p00;
+  this->p01 = p01;
+  this->p10 = p10;
+}
+
+void Tracker::Axis::correct(float z, float measurementVar) {
+  float s = this->p00 + measurementVar;
+  float k0 = this->p00 / s;
+  float k1 = this->p10 / s;
+  float innovation = z - this->position;
+  this->position += k0 * innovation;
+  this->velocity += k1 * innovation;
+  float p00 = this->p00;
+  float p01 = this->p01;
+  this->p00 = (1 - k0) * p00;
+  this->p01 = (1 - k0) * p01;
+  this->p10 -= k1 * p00;
+  this->p11 -= k1 * p01;
+}
+
+void Tracker::configure(int maxAgeMs, float iouThresh) {
+  this->maxAgeMs = maxAgeMs;
+  this->iouThresh = iouThresh;
+  this->reset();
+}
+
+void Tracker::reset() { this->tracks.clear(); }
+
+void Tracker::update(std::vector<utils::Obj> &objs, int64_t nowMs) {
+  //// move every track to the frame time
+  int trackCount = static_cast<int>(this->tracks.size());
+  int objCount = static_cast<int>(objs.size());
+  this->predicted.resize(trackCount);
+  for (int t = 0; t < trackCount; t++) {
+    Track &track = this->tracks[t];
+    float dt = std::max(nowMs - track.lastPredictMs, static_cast<int64_t>(0)) / 1000.f;
+    float scale = noiseScale(track.w.position, track.h.position) * accelerationStd;
+    track.cx.predict(dt, scale * scale);
+    track.cy.predict(dt, scale * scale);
+    track.w.predict(dt, scale * scale);
+    track.h.predict(dt, scale * scale);
+    track.lastPredictMs = nowMs;
+    this->predicted[t] = extrapolate(track, nowMs);
+  }
+
+  //// associate
+  this->assignment.assign(trackCount, -1);
+  if (trackCount > 0 && objCount > 0) {
+    this->costs.resize(static_cast<size_t>(trackCount) * objCount);
+    for (int t = 0; t < trackCount; t++) {
+      for (int c = 0; c < objCount; c++) {
+        float cost = noMatchCost;
+        if (this->predicted[t].classIdx == objs[c].classIdx) {
+          float iou = boxIou(this->predicted[t], objs[c]);
+          if (iou >= this->iouThresh) {
+            cost = 1 - iou;
+          }
+        }
+        this->costs[static_cast<size_t>(t) * objCount + c] = cost;
+      }
+    }
+    solveAssignment(this->costs, trackCount, objCount, this->assignment);
+  }
+
+  //// correct the matched tracks
+  this->detectionTrack.assign(objCount, -1);
+  for (int t = 0; t < trackCount; t++) {
+    Track &track = this->tracks[t];
+    int c = this->assignment[t];
+    if (c < 0 || this->costs[static_cast<size_t>(t) * objCount + c] >= noMatchCost) {
+      track.isMatched = false;
+      continue;
+    }
+    const utils::Obj &obj = objs[c];
+    float w = static_cast<float>(obj.p2.x - obj.p1.x);
+    float h = static_cast<float>(obj.p2.y - obj.p1.y);
+    float scale = noiseScale(w, h) * measurementStd;
+    track.cx.correct((obj.p1.x + obj.p2.x) / 2.f, scale * scale);
+    track.cy.correct((obj.p1.y + obj.p2.y) / 2.f, scale * scale);
+    track.w.correct(w, scale * scale);
+    track.h.correct(h, scale * scale);
+    track.obj = obj;
+    track.lastUpdateMs = nowMs;
+    track.isMatched = true;
+    this->detectionTrack[c] = t;
+    objs[c].trackId = track.id;
+  }
+
+  //// drop lost tracks, then start tracks for the new objects
+  this->tracks.erase(std::remove_if(this->tracks.begin(), this->tracks.end(),
+                                    [this, nowMs](const Track &track) { return nowMs - track.lastUpdateMs > this->maxAgeMs; }),
+                     this->tracks.end());
+  for (int c = 0; c < objCount; c++) {
+    if (this->detectionTrack[c] >= 0) {
+      continue;
+    }
+    this->tracks.emplace_back();
+    this->initTrack(this->tracks.back(), objs[c], nowMs);
+    objs[c].trackId = this->tracks.back().id;
+  }
+}
+
+void Tracker::predict(int64_t nowMs, const cv::Size &size, std::vector<utils::Obj> &objs) const {
+  objs.clear();
+  for (const Track &track : this->tracks) {
+    if (track.isMatched == false) {
+      continue;
+    }
+    utils::Obj obj = extrapolate(track, nowMs);
+    obj.p1.x = std::min(std::max(obj.p1.x, 0), size.width);
+    obj.p1.y = std::min(std::max(obj.p1.y, 0), size.height);
+    obj.p2.x = std::min(std::max(obj.p2.x, 0), size.width);
+    obj.p2.y = std::min(std::max(obj.p2.y, 0), size.height);
+    if (obj.p2.x > obj.p1.x && obj.p2.y > obj.p1.y) {
+      objs.push_back(std::move(obj));
+    }
+  }
+}
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void Tracker::initTrack(Track &track, const utils::Obj &obj, int64_t nowMs) {
+  float w = static_cast<float>(obj.p2.x - obj.p1.x);
+  float h = static_cast<float>(obj.p2.y - obj.p1.y);
+  float positionStd = noiseScale(w, h) * measurementStd;
+  float velocityStd = noiseScale(w, h) * initialVelocityStd;
+  track.id = this->nextId++;
+  track.obj = obj;
+  track.cx.init((obj.p1.x + obj.p2.x) / 2.f, positionStd * positionStd, velocityStd * velocityStd);
+  track.cy.init((obj.p1.y + obj.p2.y) / 2.f, positionStd * positionStd, velocityStd * velocityStd);
+  track.w.init(w, positionStd * positionStd, velocityStd * velocityStd);
+  track.h.init(h, positionStd * positionStd, velocityStd * velocityStd);
+  track.lastUpdateMs = nowMs;
+  track.lastPredictMs = nowMs;
+  track.isMatched = true;
+  if (this->nextId == std::numeric_limits<int>::max()) {
+    this->nextId = 1;
+  }
+}
+
+utils::Obj Tracker::extrapolate(const Track &track, int64_t nowMs) {
+  float dt = std::max(nowMs - track.lastPredictMs, static_cast<int64_t>(0)) / 1000.f;
+  float cx = track.cx.position + track.cx.velocity * dt;
+  float cy = track.cy.position + track.cy.velocity * dt;
+  float w = std::max(track.w.position + track.w.velocity * dt, 1.f);
+  float h = std::max(track.h.position + track.h.velocity * dt, 1.f);
+  utils::Obj obj = track.obj;
+  obj.p1 = cv::Point(static_cast<int>(std::lround(cx - w / 2)), static_cast<int>(std::lround(cy - h / 2)));
+  obj.p2 = cv::Point(static_cast<int>(std::lround(cx + w / 2)), static_cast<int>(std::lround(cy + h / 2)));
+  obj.trackId = track.id;
+  return obj;
+}
+
+// ================================================================================================================
+// assignment
+// ================================================================================================================
+
+void solveAssignment(const std::vector<float> &costs, int rows, int cols, std::vector<int> &rowToCol) {
+  rowToCol.assign(rows, -1);
+  if (rows == 0 || cols == 0) {
+    return;
+  }
+
+  //// the potential method needs n <= m, so solve the transposed problem when there are more rows
+  bool isTransposed = rows > cols;
+  int n = isTransposed ? cols : rows;
+  int m = isTransposed ? rows : cols;
+  auto cost = [&](int i, int j) {
+    return static_cast<double>(isTransposed ? costs[static_cast<size_t>(j) * cols + i] : costs[static_cast<size_t>(i) * cols + j]);
+  };
+
+  const double inf = std::numeric_limits<double>::infinity();
+  std::vector<double> u(n + 1, 0), v(m + 1, 0), minv(m + 1);
+  std::vector<int> p(m + 1, 0), way(m + 1, 0);
+  std::vector<char> used(m + 1);
+  for (int i = 1; i <= n; i++) {
+    p[0] = i;
+    int j0 = 0;
+    std::fill(minv.begin(), minv.end(), inf);
+    std::fill(used.begin(), used.end(), 0);
+    do {
+      used[j0] = 1;
+      int i0 = p[j0];
+      int j1 = 0;
+      double delta = inf;
+      for (int j = 1; j <= m; j++) {
+        if (used[j]) {
+          continue;
+        }
+        double cur = cost(i0 - 1, j - 1) - u[i0] - v[j];
+        if (cur < minv[j]) {
+          minv[j] = cur;
+          way[j] = j0;
+        }
+        if (minv[j] < delta) {
+          delta = minv[j];
+          j1 = j;
+        }
+      }
+      for (int j = 0; j <= m; j++) {
+        if (used[j]) {
+          u[p[j]] += delta;
+          v[j] -= delta;
+        } else {
+          minv[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (p[j0] != 0);
+    do {
+      int j1 = way[j0];
+      p[j0] = p[j1];
+      j0 = j1;
+    } while (j0 != 0);
+  }
+
+  for (int j = 1; j <= m; j++) {
+    if (p[j] == 0) {
+      continue;
+    }
+    if (isTransposed) {
+      rowToCol[j - 1] = p[j] - 1;
+    } else {
+      rowToCol[p[j] - 1] = j - 1;
+    }
+  }
+}
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
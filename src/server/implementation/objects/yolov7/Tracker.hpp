@@ -0,0 +1,107 @@
+#pragma once
+#include "utils.hpp"
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace kurento {
+namespace module {
+namespace objdet {
+
+/**
+ * @brief SORT-style multi-object tracker
+ *
+ * Every box coordinate (center x/y, width, height) has its own constant velocity Kalman filter; with the diagonal
+ * noise of SORT the full filter decouples into these 2x2 ones. Detections are associated with the predicted tracks
+ * of the same class by the Hungarian algorithm on 1 - IoU. Between inferences the tracks are extrapolated without
+ * touching the filters, so prediction costs a few multiplications per box.
+ */
+class Tracker {
+public:
+  /**
+   * @brief change the settings and drop all tracks
+   *
+   * @param maxAgeMs a track without matching detection for this long is dropped
+   * @param iouThresh minimum IoU between a predicted track and a detection to associate them
+   */
+  void configure(int maxAgeMs, float iouThresh);
+
+  /// @brief drop all tracks
+  void reset();
+
+  /**
+   * @brief correct the tracks with the detections of an inferred frame
+   *
+   * @param objs detections, their trackId is set
+   * @param nowMs monotonic time of the frame in milliseconds
+   */
+  void update(std::vector<utils::Obj> &objs, int64_t nowMs);
+
+  /**
+   * @brief extrapolate the tracks seen in the last inferred frame
+   *
+   * @param nowMs monotonic time of the frame in milliseconds
+   * @param size frame size, boxes are clipped to it
+   * @param objs predicted boxes
+   */
+  void predict(int64_t nowMs, const cv::Size &size, std::vector<utils::Obj> &objs) const;
+
+  size_t getTrackCount() const { return this->tracks.size(); }
+
+private:
+  /// @brief a 1D constant velocity Kalman filter
+  struct Axis {
+    float position;
+    float velocity = 0;
+    float p00;
+    float p01 = 0;
+    float p10 = 0;
+    float p11;
+
+    void init(float z, float positionVar, float velocityVar);
+    void predict(float dt, float accelVar);
+    void correct(float z, float measurementVar);
+  };
+
+  struct Track {
+    int id;
+    utils::Obj obj;
+    Axis cx;
+    Axis cy;
+    Axis w;
+    Axis h;
+    int64_t lastUpdateMs;
+    int64_t lastPredictMs;
+    bool isMatched;
+  };
+
+  int maxAgeMs = 1000;
+  float iouThresh = 0.3f;
+  int nextId = 1;
+  std::vector<Track> tracks;
+
+  //// association scratch, reused across frames
+  std::vector<utils::Obj> predicted;
+  std::vector<float> costs;
+  std::vector<int> assignment;
+  std::vector<int> detectionTrack;
+
+  void initTrack(Track &track, const utils::Obj &obj, int64_t nowMs);
+
+  /// @brief the box of a track extrapolated to a time
+  static utils::Obj extrapolate(const Track &track, int64_t nowMs);
+};
+
+/**
+ * @brief minimum cost assignment (Hungarian algorithm, O(n^3))
+ *
+ * @param costs row-major rows x cols costs
+ * @param rows number of rows
+ * @param cols number of columns
+ * @param rowToCol assigned column of every row, -1 if the row is left out (only when rows > cols)
+ */
+void solveAssignment(const std::vector<float> &costs, int rows, int cols, std::vector<int> &rowToCol);
+
+} // namespace objdet
+} // namespace module
+} // namespace kurento
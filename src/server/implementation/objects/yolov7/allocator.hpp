@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace utils {
+
+/// @brief host memory provider for engine IO staging buffers
+class HostAllocator {
+public:
+  virtual ~HostAllocator() = default;
+
+  /// @brief allocate a buffer of at least the given size, throws std::bad_alloc on failure
+  virtual void *allocate(size_t bytes) = 0;
+
+  /// @brief release a buffer returned by allocate
+  virtual void deallocate(void *ptr) = 0;
+};
+
+/// @brief pageable, cache-line aligned host memory, for detectors without a device (the objdet-bench stub)
+class SystemAllocator : public HostAllocator {
+public:
+  void *allocate(size_t bytes) override {
+    size_t aligned = (bytes + 63) / 64 * 64;
+    void *ptr = std::aligned_alloc(64, aligned == 0 ? 64 : aligned);
+    if (ptr == nullptr) {
+      throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  void deallocate(void *ptr) override { std::free(ptr); }
+};
+
+/// @brief forwards to another allocator and counts the calls, objdet-bench reports the host buffers allocated during a run
+class CountingAllocator : public HostAllocator {
+public:
+  explicit CountingAllocator(HostAllocator &upstream) : upstream(upstream) {}
+
+  void *allocate(size_t bytes) override {
+    this->allocations.fetch_add(1, std::memory_order_relaxed);
+    this->allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    return this->upstream.allocate(bytes);
+  }
+
+  void deallocate(void *ptr) override {
+    this->deallocations.fetch_add(1, std::memory_order_relaxed);
+    this->upstream.deallocate(ptr);
+  }
+
+  std::atomic<size_t> allocations{0};
+  std::atomic<size_t> deallocations{0};
+  std::atomic<size_t> allocatedBytes{0};
+
+private:
+  HostAllocator &upstream;
+};
+
+/// @brief fixed-size buffer owned through a HostAllocator, never reallocated after construction
+template <typename T> class HostBuffer {
+public:
+  HostBuffer() = default;
+  HostBuffer(HostAllocator &allocator, size_t count)
+      : allocator(&allocator), ptr(static_cast<T *>(allocator.allocate(count * sizeof(T)))), count(count) {}
+  HostBuffer(const HostBuffer &) = delete;
+  HostBuffer &operator=(const HostBuffer &) = delete;
+  HostBuffer(HostBuffer &&other) noexcept { this->swap(other); }
+  HostBuffer &operator=(HostBuffer &&other) noexcept {
+    HostBuffer tmp(std::move(other));
+    this->swap(tmp);
+    return *this;
+  }
+  ~HostBuffer() {
+    if (this->ptr != nullptr) {
+      this->allocator->deallocate(this->ptr);
+    }
+  }
+
+  T *data() const { return this->ptr; }
+  size_t size() const { return this->count; }
+  size_t bytes() const { return this->count * sizeof(T); }
+
+private:
+  HostAllocator *allocator = nullptr;
+  T *ptr = nullptr;
+  size_t count = 0;
+
+  void swap(HostBuffer &other) noexcept {
+    std::swap(this->allocator, other.allocator);
+    std::swap(this->ptr, other.ptr);
+    std::swap(this->count, other.count);
+  }
+};
+
+} // namespace utils
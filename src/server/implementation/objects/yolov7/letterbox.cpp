@@ -0,0 +1,201 @@
+#include "letterbox.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LETTERBOX_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LETTERBOX_NEON 1
+#endif
+
+namespace utils {
+
+namespace {
+
+/// @brief fill the sampling table of one axis the same way cv::resize (INTER_LINEAR) does
+void buildAxis(int srcLen, int dstLen, std::vector<int> &ofs0, std::vector<int> &ofs1, std::vector<float> &alpha, int stride) {
+  ofs0.resize(dstLen);
+  ofs1.resize(dstLen);
+  alpha.resize(dstLen);
+  double scale = static_cast<double>(srcLen) / dstLen;
+  for (int d = 0; d < dstLen; d++) {
+    float f = static_cast<float>((d + 0.5) * scale - 0.5);
+    int s = static_cast<int>(std::floor(f));
+    f -= s;
+    if (s < 0) {
+      s = 0;
+      f = 0;
+    }
+    if (s >= srcLen - 1) {
+      s = srcLen - 1;
+      f = 0;
+    }
+    ofs0[d] = s * stride;
+    ofs1[d] = std::min(s + 1, srcLen - 1) * stride;
+    alpha[d] = f;
+  }
+}
+
+void buildPlan(const cv::Mat &rgbImg, LetterboxPlan &plan, int wh) {
+  cv::Size shape = rgbImg.size();
+  float targetWidth = wh;
+  float targetHeight = wh;
+  float r = std::min(targetWidth / shape.width, targetHeight / shape.height);
+
+  int newUnpadWidth = std::min(static_cast<int>(std::lround(shape.width * r)), wh);
+  int newUnpadHeight = std::min(static_cast<int>(std::lround(shape.height * r)), wh);
+  float dw = (wh - newUnpadWidth) / 2.;
+  float dh = (wh - newUnpadHeight) / 2.;
+
+  plan.srcSize = shape;
+  plan.channels = rgbImg.channels();
+  plan.wh = wh;
+  plan.ratio = r;
+  plan.dw = dw;
+  plan.dh = dh;
+  plan.newUnpadWidth = newUnpadWidth;
+  plan.newUnpadHeight = newUnpadHeight;
+  plan.top = std::lround(dh - 0.1);
+  plan.left = std::lround(dw - 0.1);
+
+  buildAxis(shape.width, newUnpadWidth, plan.xOfs0, plan.xOfs1, plan.xAlpha, plan.channels);
+  buildAxis(shape.height, newUnpadHeight, plan.yOfs0, plan.yOfs1, plan.yAlpha, 1);
+  plan.rows.resize(static_cast<size_t>(2) * 3 * newUnpadWidth);
+}
+
+/// @brief interpolate one source row horizontally into 3 planar float rows (alpha of RGBA is dropped)
+void resizeRow(const uchar *src, float *row, const LetterboxPlan &plan) {
+  const int width = plan.newUnpadWidth;
+  const int *ofs0 = plan.xOfs0.data();
+  const int *ofs1 = plan.xOfs1.data();
+  const float *alpha = plan.xAlpha.data();
+  float *r = row;
+  float *g = row + width;
+  float *b = row + 2 * width;
+  for (int x = 0; x < width; x++) {
+    const uchar *p0 = src + ofs0[x];
+    const uchar *p1 = src + ofs1[x];
+    float a = alpha[x];
+    r[x] = p0[0] + (p1[0] - p0[0]) * a;
+    g[x] = p0[1] + (p1[1] - p0[1]) * a;
+    b[x] = p0[2] + (p1[2] - p0[2]) * a;
+  }
+}
+
+/// @brief out = (top + (bottom - top) * beta) * scale
+void blendRowsScalar(const float *top, const float *bottom, float *out, int n, float beta, float scale) {
+  for (int i = 0; i < n; i++) {
+    out[i] = (top[i] + (bottom[i] - top[i]) * beta) * scale;
+  }
+}
+
+#if defined(LETTERBOX_X86)
+__attribute__((target("avx2"))) void blendRowsAVX2(const float *top, const float *bottom, float *out, int n, float beta,
+                                                     float scale) {
+  const __m256 vBeta = _mm256_set1_ps(beta);
+  const __m256 vScale = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 t = _mm256_loadu_ps(top + i);
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(bottom + i), t);
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_add_ps(t, _mm256_mul_ps(d, vBeta)), vScale));
+  }
+  blendRowsScalar(top + i, bottom + i, out + i, n - i, beta, scale);
+}
+
+bool hasAVX2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+#endif
+
+#if defined(LETTERBOX_NEON)
+void blendRowsNEON(const float *top, const float *bottom, float *out, int n, float beta, float scale) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t t = vld1q_f32(top + i);
+    float32x4_t d = vsubq_f32(vld1q_f32(bottom + i), t);
+    vst1q_f32(out + i, vmulq_n_f32(vaddq_f32(t, vmulq_n_f32(d, beta)), scale));
+  }
+  blendRowsScalar(top + i, bottom + i, out + i, n - i, beta, scale);
+}
+#endif
+
+inline void blendRows(const float *top, const float *bottom, float *out, int n, float beta, float scale) {
+#if defined(LETTERBOX_X86)
+  if (hasAVX2()) {
+    blendRowsAVX2(top, bottom, out, n, beta, scale);
+    return;
+  }
+#elif defined(LETTERBOX_NEON)
+  blendRowsNEON(top, bottom, out, n, beta, scale);
+  return;
+#endif
+  blendRowsScalar(top, bottom, out, n, beta, scale);
+}
+
+} // namespace
+
+void preprocessInto(const cv::Mat &rgbImg, float *dst, Yolov7Input &input, LetterboxPlan &plan, int wh, int padColor) {
+  if (rgbImg.depth() != CV_8U || (rgbImg.channels() != 3 && rgbImg.channels() != 4)) {
+    throw std::runtime_error("preprocess supports 8-bit RGB or RGBA images only");
+  }
+  if (plan.srcSize != rgbImg.size() || plan.channels != rgbImg.channels() || plan.wh != wh) {
+    buildPlan(rgbImg, plan, wh);
+  }
+
+  const float scale = 1 / 255.f;
+  const float padValue = padColor * scale;
+  const int width = plan.newUnpadWidth;
+  const int height = plan.newUnpadHeight;
+  const size_t planeSize = static_cast<size_t>(wh) * wh;
+
+  //// top and bottom padding rows of all planes
+  for (int c = 0; c < 3; c++) {
+    float *plane = dst + c * planeSize;
+    std::fill(plane, plane + static_cast<size_t>(plan.top) * wh, padValue);
+    std::fill(plane + static_cast<size_t>(plan.top + height) * wh, plane + planeSize, padValue);
+  }
+
+  //// the two most recently interpolated source rows, reused while the vertical window does not move
+  float *rowBuffers[2] = {plan.rows.data(), plan.rows.data() + 3 * width};
+  int rowSource[2] = {-1, -1};
+  auto fetchRow = [&](int srcY) -> const float * {
+    for (int k = 0; k < 2; k++) {
+      if (rowSource[k] == srcY) {
+        return rowBuffers[k];
+      }
+    }
+    // source rows are visited in increasing order, so the smaller one is never needed again
+    int k = rowSource[0] < rowSource[1] ? 0 : 1;
+    resizeRow(rgbImg.ptr<uchar>(srcY), rowBuffers[k], plan);
+    rowSource[k] = srcY;
+    return rowBuffers[k];
+  };
+
+  for (int y = 0; y < height; y++) {
+    int y0 = plan.yOfs0[y];
+    int y1 = plan.yOfs1[y];
+    const float *top = fetchRow(y0);
+    const float *bottom = y1 == y0 ? top : fetchRow(y1);
+    float beta = plan.yAlpha[y];
+
+    size_t rowStart = static_cast<size_t>(plan.top + y) * wh;
+    for (int c = 0; c < 3; c++) {
+      float *out = dst + c * planeSize + rowStart;
+      std::fill(out, out + plan.left, padValue);
+      blendRows(top + c * width, bottom + c * width, out + plan.left, width, beta, scale);
+      std::fill(out + plan.left + width, out + wh, padValue);
+    }
+  }
+
+  input.inputSize = plan.srcSize;
+  input.ratio = plan.ratio;
+  input.dw = std::lround(plan.dw);
+  input.dh = std::lround(plan.dh);
+}
+
+} // namespace utils
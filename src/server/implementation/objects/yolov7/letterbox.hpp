@@ -0,0 +1,65 @@
+#pragma once
+#include <opencv2/opencv.hpp>
+
+#include "utils.hpp"
+#include <vector>
+
+namespace utils {
+
+/// @brief letterbox geometry and bilinear sampling tables, rebuilt only when the source size changes
+struct LetterboxPlan {
+  cv::Size srcSize;
+  int channels = 0;
+  int wh = 0;
+
+  //// letterbox geometry (same rounding as utils::preprocess)
+  float ratio = 1.f;
+  float dw = 0.f;
+  float dh = 0.f;
+  int newUnpadWidth = 0;
+  int newUnpadHeight = 0;
+  int top = 0;
+  int left = 0;
+
+  //// horizontal sampling: element offsets of the two neighbours and the weight of the right one
+  std::vector<int> xOfs0;
+  std::vector<int> xOfs1;
+  std::vector<float> xAlpha;
+
+  //// vertical sampling: source rows of the two neighbours and the weight of the lower one
+  std::vector<int> yOfs0;
+  std::vector<int> yOfs1;
+  std::vector<float> yAlpha;
+
+  /// @brief two horizontally interpolated source rows in planar layout (3 x newUnpadWidth each)
+  std::vector<float> rows;
+};
+
+/**
+ * @brief fused image preprocess (letterbox, RGBA->RGB, normalization and HWC->CHW in one pass)
+ *
+ * Produces the same tensor as utils::preprocess within 1/255 (bilinear sampling is done in float instead of
+ * 8-bit fixed point), without any intermediate image.
+ *
+ * @param rgbImg RGB or RGBA 8-bit image, may be a non-continuous ROI
+ * @param dst caller-owned planar float buffer of 3 x wh x wh
+ * @param input Yolov7Input Struct, only the coordinate conversion fields are filled
+ * @param plan cached sampling tables, reused across frames of the same size
+ * @param wh target width/height
+ * @param padColor padding color
+ */
+void preprocessInto(const cv::Mat &rgbImg, float *dst, Yolov7Input &input, LetterboxPlan &plan, int wh, int padColor);
+
+/**
+ * @brief fused image preprocess (letterbox and normalization)
+ *
+ * @param rgbImg RGB or RGBA image
+ * @param dst caller-owned planar float buffer of 3 x 640 x 640
+ * @param input Yolov7Input Struct
+ * @param plan cached sampling tables
+ */
+static inline void preprocessInto(const cv::Mat &rgbImg, float *dst, Yolov7Input &input, LetterboxPlan &plan) {
+  preprocessInto(rgbImg, dst, input, plan, 640, 114);
+};
+
+} // namespace utils
@@ -1,21 +1,42 @@
 #pragma once
+#ifdef OBJDET_WITH_TENSORRT
 #include <NvInfer.h>
+#endif
 
 #include <opencv2/opencv.hpp>
 
-#include "yolov7.hpp"
+#include <algorithm>
 #include <json/json.h>
+#include <limits>
 
 namespace utils {
 
+/// @brief the official pre-trained model classes. (COCO Dataset)
+inline const std::vector<std::string> COCO_CLASSNAMES = {
+    "person",         "bicycle",    "car",           "motorcycle",    "airplane",     "bus",           "train",
+    "truck",          "boat",       "traffic light", "fire hydrant",  "stop sign",    "parking meter", "bench",
+    "bird",           "cat",        "dog",           "horse",         "sheep",        "cow",           "elephant",
+    "bear",           "zebra",      "giraffe",       "backpack",      "umbrella",     "handbag",       "tie",
+    "suitcase",       "frisbee",    "skis",          "snowboard",     "sports ball",  "kite",          "baseball bat",
+    "baseball glove", "skateboard", "surfboard",     "tennis racket", "bottle",       "wine glass",    "cup",
+    "fork",           "knife",      "spoon",         "bowl",          "banana",       "apple",         "sandwich",
+    "orange",         "broccoli",   "carrot",        "hot dog",       "pizza",        "donut",         "cake",
+    "chair",          "couch",      "potted plant",  "bed",           "dining table", "toilet",        "tv",
+    "laptop",         "mouse",      "remote",        "keyboard",      "cell phone",   "microwave",     "oven",
+    "toaster",        "sink",       "refrigerator",  "book",          "clock",        "vase",          "scissors",
+    "teddy bear",     "hair drier", "toothbrush"};
+
+#ifdef OBJDET_WITH_TENSORRT
 /// @brief tensorrt binding info
 struct BindingInfo {
   int dataSize;
+  /// @brief element count of one batch item
   size_t size = 1;
   nvinfer1::Dims dims;
   std::string name;
   bool isInput;
 };
+#endif
 
 /// @brief yolov7 input
 struct Yolov7Input {
@@ -32,13 +53,17 @@ struct Yolov7Input {
 struct Obj {
   cv::Point p1;
   cv::Point p2;
-  std::string name;
+  /// @brief class name, points into the static class name table so that copying an Obj never allocates
+  const char *name = "";
   int classIdx;
   float confi;
+  /// @brief stable id across frames when tracking, -1 otherwise
+  int trackId = -1;
 
   bool operator<(const Obj &other) const { return confi > other.confi; }
 };
 
+#ifdef OBJDET_WITH_TENSORRT
 /// @brief binding info and memory allocations
 struct EngineIO {
   int bindingCount;
@@ -48,6 +73,12 @@ struct EngineIO {
   std::vector<void *> outputBuffersGPU;
   std::vector<void *> outputBuffersCPU;
   std::vector<void *> combinedBuffersGPU;
+
+  /// @brief batch capacity of the allocated buffers
+  int maxBatch = 1;
+
+  /// @brief whether the batch dimension can be changed per enqueue
+  bool isDynamicBatch = false;
 };
 
 /// @brief get the data type size for memory allocation
@@ -67,7 +98,7 @@ static inline void getBindingInfo(BindingInfo &info, const nvinfer1::ICudaEngine
   std::string name = engine->getBindingName(index);          // TODO: deprecated
   nvinfer1::Dims dims = engine->getBindingDimensions(index); // TODO: deprecated
   int size = 1;
-  for (int i = 0; i < dims.nbDims; i++) {
+  for (int i = 1; i < dims.nbDims; i++) { // skip the batch dimension
     size *= dims.d[i];
   }
 
@@ -77,6 +108,7 @@ static inline void getBindingInfo(BindingInfo &info, const nvinfer1::ICudaEngine
   info.name = name;
   info.isInput = engine->bindingIsInput(index); // TODO: deprecated
 };
+#endif
 
 /**
  * @brief image preprocess (letterbox and normalization)
@@ -133,36 +165,95 @@ static inline void preprocess(const cv::Mat &rgbImg, Yolov7Input &input, int wh,
 static inline void preprocess(const cv::Mat &rgbImg, Yolov7Input &input) { preprocess(rgbImg, input, 640, 114); };
 
 /**
- * @brief model output postprocess (convert to Obj class)
+ * @brief convert a box from model input coordinates back to the source image
+ *
+ * @param x1 left in model input coordinates
+ * @param y1 top in model input coordinates
+ * @param x2 right in model input coordinates
+ * @param y2 bottom in model input coordinates
+ * @param confi confidence
+ * @param classIdx class index
+ * @param input Yolov7Input of the frame
+ * @param CLASSNAMES object names, must outlive the objects
+ */
+static inline Obj toObj(float x1, float y1, float x2, float y2, float confi, int classIdx, const Yolov7Input &input,
+                        const std::vector<std::string> &CLASSNAMES) {
+  Obj obj;
+  obj.p1 = cv::Point(std::min(std::max((int)std::lround((x1 - input.dw) / input.ratio), 0), input.inputSize.width),
+                     std::min(std::max((int)std::lround((y1 - input.dh) / input.ratio), 0), input.inputSize.height));
+  obj.p2 = cv::Point(std::min(std::max((int)std::lround((x2 - input.dw) / input.ratio), 0), input.inputSize.width),
+                     std::min(std::max((int)std::lround((y2 - input.dh) / input.ratio), 0), input.inputSize.height));
+  obj.confi = confi;
+  obj.classIdx = classIdx;
+  obj.name = CLASSNAMES[classIdx].c_str();
+  return obj;
+};
+
+/**
+ * @brief keep the objects at or above a confidence, at most maxCount of the most confident, in descending confidence
+ *
+ * In place and without allocating: a compaction, then a partial sort of only the kept prefix.
+ *
+ * @param objs objects, filtered and sorted
+ * @param minConfidence confidence threshold
+ * @param maxCount maximum number of objects
+ */
+static inline void selectTop(std::vector<Obj> &objs, float minConfidence, int maxCount) {
+  objs.erase(std::remove_if(objs.begin(), objs.end(), [minConfidence](const Obj &obj) { return obj.confi < minConfidence; }),
+             objs.end());
+  size_t count = std::min(objs.size(), static_cast<size_t>(std::max(maxCount, 0)));
+  std::partial_sort(objs.begin(), objs.begin() + count, objs.end());
+  objs.resize(count);
+};
+
+/**
+ * @brief model output postprocess: confidence filter, top-K selection and box decoding in one pass over the outputs
+ *
+ * Only the boxes that pass the threshold are decoded, into objs whose capacity is reused across frames.
  *
  * @param outputBuffer the output from the model
  * @param input Yolov7Input
- * @param objs detected objects
- * @param CLASSNAMES object names
+ * @param objs detected objects, in descending confidence
+ * @param CLASSNAMES object names, must outlive the objects
+ * @param minConfidence confidence threshold
+ * @param maxCount maximum number of objects
  */
 static inline void postprocess(const std::vector<void *> &outputBuffer, const Yolov7Input &input, std::vector<Obj> &objs,
-                               const std::vector<std::string> &CLASSNAMES) {
+                               const std::vector<std::string> &CLASSNAMES, float minConfidence, int maxCount) {
   objs.clear();
   const int *boxCount = static_cast<int *>(outputBuffer[0]);
   const float *boxes = static_cast<float *>(outputBuffer[1]);
   const float *confidences = static_cast<float *>(outputBuffer[2]);
   const int *labels = static_cast<int *>(outputBuffer[3]);
+  const int classCount = static_cast<int>(CLASSNAMES.size());
+  bool isSorted = true;
   for (int i = 0; i < boxCount[0]; i++) {
+    if (confidences[i] < minConfidence || labels[i] < 0 || labels[i] >= classCount) {
+      continue;
+    }
+    isSorted = isSorted && (objs.empty() || confidences[i] <= objs.back().confi);
     const float *box = boxes + i * 4;
-
-    int x1 = std::min(std::max((int)std::lround((*box++ - input.dw) / input.ratio), 0), input.inputSize.width);
-    int y1 = std::min(std::max((int)std::lround((*box++ - input.dh) / input.ratio), 0), input.inputSize.height);
-    int x2 = std::min(std::max((int)std::lround((*box++ - input.dw) / input.ratio), 0), input.inputSize.width);
-    int y2 = std::min(std::max((int)std::lround((*box++ - input.dh) / input.ratio), 0), input.inputSize.height);
-
-    Obj obj;
-    obj.p1 = cv::Point(x1, y1);
-    obj.p2 = cv::Point(x2, y2);
-    obj.confi = *(confidences + i);
-    obj.classIdx = *(labels + i);
-    obj.name = CLASSNAMES[obj.classIdx];
-    objs.push_back(obj);
+    objs.push_back(toObj(box[0], box[1], box[2], box[3], confidences[i], labels[i], input, CLASSNAMES));
   }
+  // the NMS plugin emits its boxes by descending score, then the top-K are a prefix
+  if (isSorted == false) {
+    selectTop(objs, minConfidence, maxCount);
+  } else if (static_cast<int>(objs.size()) > maxCount) {
+    objs.resize(std::max(maxCount, 0));
+  }
+};
+
+/**
+ * @brief model output postprocess (convert to Obj class)
+ *
+ * @param outputBuffer the output from the model
+ * @param input Yolov7Input
+ * @param objs detected objects
+ * @param CLASSNAMES object names, must outlive the objects
+ */
+static inline void postprocess(const std::vector<void *> &outputBuffer, const Yolov7Input &input, std::vector<Obj> &objs,
+                               const std::vector<std::string> &CLASSNAMES) {
+  postprocess(outputBuffer, input, objs, CLASSNAMES, 0, std::numeric_limits<int>::max());
 };
 
 /**
@@ -2,32 +2,28 @@
 #include "yolov7.hpp"
 #include "utils.hpp"
 #include <NvInferPlugin.h>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <gst/gst.h>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 GST_DEBUG_CATEGORY_STATIC(obj_det_yolov7);
-#define GST_CAT_DEFAULT obj_det_yolov7
+GST_DEBUG_CATEGORY_STATIC(obj_det_trt_engine);
+
+// the engine and what it owns log through their own category, they exist before any Yolov7trt has set up obj_det_yolov7
+#define GST_CAT_DEFAULT obj_det_trt_engine
 
 namespace fs = std::filesystem;
 
 static const int inputChannel = 3;
-static const int inputWH = 640;
-
-const std::vector<std::string> Yolov7trt::CLASSNAMES = {
-    "person",         "bicycle",    "car",           "motorcycle",    "airplane",     "bus",           "train",
-    "truck",          "boat",       "traffic light", "fire hydrant",  "stop sign",    "parking meter", "bench",
-    "bird",           "cat",        "dog",           "horse",         "sheep",        "cow",           "elephant",
-    "bear",           "zebra",      "giraffe",       "backpack",      "umbrella",     "handbag",       "tie",
-    "suitcase",       "frisbee",    "skis",          "snowboard",     "sports ball",  "kite",          "baseball bat",
-    "baseball glove", "skateboard", "surfboard",     "tennis racket", "bottle",       "wine glass",    "cup",
-    "fork",           "knife",      "spoon",         "bowl",          "banana",       "apple",         "sandwich",
-    "orange",         "broccoli",   "carrot",        "hot dog",       "pizza",        "donut",         "cake",
-    "chair",          "couch",      "potted plant",  "bed",           "dining table", "toilet",        "tv",
-    "laptop",         "mouse",      "remote",        "keyboard",      "cell phone",   "microwave",     "oven",
-    "toaster",        "sink",       "refrigerator",  "book",          "clock",        "vase",          "scissors",
-    "teddy bear",     "hair drier", "toothbrush"};
 
 class Logger : public nvinfer1::ILogger {
   void log(nvinfer1::ILogger::Severity severity, const nvinfer1::AsciiChar *msg) noexcept override {
@@ -51,8 +47,25 @@ class Logger : public nvinfer1::ILogger {
   }
 };
 
-Yolov7trt::Yolov7trt(const std::string &modelPath, const int &device, std::string name) : deviceID(device) {
-  GST_DEBUG_CATEGORY_INIT(obj_det_yolov7, (std::string("ObjDetYolov7-") + name).c_str(), GST_DEBUG_BG_GREEN, "ObjDetYolov7");
+void *CudaHostAllocator::allocate(size_t bytes) {
+  void *ptr = nullptr;
+  if (cudaHostAlloc(&ptr, bytes, cudaHostAllocDefault) != cudaSuccess || ptr == nullptr) {
+    GST_ERROR("cannot allocate %zu bytes of pinned memory", bytes);
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void CudaHostAllocator::deallocate(void *ptr) { cudaFreeHost(ptr); }
+
+CudaHostAllocator &CudaHostAllocator::instance() {
+  static CudaHostAllocator allocator;
+  return allocator;
+}
+
+TrtEngine::TrtEngine(const std::string &modelPath, const int &device, std::vector<int> inputSizes)
+    : deviceID(device), requestedSizes(std::move(inputSizes)) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_trt_engine, "ObjDetTrtEngine", GST_DEBUG_BG_GREEN, "ObjDetTrtEngine");
   // cuda device check
   int cudaCount = -1;
   cudaGetDeviceCount(&cudaCount);
@@ -61,7 +74,7 @@ Yolov7trt::Yolov7trt(const std::string &modelPath, const int &device, std::strin
     GST_ERROR("no gpu found, cannot init model");
     throw std::runtime_error("no gpu found");
   }
-  if (device < cudaCount - 1) {
+  if (device < 0 || device >= cudaCount) {
     GST_ERROR("incorrect cuda device configuration");
     throw std::runtime_error("incorrect cuda device configuration");
   }
@@ -69,78 +82,245 @@ Yolov7trt::Yolov7trt(const std::string &modelPath, const int &device, std::strin
   // load model
   GST_INFO("init model");
   this->initModel(modelPath);
+};
 
-  // define input and output
-  GST_INFO("allocate memory");
-  initEngineIO();
+int TrtEngine::nextProfile() {
+  int profiles = std::max(this->engine->getNbOptimizationProfiles(), 1);
+  int index = this->contextCount.fetch_add(1);
+  bool isDynamic = this->engine->getBindingDimensions(0).d[0] < 0; // TODO: deprecated
+  if (index >= profiles && isDynamic) {
+    GST_WARNING("more execution contexts than optimization profiles (%d), build the engine with more profiles", profiles);
+  }
+  return index % profiles;
+};
 
-  // warmup
-  GST_INFO("warmup");
-  for (int i = 0; i < 10; i++) {
-    GST_DEBUG("warmup %d", i);
-    cv::Mat dummyImg(640, 640, CV_8UC3, cv::Scalar(rand() % 256, rand() % 256, rand() % 256));
-    std::vector<utils::Obj> dummyObjs;
-    this->infer(dummyImg, dummyObjs);
+void TrtEngine::initModel(const std::string &modelPath) {
+  GST_INFO("set device %d", this->deviceID);
+  cudaSetDevice(this->deviceID);
+  // runtime
+  GST_INFO("init logger");
+  this->gLogger = new Logger();
+  initLibNvInferPlugins(gLogger, "");
+
+  GST_INFO("create infer runtime");
+  this->runtime = nvinfer1::createInferRuntime(*gLogger);
+  assert(this->runtime != nullptr);
+
+  // engine
+  GST_INFO("check model file");
+  if (fs::exists(modelPath) == false) {
+    GST_ERROR("model not found: %s", modelPath.c_str());
+    throw std::runtime_error("model not found: " + modelPath);
+  }
+  GST_INFO("load model");
+  auto start = std::chrono::steady_clock::now();
+  size_t size = 0;
+  if (this->deserializeMapped(modelPath, size) == false) {
+    // no mapping (e.g. a file system without mmap support): read the whole file into memory
+    GST_WARNING("cannot map %s, read it instead", modelPath.c_str());
+    std::ifstream file(modelPath, std::ios::binary);
+    if (file.good() == false) {
+      GST_ERROR("model cannot load: %s", modelPath.c_str());
+      throw std::runtime_error("model cannot load: " + modelPath);
+    }
+    file.seekg(0, std::ios::end);
+    size = static_cast<size_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    std::vector<char> buffer(size);
+    file.read(buffer.data(), static_cast<std::streamsize>(size));
+    this->engine = this->runtime->deserializeCudaEngine(buffer.data(), size);
+  }
+  if (this->engine == nullptr) {
+    GST_ERROR("model cannot deserialize: %s", modelPath.c_str());
+    throw std::runtime_error("model cannot deserialize: " + modelPath);
+  }
+  GST_INFO("deserialized %zu bytes on device %d in %lld ms", size, this->deviceID,
+           static_cast<long long>(
+               std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
+};
+
+bool TrtEngine::deserializeMapped(const std::string &modelPath, size_t &size) {
+  int fd = open(modelPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+  size = static_cast<size_t>(info.st_size);
+  // the page cache backs the mapping, so several devices loading the same file share one copy of it
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  this->engine = this->runtime->deserializeCudaEngine(data, size);
+  munmap(data, size);
+  return true;
+}
+
+TrtEngine::~TrtEngine() {
+  GST_INFO("destroy engine");
+  cudaSetDevice(this->deviceID);
+  this->engine->destroy();  // TODO: deprecated
+  this->runtime->destroy(); // TODO: deprecated
+  delete this->gLogger;
+};
+
+#undef GST_CAT_DEFAULT
+#define GST_CAT_DEFAULT obj_det_yolov7
+
+Yolov7trt::Yolov7trt(const std::string &modelPath, const int &device, std::string name, int maxBatch)
+    : Yolov7trt(std::make_shared<TrtEngine>(modelPath, device), name, maxBatch) {}
+
+Yolov7trt::Yolov7trt(std::shared_ptr<TrtEngine> engine, std::string name, int maxBatch, int warmupCount)
+    : Yolov7trt(engine, name, maxBatch, warmupCount, CudaHostAllocator::instance()) {}
+
+Yolov7trt::Yolov7trt(std::shared_ptr<TrtEngine> engine, std::string name, int maxBatch, int warmupCount,
+                     utils::HostAllocator &hostAllocator)
+    : deviceID(engine->getDeviceID()), requestedMaxBatch(std::max(maxBatch, 1)), sharedEngine(engine), engine(engine->get()),
+      hostAllocator(hostAllocator) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_yolov7, (std::string("ObjDetYolov7-") + name).c_str(), GST_DEBUG_BG_GREEN, "ObjDetYolov7");
+  this->initContext(warmupCount);
+};
+
+bool Yolov7trt::setInputSize(int wh) {
+  if (wh == 0) {
+    wh = this->inputSizes.front();
   }
+  if (std::find(this->inputSizes.begin(), this->inputSizes.end(), wh) == this->inputSizes.end()) {
+    GST_WARNING("input size %d is not supported by the engine", wh);
+    return false;
+  }
+  this->requestedWH.store(wh, std::memory_order_relaxed);
+  return true;
+};
+
+void Yolov7trt::setOutputLimits(float minConfidence, int maxCount) {
+  this->minConfidence = minConfidence;
+  this->maxCount = maxCount;
 };
 
 void Yolov7trt::infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) {
-  utils::Yolov7Input input;
-  GST_DEBUG("preprocess");
-  utils::preprocess(rgbImg, input);
+  this->inputWH = this->requestedWH.load(std::memory_order_relaxed);
+  auto start = std::chrono::steady_clock::now();
+  this->preprocessSample(0, rgbImg);
+  this->recordStage(kurento::module::objdet::Stage::PREPROCESS, start);
+  this->run(1);
+  start = std::chrono::steady_clock::now();
+  this->postprocessSample(0, output);
+  this->recordStage(kurento::module::objdet::Stage::POSTPROCESS, start);
+};
+
+void Yolov7trt::inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) {
+  int total = static_cast<int>(rgbImgs.size());
+  outputs.resize(total);
+  this->inputWH = this->requestedWH.load(std::memory_order_relaxed);
+  for (int start = 0; start < total; start += this->engineIO.maxBatch) {
+    int batchSize = std::min(total - start, this->engineIO.maxBatch);
+    auto stageStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < batchSize; i++) {
+      this->preprocessSample(i, *rgbImgs[start + i]);
+    }
+    this->recordStage(kurento::module::objdet::Stage::PREPROCESS, stageStart);
+    this->run(batchSize);
+    stageStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < batchSize; i++) {
+      this->postprocessSample(i, outputs[start + i]);
+    }
+    this->recordStage(kurento::module::objdet::Stage::POSTPROCESS, stageStart);
+  }
+};
+
+void Yolov7trt::preprocessSample(int index, const cv::Mat &rgbImg) {
+  GST_DEBUG("preprocess %d", index);
+  // the batch items are packed at the current size, the buffer is sized for the largest one
+  size_t sampleSize = static_cast<size_t>(inputChannel) * this->inputWH * this->inputWH;
+  float *inputCPU = this->inputBufferCPU.data() + index * sampleSize;
+  utils::preprocessInto(rgbImg, inputCPU, this->inputs[index], this->letterboxPlans[index], this->inputWH, 114);
+};
+
+void Yolov7trt::run(int batchSize) {
+  // inference runs on the streaming, worker and dispatcher threads, whose current device is not this context's
+  cudaSetDevice(this->deviceID);
+  bool isBatchChanged = this->engineIO.isDynamicBatch && batchSize != this->currentBatch;
+  if (isBatchChanged || this->inputWH != this->currentWH) {
+    int batchDim = this->engineIO.isDynamicBatch ? batchSize : this->currentBatch;
+    GST_DEBUG("set binding dim= %dx%dx%dx%d", batchDim, inputChannel, this->inputWH, this->inputWH);
+    this->context->setBindingDimensions(this->bindingOffset,
+                                        nvinfer1::Dims4{batchDim, inputChannel, this->inputWH, this->inputWH}); // TODO: deprecated
+    this->currentBatch = batchDim;
+    this->currentWH = this->inputWH;
+  }
+
+  // the events cost a few microseconds per run, only spent when recording
+  kurento::module::objdet::StageMetrics *metrics = this->metrics;
+  if (metrics != nullptr) {
+    cudaEventRecord(this->stageEvents[0], this->stream);
+  }
+
   GST_DEBUG("copy input to gpu(async)");
-  cudaMemcpyAsync(this->engineIO.inputBufferGPU[0], input.mat.ptr<float>(), input.mat.total() * input.mat.elemSize(),
-                  cudaMemcpyHostToDevice, this->stream);
+  size_t inputBytes = static_cast<size_t>(batchSize) * inputChannel * this->inputWH * this->inputWH * this->engineIO.inputBinding.dataSize;
+  cudaMemcpyAsync(this->engineIO.inputBufferGPU[0], this->inputBufferCPU.data(), inputBytes, cudaMemcpyHostToDevice, this->stream);
+
+  if (metrics != nullptr) {
+    cudaEventRecord(this->stageEvents[1], this->stream);
+  }
 
   GST_DEBUG("infer(enqueue)");
   this->context->enqueueV2(this->engineIO.combinedBuffersGPU.data(), this->stream, nullptr); // TODO: deprecated
+  if (metrics != nullptr) {
+    cudaEventRecord(this->stageEvents[2], this->stream);
+  }
 
   GST_DEBUG("copy output to cpu(async)");
   int totalOutput = static_cast<int>(this->engineIO.outputBindings.size());
   for (int i = 0; i < totalOutput; i++) {
-    size_t size = this->engineIO.outputBindings[i].size * this->engineIO.outputBindings[i].dataSize;
+    size_t size = batchSize * this->engineIO.outputBindings[i].size * this->engineIO.outputBindings[i].dataSize;
     cudaMemcpyAsync(this->engineIO.outputBuffersCPU[i], this->engineIO.outputBuffersGPU[i], size, cudaMemcpyDeviceToHost,
                     this->stream);
   }
 
+  if (metrics != nullptr) {
+    cudaEventRecord(this->stageEvents[3], this->stream);
+  }
+
   GST_DEBUG("cuda stream sync");
   cudaStreamSynchronize(this->stream);
-  GST_DEBUG("postprocess");
-  utils::postprocess(this->engineIO.outputBuffersCPU, input, output, this->CLASSNAMES);
-};
-
-void Yolov7trt::initModel(const std::string &modelPath) {
-  GST_INFO("set device %d", this->deviceID);
-  cudaSetDevice(this->deviceID);
-  // runtime
-  GST_INFO("init logger");
-  this->gLogger = new Logger();
-  initLibNvInferPlugins(gLogger, "");
 
-  GST_INFO("create infer runtime");
-  this->runtime = nvinfer1::createInferRuntime(*gLogger);
-  assert(this->runtime != nullptr);
+  if (metrics != nullptr) {
+    static const kurento::module::objdet::Stage stages[] = {
+        kurento::module::objdet::Stage::H2D, kurento::module::objdet::Stage::COMPUTE, kurento::module::objdet::Stage::D2H};
+    for (int i = 0; i < 3; i++) {
+      float elapsedMs = 0;
+      if (cudaEventElapsedTime(&elapsedMs, this->stageEvents[i], this->stageEvents[i + 1]) == cudaSuccess) {
+        metrics->record(stages[i], static_cast<uint64_t>(elapsedMs * 1000));
+      }
+    }
+  }
+};
 
-  // engine
-  GST_INFO("check model file");
-  if (fs::exists(modelPath) == false) {
-    GST_ERROR("model not found: %s", modelPath.c_str());
-    throw std::runtime_error("model not found: " + modelPath);
+void Yolov7trt::recordStage(kurento::module::objdet::Stage stage, std::chrono::steady_clock::time_point start) {
+  if (this->metrics != nullptr) {
+    this->metrics->record(stage, kurento::module::objdet::elapsedUs(start));
   }
-  std::ifstream file(modelPath, std::ios::binary);
-  if (file.good() == false) {
-    GST_ERROR("model cannot load: %s", modelPath.c_str());
-    throw std::runtime_error("model cannot load: " + modelPath);
+};
+
+void Yolov7trt::postprocessSample(int index, std::vector<utils::Obj> &output) {
+  GST_DEBUG("postprocess %d", index);
+  int totalOutput = static_cast<int>(this->engineIO.outputBindings.size());
+  for (int i = 0; i < totalOutput; i++) {
+    const utils::BindingInfo &binding = this->engineIO.outputBindings[i];
+    this->sampleOutputsCPU[i] = static_cast<char *>(this->engineIO.outputBuffersCPU[i]) + index * binding.size * binding.dataSize;
   }
-  GST_INFO("load model");
-  file.seekg(0, std::ios::end);
-  std::streamsize size = file.tellg();
-  file.seekg(0, std::ios::beg);
-  char *buffer = new char[size];
-  file.read(buffer, size);
-  this->engine = this->runtime->deserializeCudaEngine(buffer, size);
-  delete[] buffer;
-  assert(this->engine != nullptr);
+  utils::postprocess(this->sampleOutputsCPU, this->inputs[index], output, utils::COCO_CLASSNAMES, this->minConfidence, this->maxCount);
+};
+
+void Yolov7trt::initContext(int warmupCount) {
+  cudaSetDevice(this->deviceID);
 
   // context
   GST_INFO("create execution context");
@@ -149,27 +329,118 @@ void Yolov7trt::initModel(const std::string &modelPath) {
 
   GST_INFO("create stream");
   cudaStreamCreate(&stream);
+  for (cudaEvent_t &event : this->stageEvents) {
+    cudaEventCreate(&event);
+  }
+
+  this->profile = this->sharedEngine->nextProfile();
+  if (this->profile > 0) {
+    GST_INFO("use optimization profile %d", this->profile);
+    this->context->setOptimizationProfileAsync(this->profile, this->stream);
+  }
+
+  // define input and output
+  GST_INFO("allocate memory");
+  initEngineIO();
+
+  // warmup, the other sizes once so that switching to them does not stall a session
+  GST_INFO("warmup");
+  auto start = std::chrono::steady_clock::now();
+  std::vector<utils::Obj> dummyObjs;
+  for (int i = 0; i < warmupCount; i++) {
+    GST_DEBUG("warmup %d", i);
+    int wh = this->inputSizes.front();
+    cv::Mat dummyImg(wh, wh, CV_8UC3, cv::Scalar(rand() % 256, rand() % 256, rand() % 256));
+    this->infer(dummyImg, dummyObjs);
+  }
+  for (size_t i = 1; i < this->inputSizes.size() && warmupCount > 0; i++) {
+    GST_DEBUG("warmup size %d", this->inputSizes[i]);
+    this->requestedWH.store(this->inputSizes[i], std::memory_order_relaxed);
+    cv::Mat dummyImg(this->inputSizes[i], this->inputSizes[i], CV_8UC3, cv::Scalar(rand() % 256, rand() % 256, rand() % 256));
+    this->infer(dummyImg, dummyObjs);
+  }
+  this->requestedWH.store(this->inputSizes.front(), std::memory_order_relaxed);
+  GST_INFO("%d warmup inferences on device %d in %lld ms", warmupCount, this->deviceID,
+           static_cast<long long>(
+               std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
+};
+
+void Yolov7trt::initInputSizes() {
+  //// a dynamic height/width is bounded by the optimization profile, a static one is the only size
+  const nvinfer1::Dims &dims = this->engineIO.inputBinding.dims;
+  const std::vector<int> &requested = this->sharedEngine->getRequestedSizes();
+  this->inputSizes.clear();
+  if (dims.d[2] < 0 || dims.d[3] < 0) {
+    nvinfer1::Dims minDims =
+        this->engine->getProfileDimensions(this->bindingOffset, this->profile, nvinfer1::OptProfileSelector::kMIN); // TODO: deprecated
+    nvinfer1::Dims maxDims =
+        this->engine->getProfileDimensions(this->bindingOffset, this->profile, nvinfer1::OptProfileSelector::kMAX); // TODO: deprecated
+    for (int wh : requested) {
+      if (wh < std::max(minDims.d[2], minDims.d[3]) || wh > std::min(maxDims.d[2], maxDims.d[3])) {
+        GST_WARNING("input size %d is outside of the optimization profile (%dx%d~%dx%d), skipped", wh, minDims.d[3], minDims.d[2],
+                    maxDims.d[3], maxDims.d[2]);
+        continue;
+      }
+      this->inputSizes.push_back(wh);
+    }
+    if (this->inputSizes.empty()) {
+      nvinfer1::Dims optDims =
+          this->engine->getProfileDimensions(this->bindingOffset, this->profile, nvinfer1::OptProfileSelector::kOPT); // TODO: deprecated
+      this->inputSizes.push_back(std::min(optDims.d[2], optDims.d[3]));
+    }
+  } else {
+    this->inputSizes.push_back(std::min(dims.d[2], dims.d[3]));
+    if (requested.size() > 1 || (requested.size() == 1 && requested[0] != this->inputSizes[0])) {
+      GST_WARNING("engine input is fixed at %d, rebuild it with a dynamic shape profile to use other sizes", this->inputSizes[0]);
+    }
+  }
+  std::sort(this->inputSizes.begin(), this->inputSizes.end(), std::greater<int>());
+  this->inputSizes.erase(std::unique(this->inputSizes.begin(), this->inputSizes.end()), this->inputSizes.end());
+  this->requestedWH.store(this->inputSizes.front(), std::memory_order_relaxed);
+  this->inputWH = this->inputSizes.front();
+
+  //// the staging buffers hold a batch at the largest size
+  this->engineIO.inputBinding.size = static_cast<size_t>(inputChannel) * this->inputWH * this->inputWH;
+  GST_INFO("input sizes %zu, default %d", this->inputSizes.size(), this->inputWH);
 };
 
 void Yolov7trt::initEngineIO() { this->initEngineIO(true); };
 
 void Yolov7trt::initEngineIO(bool allocateMem) {
   GST_INFO("get binging numbers");
-  int bindingCount = this->engine->getNbBindings(); // TODO: deprecated
+  int totalBindingCount = this->engine->getNbBindings(); // TODO: deprecated
+  int bindingCount = totalBindingCount / std::max(this->engine->getNbOptimizationProfiles(), 1);
   assert(bindingCount == 5);
   this->engineIO.bindingCount = bindingCount;
+  // bindings of profile k are numbered from k * bindingCount
+  this->bindingOffset = this->profile * bindingCount;
 
   // input
   GST_INFO("get input binding info");
-  assert(this->engine->bindingIsInput(0)); // TODO: deprecated
-  utils::getBindingInfo(this->engineIO.inputBinding, this->engine, 0);
+  assert(this->engine->bindingIsInput(this->bindingOffset)); // TODO: deprecated
+  utils::getBindingInfo(this->engineIO.inputBinding, this->engine, this->bindingOffset);
+  this->initInputSizes();
 
-  GST_INFO("set binding dim= %dx%dx%dx%d", 1, inputChannel, inputWH, inputWH);
-  this->context->setBindingDimensions(0, nvinfer1::Dims4{1, inputChannel, inputWH, inputWH}); // TODO: deprecated
+  //// batch capacity: a dynamic batch dimension is bounded by the optimization profile
+  int engineBatch = this->engineIO.inputBinding.dims.d[0];
+  this->engineIO.isDynamicBatch = engineBatch < 0;
+  if (this->engineIO.isDynamicBatch) {
+    engineBatch =
+        this->engine->getProfileDimensions(this->bindingOffset, this->profile, nvinfer1::OptProfileSelector::kMAX).d[0]; // TODO: deprecated
+  }
+  this->engineIO.maxBatch = std::max(std::min(this->requestedMaxBatch, engineBatch), 1);
+  GST_INFO("engine batch %d (%s), use max batch %d", engineBatch, this->engineIO.isDynamicBatch ? "dynamic" : "static",
+           this->engineIO.maxBatch);
+
+  this->currentBatch = this->engineIO.isDynamicBatch ? 1 : engineBatch;
+  this->currentWH = this->inputWH;
+  GST_INFO("set binding dim= %dx%dx%dx%d", this->currentBatch, inputChannel, this->inputWH, this->inputWH);
+  this->context->setBindingDimensions(this->bindingOffset,
+                                      nvinfer1::Dims4{this->currentBatch, inputChannel, this->inputWH, this->inputWH}); // TODO: deprecated
 
   // output
   GST_INFO("get output binding info");
-  for (int i = 1; i < bindingCount; i++) {
+  for (int i = this->bindingOffset + 1; i < this->bindingOffset + bindingCount; i++) {
     assert(this->engine->bindingIsInput(i) == false);
     utils::BindingInfo info;
     utils::getBindingInfo(info, this->engine, i);
@@ -177,10 +448,15 @@ void Yolov7trt::initEngineIO(bool allocateMem) {
   }
 
   if (allocateMem == true) {
-    // input (gpu only)
+    // input
     GST_INFO("allocate input buffer");
+    //// a static batch engine always reads and writes its full batch
+    size_t bufferBatch = std::max(this->engineIO.maxBatch, this->currentBatch);
+    this->inputBufferCPU = utils::HostBuffer<float>(this->hostAllocator, bufferBatch * this->engineIO.inputBinding.size);
+    this->inputs.resize(this->engineIO.maxBatch);
+    this->letterboxPlans.resize(this->engineIO.maxBatch);
     void *inputBuffer;
-    cudaMalloc(&inputBuffer, this->engineIO.inputBinding.size * this->engineIO.inputBinding.dataSize);
+    cudaMalloc(&inputBuffer, bufferBatch * this->engineIO.inputBinding.size * this->engineIO.inputBinding.dataSize);
     this->engineIO.inputBufferGPU.push_back(inputBuffer);
 
     // output
@@ -189,20 +465,22 @@ void Yolov7trt::initEngineIO(bool allocateMem) {
       assert(binding.isInput == false);
       // gpu
       void *outputBufferGPU;
-      cudaMalloc(&outputBufferGPU, binding.size * binding.dataSize);
+      cudaMalloc(&outputBufferGPU, bufferBatch * binding.size * binding.dataSize);
       this->engineIO.outputBuffersGPU.push_back(outputBufferGPU);
       // cpu
-      void *outputBufferCPU;
-      cudaHostAlloc(&outputBufferCPU, binding.size * binding.dataSize, 0);
+      void *outputBufferCPU = this->hostAllocator.allocate(bufferBatch * binding.size * binding.dataSize);
       this->engineIO.outputBuffersCPU.push_back(outputBufferCPU);
     }
+    this->sampleOutputsCPU.resize(this->engineIO.outputBuffersCPU.size());
 
-    // a combined pointer for model input
-    this->engineIO.combinedBuffersGPU.reserve(this->engineIO.inputBufferGPU.size() + this->engineIO.outputBuffersGPU.size());
+    // a combined pointer for model input, bindings of other profiles stay unbound
+    this->engineIO.combinedBuffersGPU.reserve(totalBindingCount);
+    this->engineIO.combinedBuffersGPU.assign(this->bindingOffset, nullptr);
     this->engineIO.combinedBuffersGPU.insert(this->engineIO.combinedBuffersGPU.end(), this->engineIO.inputBufferGPU.begin(),
                                              this->engineIO.inputBufferGPU.end());
     this->engineIO.combinedBuffersGPU.insert(this->engineIO.combinedBuffersGPU.end(), this->engineIO.outputBuffersGPU.begin(),
                                              this->engineIO.outputBuffersGPU.end());
+    this->engineIO.combinedBuffersGPU.resize(totalBindingCount, nullptr);
   } else {
     GST_INFO("skip allocating memory");
   }
@@ -210,16 +488,16 @@ void Yolov7trt::initEngineIO(bool allocateMem) {
 
 Yolov7trt::~Yolov7trt() {
   GST_INFO("destroy model");
+  cudaSetDevice(this->deviceID);
   this->context->destroy(); // TODO: deprecated
-  this->engine->destroy();  // TODO: deprecated
-  this->runtime->destroy(); // TODO: deprecated
   cudaStreamDestroy(this->stream);
+  for (cudaEvent_t &event : this->stageEvents) {
+    cudaEventDestroy(event);
+  }
   for (auto &ptr : this->engineIO.combinedBuffersGPU) {
     cudaFree(ptr);
   }
   for (auto &ptr : this->engineIO.outputBuffersCPU) {
-    cudaFreeHost(ptr);
+    this->hostAllocator.deallocate(ptr);
   }
-
-  delete this->gLogger;
 };
\ No newline at end of file
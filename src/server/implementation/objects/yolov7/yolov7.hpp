@@ -1,32 +1,163 @@
 
 #pragma once
+#include "Detector.hpp"
+#include "allocator.hpp"
+#include "letterbox.hpp"
 #include "utils.hpp"
 #include <NvInfer.h>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
 class Logger;
 
-class Yolov7trt {
+/// @brief page-locked host memory, so that async copies to/from the GPU are truly asynchronous
+class CudaHostAllocator : public utils::HostAllocator {
+public:
+  void *allocate(size_t bytes) override;
+  void deallocate(void *ptr) override;
+
+  /// @brief the process-wide instance used by default
+  static CudaHostAllocator &instance();
+};
 
+/// @brief a deserialized engine (runtime, logger and weights), shared by all execution contexts of a model
+class TrtEngine {
 public:
-  /// @brief the official pre-trained model classes. (COCO Dataset)
-  const static std::vector<std::string> CLASSNAMES;
+  /**
+   * @brief deserialize an engine
+   *
+   * @param inputSizes square input sizes to offer when the engine has a dynamic height/width, empty for the profile optimum
+   */
+  TrtEngine(const std::string &modelPath, const int &device, std::vector<int> inputSizes = {});
+  ~TrtEngine();
 
-  Yolov7trt(const std::string &modelPath, const int &device, std::string name);
-  ~Yolov7trt();
-  
-  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output);
+  nvinfer1::ICudaEngine *get() const { return this->engine; }
+  int getDeviceID() const { return this->deviceID; }
+
+  /// @brief the configured input sizes, every context keeps those within its optimization profile
+  const std::vector<int> &getRequestedSizes() const { return this->requestedSizes; }
+
+  /// @brief the optimization profile for the next execution context (round robin)
+  int nextProfile();
 
 private:
   int deviceID;
+  std::vector<int> requestedSizes;
   Logger *gLogger = nullptr;
   nvinfer1::IRuntime *runtime = nullptr;
   nvinfer1::ICudaEngine *engine = nullptr;
+  std::atomic<int> contextCount{0};
+
+  void initModel(const std::string &modelPath);
+
+  /// @brief deserialize straight from a read-only mapping of the file, returns false if the file cannot be mapped
+  bool deserializeMapped(const std::string &modelPath, size_t &size);
+};
+
+/// @brief one execution context (stream and IO buffers) on a shared TrtEngine
+class Yolov7trt : public Detector {
+
+public:
+  /// @brief load a private engine
+  Yolov7trt(const std::string &modelPath, const int &device, std::string name, int maxBatch = 1);
+
+  /**
+   * @brief create a context on a shared engine
+   *
+   * @param engine shared engine
+   * @param name name for logging
+   * @param maxBatch requested batch capacity, capped by the engine
+   * @param warmupCount warmup inferences
+   */
+  Yolov7trt(std::shared_ptr<TrtEngine> engine, std::string name, int maxBatch = 1, int warmupCount = 10);
+  Yolov7trt(std::shared_ptr<TrtEngine> engine, std::string name, int maxBatch, int warmupCount, utils::HostAllocator &hostAllocator);
+  ~Yolov7trt();
+
+  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) override;
+  void inferBatch(const std::vector<const cv::Mat *> &rgbImgs, std::vector<std::vector<utils::Obj>> &outputs) override;
+  int getMaxBatchSize() const override { return this->engineIO.maxBatch; }
+  int getDeviceId() const override { return this->deviceID; }
+  std::vector<int> getInputSizes() const override { return this->inputSizes; }
+  int getInputSize() const override { return this->requestedWH.load(std::memory_order_relaxed); }
+  bool setInputSize(int wh) override;
+  void setOutputLimits(float minConfidence, int maxCount) override;
+  void setMetrics(kurento::module::objdet::StageMetrics *metrics) override { this->metrics = metrics; }
+
+private:
+  int deviceID;
+
+  /// @brief the model's metrics, nullptr when not recording
+  kurento::module::objdet::StageMetrics *metrics = nullptr;
+
+  /// @brief recorded on the stream around the input copy, the engine run and the output copy, for their GPU times
+  cudaEvent_t stageEvents[4];
+
+  /// @brief input sizes supported by the engine and this context's profile, largest first
+  std::vector<int> inputSizes;
+
+  /// @brief input size set by setInputSize, picked up by the next inference
+  std::atomic<int> requestedWH{0};
+
+  /// @brief input size of the inference in progress
+  int inputWH = 0;
+
+  /// @brief input size of the last enqueue, for dynamic shape engines
+  int currentWH = 0;
+
+  //// applied by the postprocess
+  float minConfidence = 0;
+  int maxCount = std::numeric_limits<int>::max();
+
+  /// @brief requested batch capacity, capped by the engine
+  int requestedMaxBatch;
+
+  /// @brief batch size of the last enqueue, for dynamic batch engines
+  int currentBatch = 0;
+
+  /// @brief the optimization profile of this context and the index of its first binding
+  int profile = 0;
+  int bindingOffset = 0;
+
+  std::shared_ptr<TrtEngine> sharedEngine;
+  nvinfer1::ICudaEngine *engine = nullptr;
   nvinfer1::IExecutionContext *context = nullptr;
   cudaStream_t stream;
   utils::EngineIO engineIO;
 
-  void initModel(const std::string &modelPath);
+  /// @brief provider of the host-side staging buffers
+  utils::HostAllocator &hostAllocator;
+
+  /// @brief preprocessed input tensor on host (pinned by default), written in place by the preprocess
+  utils::HostBuffer<float> inputBufferCPU;
+
+  /// @brief letterbox info of the current frames, one per batch item
+  std::vector<utils::Yolov7Input> inputs;
+
+  /// @brief cached sampling tables of the fused preprocess, one per batch item
+  std::vector<utils::LetterboxPlan> letterboxPlans;
+
+  /// @brief output pointers of one batch item, handed to the postprocess
+  std::vector<void *> sampleOutputsCPU;
+
+  void initContext(int warmupCount);
+
+  /// @brief choose the input sizes from the input binding and the requested sizes
+  void initInputSizes();
   void initEngineIO();
   void initEngineIO(bool allocateMem);
+
+  /// @brief preprocess one image into the given batch slot
+  void preprocessSample(int index, const cv::Mat &rgbImg);
+
+  /// @brief copy the first batchSize slots in, run the engine and copy the results out
+  void run(int batchSize);
+
+  /// @brief convert the results of one batch slot
+  void postprocessSample(int index, std::vector<utils::Obj> &output);
+
+  /// @brief record the host time of a stage if recording
+  void recordStage(kurento::module::objdet::Stage stage, std::chrono::steady_clock::time_point start);
 };
\ No newline at end of file
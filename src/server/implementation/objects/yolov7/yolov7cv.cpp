@@ -0,0 +1,192 @@
+#include "yolov7cv.hpp"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <gst/gst.h>
+#include <stdexcept>
+
+GST_DEBUG_CATEGORY_STATIC(obj_det_yolov7cv);
+#define GST_CAT_DEFAULT obj_det_yolov7cv
+
+namespace fs = std::filesystem;
+
+static const int inputChannel = 3;
+
+/// @brief input size of the exported models when none is configured
+static const int defaultInputWH = 640;
+
+//// same defaults as the end-to-end export, so both backends report the same objects
+static const float confThreshold = 0.25f;
+static const float nmsThreshold = 0.45f;
+static const int topK = 100;
+
+/// @brief class offset that keeps a single NMS call from suppressing boxes of different classes
+static const int classOffset = 4096;
+
+Yolov7cv::Yolov7cv(const std::string &modelPath, std::string name, int warmupCount, std::vector<int> inputSizes) {
+  GST_DEBUG_CATEGORY_INIT(obj_det_yolov7cv, (std::string("ObjDetYolov7cv-") + name).c_str(), GST_DEBUG_BG_GREEN, "ObjDetYolov7cv");
+
+  GST_INFO("check model file");
+  if (fs::exists(modelPath) == false) {
+    GST_ERROR("model not found: %s", modelPath.c_str());
+    throw std::runtime_error("model not found: " + modelPath);
+  }
+
+  GST_INFO("load model");
+  this->net = cv::dnn::readNetFromONNX(modelPath);
+  if (this->net.empty()) {
+    GST_ERROR("model cannot load: %s", modelPath.c_str());
+    throw std::runtime_error("model cannot load: " + modelPath);
+  }
+  this->net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+  this->net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+  this->outputNames = this->net.getUnconnectedOutLayersNames();
+
+  if (inputSizes.empty()) {
+    inputSizes.push_back(defaultInputWH);
+  }
+  std::sort(inputSizes.begin(), inputSizes.end(), std::greater<int>());
+  inputSizes.erase(std::unique(inputSizes.begin(), inputSizes.end()), inputSizes.end());
+
+  // warmup, also rejects exports whose output layout is not supported and sizes a fixed-shape export cannot run at
+  GST_INFO("warmup");
+  std::vector<utils::Obj> dummyObjs;
+  for (int wh : inputSizes) {
+    this->requestedWH.store(wh, std::memory_order_relaxed);
+    try {
+      for (int i = 0; i < std::max(warmupCount, 1); i++) {
+        GST_DEBUG("warmup %d at %d", i, wh);
+        cv::Mat dummyImg(wh, wh, CV_8UC3, cv::Scalar(rand() % 256, rand() % 256, rand() % 256));
+        this->infer(dummyImg, dummyObjs);
+      }
+    } catch (const cv::Exception &e) {
+      GST_WARNING("input size %d is not supported by the model, skipped: %s", wh, e.what());
+      continue;
+    }
+    this->inputSizes.push_back(wh);
+  }
+  if (this->inputSizes.empty()) {
+    GST_ERROR("model cannot run at any configured input size: %s", modelPath.c_str());
+    throw std::runtime_error("model cannot run at any configured input size: " + modelPath);
+  }
+  this->requestedWH.store(this->inputSizes.front(), std::memory_order_relaxed);
+};
+
+bool Yolov7cv::setInputSize(int wh) {
+  if (wh == 0) {
+    wh = this->inputSizes.front();
+  }
+  if (std::find(this->inputSizes.begin(), this->inputSizes.end(), wh) == this->inputSizes.end()) {
+    GST_WARNING("input size %d is not supported by the model", wh);
+    return false;
+  }
+  this->requestedWH.store(wh, std::memory_order_relaxed);
+  return true;
+};
+
+void Yolov7cv::setOutputLimits(float minConfidence, int maxCount) {
+  this->minConfidence = minConfidence;
+  this->maxCount = maxCount;
+};
+
+void Yolov7cv::infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) {
+  int inputWH = this->requestedWH.load(std::memory_order_relaxed);
+  if (this->inputBlob.dims != 4 || this->inputBlob.size[2] != inputWH) {
+    GST_DEBUG("allocate input buffer at %d", inputWH);
+    int inputDims[] = {1, inputChannel, inputWH, inputWH};
+    this->inputBlob.create(4, inputDims, CV_32F);
+  }
+
+  GST_DEBUG("preprocess");
+  auto start = std::chrono::steady_clock::now();
+  utils::preprocessInto(rgbImg, this->inputBlob.ptr<float>(), this->input, this->letterboxPlan, inputWH, 114);
+  auto forwardStart = std::chrono::steady_clock::now();
+
+  GST_DEBUG("infer");
+  this->net.setInput(this->inputBlob);
+  this->net.forward(this->outputs, this->outputNames);
+  auto decodeStart = std::chrono::steady_clock::now();
+
+  GST_DEBUG("postprocess");
+  output.clear();
+  const cv::Mat &result = this->outputs[0];
+  if (result.dims == 2 && result.size[1] == 7) {
+    this->decodeEnd2End(result, output);
+  } else if (result.dims == 3 && result.size[0] == 1 && result.size[2] > 5) {
+    this->decodeRaw(result, output);
+  } else {
+    GST_ERROR("unsupported model output (%d dims), export the model with --grid or --end2end", result.dims);
+    throw std::runtime_error("unsupported model output");
+  }
+  if (this->metrics != nullptr) {
+    using kurento::module::objdet::Stage;
+    auto us = [](std::chrono::steady_clock::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+    this->metrics->record(Stage::PREPROCESS, us(forwardStart - start));
+    this->metrics->record(Stage::COMPUTE, us(decodeStart - forwardStart));
+    this->metrics->record(Stage::POSTPROCESS, kurento::module::objdet::elapsedUs(decodeStart));
+  }
+};
+
+// ================================================================================================================
+// private
+// ================================================================================================================
+
+void Yolov7cv::decodeEnd2End(const cv::Mat &output, std::vector<utils::Obj> &objs) {
+  const int rows = output.size[0];
+  for (int i = 0; i < rows; i++) {
+    const float *row = output.ptr<float>(i);
+    int classIdx = static_cast<int>(row[5]);
+    if (classIdx < 0 || classIdx >= static_cast<int>(utils::COCO_CLASSNAMES.size()) || row[6] < this->minConfidence) {
+      continue;
+    }
+    objs.push_back(utils::toObj(row[1], row[2], row[3], row[4], row[6], classIdx, this->input, utils::COCO_CLASSNAMES));
+  }
+  utils::selectTop(objs, this->minConfidence, this->maxCount);
+};
+
+void Yolov7cv::decodeRaw(const cv::Mat &output, std::vector<utils::Obj> &objs) {
+  const int rows = output.size[1];
+  const int cols = output.size[2];
+  const int classCount = std::min(cols - 5, static_cast<int>(utils::COCO_CLASSNAMES.size()));
+  const float *data = output.ptr<float>();
+  const float scoreThreshold = std::max(confThreshold, this->minConfidence);
+
+  this->nmsBoxes.clear();
+  this->candidateBoxes.clear();
+  this->candidateScores.clear();
+  this->candidateClasses.clear();
+  for (int i = 0; i < rows; i++) {
+    const float *row = data + static_cast<size_t>(i) * cols;
+    float objectness = row[4];
+    if (objectness < scoreThreshold) {
+      continue;
+    }
+    int classIdx = 0;
+    for (int c = 1; c < classCount; c++) {
+      if (row[5 + c] > row[5 + classIdx]) {
+        classIdx = c;
+      }
+    }
+    float score = objectness * row[5 + classIdx];
+    if (score < scoreThreshold) {
+      continue;
+    }
+    float x1 = row[0] - row[2] / 2;
+    float y1 = row[1] - row[3] / 2;
+    this->candidateBoxes.emplace_back(x1, y1, row[2], row[3]);
+    this->nmsBoxes.emplace_back(static_cast<int>(x1) + classIdx * classOffset, static_cast<int>(y1), static_cast<int>(row[2]),
+                                static_cast<int>(row[3]));
+    this->candidateScores.push_back(score);
+    this->candidateClasses.push_back(classIdx);
+  }
+
+  // the kept indices come by descending score, so the NMS top-K is the session's box limit
+  cv::dnn::NMSBoxes(this->nmsBoxes, this->candidateScores, scoreThreshold, nmsThreshold, this->keptIndices, 1.f,
+                    std::min(topK, this->maxCount));
+  for (int index : this->keptIndices) {
+    const cv::Rect2f &box = this->candidateBoxes[index];
+    objs.push_back(utils::toObj(box.x, box.y, box.x + box.width, box.y + box.height, this->candidateScores[index],
+                                this->candidateClasses[index], this->input, utils::COCO_CLASSNAMES));
+  }
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include "Detector.hpp"
+#include "letterbox.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <limits>
+#include <opencv2/opencv.hpp>
+
+/// @brief CPU inference with the OpenCV DNN module on an ONNX export of the model
+class Yolov7cv : public Detector {
+
+public:
+  /**
+   * @brief load an ONNX model
+   *
+   * @param modelPath ONNX file, exported either with --grid (raw [1, N, 85] output) or with --end2end for onnxruntime
+   *                  ([N, 7] output with NMS included)
+   * @param name name for logging
+   * @param warmupCount warmup inferences
+   * @param inputSizes square input sizes to offer, those the network cannot be reshaped to are dropped; empty for 640
+   */
+  Yolov7cv(const std::string &modelPath, std::string name, int warmupCount = 1, std::vector<int> inputSizes = {});
+
+  void infer(const cv::Mat &rgbImg, std::vector<utils::Obj> &output) override;
+  std::vector<int> getInputSizes() const override { return this->inputSizes; }
+  int getInputSize() const override { return this->requestedWH.load(std::memory_order_relaxed); }
+  bool setInputSize(int wh) override;
+  void setOutputLimits(float minConfidence, int maxCount) override;
+  void setMetrics(kurento::module::objdet::StageMetrics *metrics) override { this->metrics = metrics; }
+
+private:
+  cv::dnn::Net net;
+  std::vector<std::string> outputNames;
+
+  /// @brief input sizes that passed the warmup, largest first
+  std::vector<int> inputSizes;
+
+  /// @brief input size set by setInputSize, picked up by the next inference
+  std::atomic<int> requestedWH{0};
+
+  /// @brief the model's metrics, nullptr when not recording
+  kurento::module::objdet::StageMetrics *metrics = nullptr;
+
+  //// applied by the decoding
+  float minConfidence = 0;
+  int maxCount = std::numeric_limits<int>::max();
+
+  /// @brief preprocessed 1x3xWHxWH input tensor, written in place by the preprocess
+  cv::Mat inputBlob;
+  utils::Yolov7Input input;
+  utils::LetterboxPlan letterboxPlan;
+  std::vector<cv::Mat> outputs;
+
+  //// scratch of the raw output decoding, reused across frames
+  std::vector<cv::Rect> nmsBoxes;
+  std::vector<cv::Rect2f> candidateBoxes;
+  std::vector<float> candidateScores;
+  std::vector<int> candidateClasses;
+  std::vector<int> keptIndices;
+
+  /// @brief decode an end-to-end output, rows of [batch, x1, y1, x2, y2, class, score]
+  void decodeEnd2End(const cv::Mat &output, std::vector<utils::Obj> &objs);
+
+  /// @brief decode a raw output, rows of [cx, cy, w, h, objectness, class scores...], followed by NMS
+  void decodeRaw(const cv::Mat &output, std::vector<utils::Obj> &objs);
+};